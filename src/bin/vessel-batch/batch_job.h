@@ -0,0 +1,415 @@
+#pragma once
+#ifndef _BATCH_JOB_
+#define _BATCH_JOB_
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+
+#include <QDir>
+#include <QFileInfo>
+
+#include <geogram/basic/logger.h>
+
+#include "datatype.h"
+#include "task_pool.h"
+#include "mask_stack.h"
+#include "mask_dilation.h"
+#include "slice_interpolation.h"
+#include "brick_volume.h"
+#include "slab_surface.h"
+#include "mesh_smoothing.h"
+#include "mesh_decimation.h"
+#include "slab_stream.h"
+#include "mesh_stream.h"
+
+//most slices interpolated between two masks from the spacing
+#define BATCH_MAX_INSERTED_SLICES 15
+
+struct BatchOptions
+{
+	std::string output_dir = ".";
+	int expand_level = EXPANDLEVEL;
+	std::string extension = ".ply";//.ply, .stl, .geogram or .obj
+	bool compress = false;
+	bool normals = true;
+	bool merge = true;//coplanar faces merged into rectangles, in memory only
+	bool smooth = false;//vertices on a surface net, in memory only, never merged
+	int taubin = 0;//Taubin smoothing passes, in memory only, faces then not merged
+	size_t budget = 0;//most triangles of a mesh, in memory only; 0: no limit
+	double keep = 1.0;//share of the triangles of a mesh kept, in memory only
+	int window_slices = 0;//0: the whole stack only
+	int window_step = 0;//0: window_slices
+	int slab_slices = 0;//0: in memory, else streamed that many slices at a time
+	VoxelSpacing spacing = VoxelSpacing(0, 0, 0);//when valid, else the scan's spacing.txt, else SCALEVOXEL
+	int interpolate = 0;//slices inserted between two masks, in memory only; -1: from the spacing
+
+	bool decimates() const { return budget > 0 || keep < 1.0; }
+
+	//triangles a mesh of nb_triangles is decimated to
+	size_t triangle_budget(size_t nb_triangles) const {
+		size_t n = size_t(std::ceil(double(nb_triangles)*std::min(std::max(keep, 0.0), 1.0)));
+		return (budget > 0) ? std::min(n, budget) : n;
+	}
+};
+
+//seconds spent in each step of one scan
+struct BatchTimes
+{
+	double load = 0;//decode, expand and interpolate
+	double volume = 0;//crop and voxelize
+	double extract = 0;//faces of every piece
+	double mesh = 0;//weld, smooth, decimate and normals
+	double write = 0;
+
+	double total() const { return load + volume + extract + mesh + write; }
+};
+
+//One scan, dir/vein, dir/artery and dir/micro, to a mesh file per label:
+//the whole stack and, with window_slices, overlapping windows of it, all
+//placed in the geometry of the whole stack so they overlay. Every step
+//runs on the task pool; in memory the masks are decoded and expanded once
+//and each slice is meshed once whatever the number of windows, streamed
+//(slab_slices) only the whole stack is written, without normals, as the
+//voxel hull with a triangle pair per face and only at the mask slices.
+//In memory, interpolate inserts shape-interpolated slices between every
+//two masks so that the voxels of a very anisotropic stack are not long
+//and flat; windows stay given in mask slices. Also in memory only, each
+//mesh may be decimated to a budget (see mesh_decimation.h).
+class BatchJob
+{
+public:
+	BatchJob(const std::string &dir, const BatchOptions &options) : options_(options),
+		nb_windows_(0), nb_vertices_(0), nb_triangles_(0), ok_(false) {
+		dir_ = dir;
+		if (!dir_.empty() && dir_.back() != '/' && dir_.back() != '\\')
+		{
+			dir_ += '/';
+		}
+		name_ = QDir(QString::fromStdString(dir_)).dirName().toStdString();
+	}
+
+	bool run() {
+		ok_ = false;
+		Clock::time_point t = Clock::now();
+		if (!masks_.open(dir_, { "vein/", "artery/", "micro/" }, VoxelSpacing(1.0, 1.0, SCALEVOXEL)))
+		{
+			GEO::Logger::err("Batch") << name_ << ": no masks under " << dir_ << std::endl;
+			return false;
+		}
+		if (options_.spacing.valid())
+		{
+			masks_.dims.spacing = options_.spacing;
+		}
+		inserted_ = (options_.interpolate < 0) ? masks_.dims.spacing.slices_between(BATCH_MAX_INSERTED_SLICES)
+			: std::min(options_.interpolate, BATCH_MAX_INSERTED_SLICES);
+		if (options_.slab_slices > 0 && inserted_ > 0)
+		{
+			GEO::Logger::warn("Batch") << name_ << ": streamed, no slice interpolated" << std::endl;
+			inserted_ = 0;
+		}
+		expand_ = masks_.files[VEIN].size() == masks_.files[ARTERY].size();
+		if (!expand_)
+		{
+			GEO::Logger::warn("Batch") << name_ << ": inequivalent size for vein-artery, not expanded"
+				<< std::endl;
+		}
+		ok_ = options_.slab_slices > 0 ? stream(t) : mesh_in_memory(t);
+		GEO::Logger::out("Batch") << name_ << ": " << masks_.nb_slices << " slices, "
+			<< nb_triangles_ << " triangles in " << times_.total() << " s"
+			<< (ok_ ? "" : " (failed)") << std::endl;
+		return ok_;
+	}
+
+	const BatchTimes& times() const { return times_; }
+
+	//appends a CSV row, and the header to a new file
+	bool report(const std::string &file) const {
+		const bool header = !QFileInfo(QString::fromStdString(file)).exists();
+		std::ofstream out(file.c_str(), std::ios::app);
+		if (!out)
+		{
+			return false;
+		}
+		if (header)
+		{
+			out << "scan,slices,width,height,windows,vertices,triangles,"
+				"load_s,volume_s,extract_s,mesh_s,write_s,total_s,ok\n";
+		}
+		out << name_ << ',' << masks_.nb_slices << ',' << masks_.dims.width << ',' << masks_.dims.height << ','
+			<< nb_windows_ << ',' << nb_vertices_ << ',' << nb_triangles_ << ','
+			<< times_.load << ',' << times_.volume << ',' << times_.extract << ',' << times_.mesh << ','
+			<< times_.write << ',' << times_.total() << ',' << (ok_ ? 1 : 0) << '\n';
+		return bool(out);
+	}
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	//seconds since t, t moved to now
+	static double lap(Clock::time_point &t) {
+		Clock::time_point now = Clock::now();
+		double s = std::chrono::duration<double>(now - t).count();
+		t = now;
+		return s;
+	}
+
+	//the whole stack then the windows, as ranges of mask slices
+	std::vector<std::pair<int, int>> windows() const {
+		const int n = masks_.nb_slices;
+		std::vector<std::pair<int, int>> w(1, std::pair<int, int>(0, n));
+		const int size = options_.window_slices;
+		const int step = options_.window_step > 0 ? options_.window_step : size;
+		if (size > 0 && size < n)
+		{
+			for (int z = 0; z < n; z += step)
+			{
+				int z1 = std::min(z + size, n);
+				w.push_back(std::pair<int, int>(z1 - size, z1));
+				if (z1 == n)
+				{
+					break;
+				}
+			}
+		}
+		return w;
+	}
+
+	//out/scan_label[_wi].ext, window 0 being the whole stack
+	std::string file(int label, int window) const {
+		static const char *names[3] = { "vein", "artery", "micro" };
+		std::string f = options_.output_dir + "/" + name_ + "_" + names[label];
+		if (window > 0)
+		{
+			f += "_w" + std::to_string(window - 1);
+		}
+		return f + options_.extension + (options_.compress ? ".gz" : "");
+	}
+
+	//grows vein and artery of mask slice z into micro, in the slices they have masks for
+	void expand(int z, std::vector<SliceMask> &slice) const {
+		if (expand_ && masks_.has_mask(VEIN, z) && masks_.has_mask(ARTERY, z))
+		{
+			SliceMask vein_added, artery_added;
+			expand_labels(slice[VEIN], slice[ARTERY], slice[MICRO], options_.expand_level,
+				vein_added, artery_added);
+			merge_mask(vein_added, slice[VEIN]);
+			merge_mask(artery_added, slice[ARTERY]);
+		}
+	}
+
+	//slice z of the volume, with inserted_ slices between two masks
+	int volume_slice(int z) const {
+		return z*(inserted_ + 1);
+	}
+
+	VoxelGeometry geometry() const {
+		const int n = (masks_.dims.slice - 1)*(inserted_ + 1) + 1;
+		return VoxelGeometry(masks_.dims.width, masks_.dims.height, n, IMAGEWIDTHSIZE,
+			masks_.dims.spacing.refined(inserted_));
+	}
+
+	//inserted_ slices between every two of the n masks of each label
+	void interpolate(std::vector<std::vector<SliceMask>> &slices) const {
+		const int n = int(slices.size());
+		std::vector<std::vector<SliceMask>> fine((n - 1)*(inserted_ + 1) + 1);
+		for (int z = 0; z < n; z++)
+		{
+			fine[volume_slice(z)].swap(slices[z]);
+		}
+		task_parallel_for(0, GEO::index_t(n - 1), [&](GEO::index_t z) {
+			const std::vector<SliceMask> &a = fine[volume_slice(int(z))];
+			const std::vector<SliceMask> &b = fine[volume_slice(int(z) + 1)];
+			std::vector<SliceMask> between;
+			for (int l = 0; l < a.size(); l++)
+			{
+				interpolate_masks(a[l], b[l], inserted_, between);
+				for (int i = 0; i < inserted_; i++)
+				{
+					std::vector<SliceMask> &s = fine[volume_slice(int(z)) + 1 + i];
+					s.resize(a.size());
+					s[l] = std::move(between[i]);
+				}
+			}
+		});
+		slices.swap(fine);
+	}
+
+	bool mesh_in_memory(Clock::time_point &t) {
+		std::vector<std::vector<SliceMask>> slices(masks_.nb_slices);
+		std::vector<PixelBox> slice_box(masks_.nb_slices);
+		task_pool().run([&] {
+			task_parallel_for(0, GEO::index_t(slices.size()), [&](GEO::index_t z) {
+				masks_.read_slice(int(z), slices[z]);
+				expand(int(z), slices[z]);
+				for (int l = 0; l < 3; l++)
+				{
+					slice_box[z].merge(slices[z][l].box);
+				}
+			});
+			//interpolated pixels are in the masks around them, so in the box
+			if (inserted_ > 0 && slices.size() > 1)
+			{
+				interpolate(slices);
+			}
+		});
+		times_.load = lap(t);
+		const int n = int(slices.size());
+
+		//expanded pixels are micro ones, the box is that of the masks
+		StackDims &dims = masks_.dims;
+		dims.crop_to(slice_box);
+		BrickVolume volume(dims.width, dims.height, n, 3);
+		for (int z = 0; z < n; z++)
+		{
+			for (int l = 0; l < 3; l++)
+			{
+				slices[z][l].for_each_pixel([&](int x, int y) {
+					volume.set(l, x - dims.min_x, y - dims.min_y, z);
+				});
+			}
+			std::vector<SliceMask>().swap(slices[z]);
+		}
+		times_.volume = lap(t);
+
+		const std::vector<int> &priority = vessel_label_priority();
+		std::vector<std::pair<int, int>> w = windows();
+		std::vector<int> cuts;
+		for (int i = 0; i < w.size(); i++)
+		{
+			w[i].first = volume_slice(w[i].first);
+			w[i].second = volume_slice(w[i].second - 1) + 1;
+			cuts.push_back(w[i].first);
+			cuts.push_back(w[i].second);
+		}
+		SlabSurfaces slabs;
+		task_pool().run([&] {
+			slabs.extract(volume, priority, cuts, 0, options_.merge && options_.taubin <= 0, options_.smooth);
+		});
+		times_.extract = lap(t);
+
+		//a window at a time, so only its three meshes are in memory
+		const VoxelGeometry g = geometry();
+		bool ok = true;
+		nb_windows_ = int(w.size()) - 1;
+		for (int i = 0; i < w.size(); i++)
+		{
+			IndexedMesh surfaces[3];
+			task_pool().run([&] {
+				LabelFaces caps;
+				slabs.window_caps(w[i].first, w[i].second, caps);
+				//smoothed and decimated once for the three labels, so that they keep meeting
+				MultiLabelSurface surface;
+				if (options_.taubin > 0 || options_.decimates())
+				{
+					slabs.window_surface(w[i].first, w[i].second, caps, g, surface);
+					smooth_voxel_surface(surface, g, options_.taubin);
+					if (options_.decimates())
+					{
+						std::vector<size_t> targets(3);
+						for (int l = 0; l < 3; l++)
+						{
+							targets[l] = options_.triangle_budget(surface.nb_label_triangles(l));
+						}
+						decimate_surface(surface, targets);
+					}
+				}
+				task_parallel_for(0, 3, [&](GEO::index_t l) {
+					if (options_.taubin > 0 || options_.decimates())
+					{
+						surface.label_mesh(int(l), surfaces[l]);
+					}
+					else
+					{
+						slabs.window_mesh(int(l), w[i].first, w[i].second, caps, g, surfaces[l]);
+					}
+					if (!options_.normals)
+					{
+						std::vector<float>().swap(surfaces[l].normals);
+					}
+				});
+			});
+			times_.mesh += lap(t);
+
+			bool saved[3] = { false, false, false };
+			task_pool().run([&] {
+				task_parallel_for(0, 3, [&](GEO::index_t l) {
+					saved[l] = MeshStreamWriter::write(surfaces[l], file(int(l), i), options_.compress);
+				});
+			});
+			for (int l = 0; l < 3; l++)
+			{
+				if (!saved[l])
+				{
+					GEO::Logger::err("Batch") << "cannot write " << file(l, i) << std::endl;
+				}
+				ok = ok && saved[l];
+				nb_vertices_ += int64_t(surfaces[l].nb_vertices());
+				nb_triangles_ += int64_t(surfaces[l].nb_triangles());
+			}
+			times_.write += lap(t);
+		}
+		return ok;
+	}
+
+	//the whole stack only, streamed without normals; decoding and meshing
+	//are interleaved slab by slab so both count as extract time
+	bool stream(Clock::time_point &t) {
+		masks_.crop();
+		times_.load = lap(t);
+
+		MeshStreamWriter writers[3];
+		std::vector<MeshStreamWriter*> outputs;
+		for (int l = 0; l < 3; l++)
+		{
+			if (!writers[l].open(file(l, 0), options_.compress))
+			{
+				GEO::Logger::err("Batch") << "cannot write " << file(l, 0) << std::endl;
+				return false;
+			}
+			outputs.push_back(&writers[l]);
+		}
+		SlabStream::SliceSource source = [&](int z, std::vector<SliceMask> &slice) {
+			masks_.read_slice(z, slice);
+			expand(z, slice);
+		};
+		SlabStream stream(masks_.dims, masks_.nb_slices, 3, vessel_label_priority(), geometry());
+		task_pool().run([&] {
+			stream.write(source, options_.slab_slices, outputs);
+		});
+		times_.extract = lap(t);
+
+		bool ok = true;
+		for (int l = 0; l < 3; l++)
+		{
+			nb_vertices_ += writers[l].nb_vertices();
+			nb_triangles_ += writers[l].nb_triangles();
+			if (!writers[l].close())
+			{
+				GEO::Logger::err("Batch") << "cannot write " << file(l, 0) << std::endl;
+				ok = false;
+			}
+		}
+		times_.write = lap(t);
+		return ok;
+	}
+
+	std::string dir_;
+	std::string name_;
+	BatchOptions options_;
+	MaskStack masks_;
+	bool expand_ = false;
+	int inserted_ = 0;//slices interpolated between two masks
+	BatchTimes times_;
+	int nb_windows_;
+	int64_t nb_vertices_;
+	int64_t nb_triangles_;
+	bool ok_;
+};
+
+#endif
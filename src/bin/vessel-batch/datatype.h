@@ -0,0 +1,15 @@
+#pragma once
+#ifndef _BATCH_DATATYPE_
+#define _BATCH_DATATYPE_
+
+#define IMAGEWIDTHSIZE 0.5
+#define SCALEVOXEL 5.5//slice thickness in pixels when the masks have no spacing.txt
+
+#define EXPANDLEVEL 3
+
+enum VesselType
+{
+	VEIN, ARTERY, MICRO
+};
+
+#endif
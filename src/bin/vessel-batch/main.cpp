@@ -0,0 +1,113 @@
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <QDir>
+
+#include <geogram/basic/common.h>
+#include <geogram/basic/logger.h>
+#include <geogram/basic/command_line.h>
+#include <geogram/basic/command_line_args.h>
+
+#include "batch_job.h"
+
+//Converts mask stacks to meshes without a window, for batch runs:
+//  vesselBatch batch:out=meshes batch:expand=3 batch:format=ply batch:window_slices=10
+//    batch:window_step=2 batch:report=times.csv scans/a scans/b ...
+//every scan directory holds vein/, artery/ and micro/ masks and maybe a
+//spacing.txt; the meshes of scan a are written to out/a_vein.ply,
+//out/a_vein_w0.ply, ...
+int main(int argc, char** argv) {
+	GEO::initialize();
+	GEO::CmdLine::import_arg_group("standard");
+
+	GEO::CmdLine::declare_arg_group("batch", "Mask stack to mesh conversion");
+	GEO::CmdLine::declare_arg("batch:out", ".", "directory the meshes are written to");
+	GEO::CmdLine::declare_arg("batch:expand", EXPANDLEVEL, "rings vein and artery grow into micro");
+	GEO::CmdLine::declare_arg("batch:format", "ply", "ply, stl, geogram or obj");
+	GEO::CmdLine::declare_arg("batch:compress", false, "write the meshes through zlib, as .gz (not geogram)");
+	GEO::CmdLine::declare_arg("batch:normals", true, "write vertex normals (ply, geogram, obj)");
+	GEO::CmdLine::declare_arg("batch:merge", true, "merge coplanar voxel faces into rectangles (not streamed)");
+	GEO::CmdLine::declare_arg("batch:smooth", false, "smooth surface nets instead of the voxel hull (not streamed)");
+	GEO::CmdLine::declare_arg("batch:taubin", 0,
+		"Taubin smoothing passes, vertices kept within half a voxel (not streamed)");
+	GEO::CmdLine::declare_arg("batch:budget", 0, "most triangles of each mesh, decimated down to it (not streamed)");
+	GEO::CmdLine::declare_arg_percent("batch:keep", 100.0, "triangles of each mesh kept, decimated down to it (not streamed)");
+	GEO::CmdLine::declare_arg("batch:window_slices", 0, "slices per window, 0 for the whole stack only");
+	GEO::CmdLine::declare_arg("batch:window_step", 0, "slices between two windows, 0 for window_slices");
+	GEO::CmdLine::declare_arg("batch:slab_slices", 0,
+		"stream the whole stack this many slices at a time, for stacks too big for memory; 0 meshes it in memory");
+	GEO::CmdLine::declare_arg("batch:spacing", "",
+		"voxel size \"x y z\" for every scan; else each scan's spacing.txt, else 1 1 SCALEVOXEL");
+	GEO::CmdLine::declare_arg("batch:interpolate", 0,
+		"slices interpolated between two masks (not streamed), -1 as many as the spacing needs");
+	GEO::CmdLine::declare_arg("batch:report", "", "CSV file a row of timings per scan is appended to");
+
+	std::vector<std::string> scans;
+	if (!GEO::CmdLine::parse(argc, argv, scans, "<scan_dir>*"))
+	{
+		return 1;
+	}
+	if (scans.empty())
+	{
+		GEO::Logger::err("Batch") << "no scan directory given" << std::endl;
+		return 1;
+	}
+
+	BatchOptions options;
+	options.output_dir = GEO::CmdLine::get_arg("batch:out");
+	options.expand_level = GEO::CmdLine::get_arg_int("batch:expand");
+	options.extension = "." + GEO::CmdLine::get_arg("batch:format");
+	options.compress = GEO::CmdLine::get_arg_bool("batch:compress");
+	options.normals = GEO::CmdLine::get_arg_bool("batch:normals");
+	options.merge = GEO::CmdLine::get_arg_bool("batch:merge");
+	options.smooth = GEO::CmdLine::get_arg_bool("batch:smooth");
+	options.taubin = GEO::CmdLine::get_arg_int("batch:taubin");
+	options.budget = size_t(std::max(GEO::CmdLine::get_arg_int("batch:budget"), 0));
+	options.keep = GEO::CmdLine::get_arg_percent("batch:keep", 1.0);
+	options.window_slices = GEO::CmdLine::get_arg_int("batch:window_slices");
+	options.window_step = GEO::CmdLine::get_arg_int("batch:window_step");
+	options.slab_slices = GEO::CmdLine::get_arg_int("batch:slab_slices");
+	options.interpolate = GEO::CmdLine::get_arg_int("batch:interpolate");
+	const std::string spacing = GEO::CmdLine::get_arg("batch:spacing");
+	if (!spacing.empty() && !options.spacing.parse(spacing))
+	{
+		GEO::Logger::err("Batch") << "bad spacing " << spacing << ", three sizes expected" << std::endl;
+		return 1;
+	}
+	const std::string report = GEO::CmdLine::get_arg("batch:report");
+	if (mesh_file_format(options.extension) == MESH_FILE_UNKNOWN)
+	{
+		GEO::Logger::err("Batch") << "unknown format " << GEO::CmdLine::get_arg("batch:format") << std::endl;
+		return 1;
+	}
+	if (options.compress && mesh_file_format(options.extension) == MESH_FILE_GEOGRAM)
+	{
+		GEO::Logger::err("Batch") << "geogram cannot load compressed .geogram.gz files, drop batch:compress" << std::endl;
+		return 1;
+	}
+	if (!QDir().mkpath(QString::fromStdString(options.output_dir)))
+	{
+		GEO::Logger::err("Batch") << "cannot create " << options.output_dir << std::endl;
+		return 1;
+	}
+
+	//scans one after the other, each one using every thread
+	int failed = 0;
+	for (int i = 0; i < scans.size(); i++)
+	{
+		BatchJob job(scans[i], options);
+		if (!job.run())
+		{
+			failed++;
+		}
+		if (!report.empty() && !job.report(report))
+		{
+			GEO::Logger::err("Batch") << "cannot write " << report << std::endl;
+		}
+	}
+	GEO::Logger::out("Batch") << scans.size() - failed << " of " << scans.size() << " scans converted"
+		<< std::endl;
+	GEO::terminate();
+	return failed == 0 ? 0 : 1;
+}
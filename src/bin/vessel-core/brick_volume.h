@@ -0,0 +1,272 @@
+#pragma once
+#ifndef _BRICK_VOLUME_
+#define _BRICK_VOLUME_
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+
+#include "occupancy_grid.h"
+
+//Sparse label volume made of 8x8x8 bricks.
+//A top-level table gives the brick of each 8^3 block of the volume, -1
+//when no label has a voxel there, so memory follows the occupied blocks
+//instead of the bounding box. A brick holds one 512-bit mask per label,
+//as 8 words (one per z plane) with bit y*8+x, so neighbour planes are
+//compared word by word and x/y neighbours are one shift away.
+
+#define BRICK_SHIFT 3
+#define BRICK_SIZE 8
+
+//below this many bricks per part surfaces are extracted on one thread
+#define BRICKS_MIN_PER_PART 256
+
+static const uint64_t brick_column0 = 0x0101010101010101ULL;//x == 0
+static const uint64_t brick_column7 = 0x8080808080808080ULL;//x == 7
+
+class BrickVolume
+{
+public:
+	BrickVolume() : nx(0), ny(0), nz(0), nbx(0), nby(0), nbz(0), labels(0) {}
+
+	BrickVolume(int nx_, int ny_, int nz_, int nb_labels_) : nx(0), ny(0), nz(0),
+		nbx(0), nby(0), nbz(0), labels(0) {
+		resize(nx_, ny_, nz_, nb_labels_);
+	}
+
+	void resize(int nx_, int ny_, int nz_, int nb_labels_) {
+		nx = std::max(nx_, 0);
+		ny = std::max(ny_, 0);
+		nz = std::max(nz_, 0);
+		labels = std::max(nb_labels_, 1);
+		nbx = (nx + BRICK_SIZE - 1) >> BRICK_SHIFT;
+		nby = (ny + BRICK_SIZE - 1) >> BRICK_SHIFT;
+		nbz = (nz + BRICK_SIZE - 1) >> BRICK_SHIFT;
+		table.assign(size_t(nbx)*size_t(nby)*size_t(nbz), -1);
+		slots.clear();
+		words.clear();
+	}
+
+	int size_x() const { return nx; }
+	int size_y() const { return ny; }
+	int size_z() const { return nz; }
+	int nb_labels() const { return labels; }
+	int nb_bricks() const { return int(slots.size()); }
+
+	bool inside(int x, int y, int z) const {
+		return x >= 0 && y >= 0 && z >= 0 && x < nx && y < ny && z < nz;
+	}
+
+	//allocates the brick on first use
+	void set(int label, int x, int y, int z) {
+		size_t s = table_index(x >> BRICK_SHIFT, y >> BRICK_SHIFT, z >> BRICK_SHIFT);
+		if (table[s] < 0)
+		{
+			table[s] = int32_t(slots.size());
+			slots.push_back(s);
+			words.resize(words.size() + size_t(labels)*BRICK_SIZE, 0);
+		}
+		plane(table[s], label, z & 7) |= uint64_t(1) << (((y & 7) << 3) | (x & 7));
+	}
+
+	//out of range reads as empty
+	bool get(int label, int x, int y, int z) const {
+		if (!inside(x, y, z))
+		{
+			return false;
+		}
+		int b = table[table_index(x >> BRICK_SHIFT, y >> BRICK_SHIFT, z >> BRICK_SHIFT)];
+		if (b < 0)
+		{
+			return false;
+		}
+		return (planes(b, label)[z & 7] >> (((y & 7) << 3) | (x & 7))) & 1;
+	}
+
+	//voxels with z in [z_from, z_from + size_z()) go to slice z - z_from
+	template <class Voxel>
+	void insert_voxels(int label, const std::vector<Voxel> &voxels, int z_from = 0) {
+		for (int i = 0; i < voxels.size(); i++)
+		{
+			set(label, voxels[i].x, voxels[i].y, voxels[i].z - z_from);
+		}
+	}
+
+	size_t count(int label) const {
+		size_t n = 0;
+		for (int b = 0; b < nb_bricks(); b++)
+		{
+			const uint64_t *p = planes(b, label);
+			for (int k = 0; k < BRICK_SIZE; k++)
+			{
+				n += count_bits(p[k]);
+			}
+		}
+		return n;
+	}
+
+	size_t memory_bytes() const {
+		return table.size()*sizeof(int32_t) + slots.size()*sizeof(size_t) +
+			words.size()*sizeof(uint64_t);
+	}
+
+	//allocated bricks in table order (z, then y, then x), the unit of parallel work
+	std::vector<int> brick_order() const {
+		std::vector<int> order;
+		order.reserve(slots.size());
+		for (size_t s = 0; s < table.size(); s++)
+		{
+			if (table[s] >= 0)
+			{
+				order.push_back(table[s]);
+			}
+		}
+		return order;
+	}
+
+	//same for the bricks holding slices of [z_from, z_to)
+	std::vector<int> brick_order(int z_from, int z_to) const {
+		std::vector<int> order;
+		const int bz_from = std::max(z_from, 0) >> BRICK_SHIFT;
+		const int bz_to = std::min((std::max(z_to, 0) + BRICK_SIZE - 1) >> BRICK_SHIFT, nbz);
+		for (size_t s = table_index(0, 0, bz_from); s < table_index(0, 0, bz_to); s++)
+		{
+			if (table[s] >= 0)
+			{
+				order.push_back(table[s]);
+			}
+		}
+		return order;
+	}
+
+	//voxel coordinates of the first voxel of a brick
+	void brick_origin(int b, int &x, int &y, int &z) const {
+		size_t s = slots[b];
+		x = int(s % size_t(nbx)) << BRICK_SHIFT;
+		y = int((s / size_t(nbx)) % size_t(nby)) << BRICK_SHIFT;
+		z = int(s / (size_t(nbx)*size_t(nby))) << BRICK_SHIFT;
+	}
+
+	//calls f(x, y, z) for every voxel of a label in brick b
+	template <class F>
+	void for_each_voxel_in_brick(int label, int b, F f) const {
+		int ox, oy, oz;
+		brick_origin(b, ox, oy, oz);
+		const uint64_t *p = planes(b, label);
+		for (int k = 0; k < BRICK_SIZE; k++)
+		{
+			uint64_t m = p[k];
+			while (m)
+			{
+				int bit = lowest_bit(m);
+				f(ox + (bit & 7), oy + (bit >> 3), oz + k);
+				m &= m - 1;
+			}
+		}
+	}
+
+	//calls f(x, y, z, dir) for every face of a label voxel in brick b
+	//whose neighbour in direction dir is not of that label
+	template <class F>
+	void for_each_face_in_brick(int label, int b, F f) const {
+		int ox, oy, oz;
+		brick_origin(b, ox, oy, oz);
+		const uint64_t *p = planes(b, label);
+		for (int dir = 0; dir < FACE_NB; dir++)
+		{
+			int n = neighbour_brick(b, dir);
+			const uint64_t *q = (n < 0) ? NULL : planes(n, label);
+			for (int k = 0; k < BRICK_SIZE; k++)
+			{
+				uint64_t m = p[k] & ~neighbour_word(dir, p, q, k);
+				while (m)
+				{
+					int bit = lowest_bit(m);
+					f(ox + (bit & 7), oy + (bit >> 3), oz + k, dir);
+					m &= m - 1;
+				}
+			}
+		}
+	}
+
+	//the 8 planes of a label in brick b
+	const uint64_t* label_planes(int b, int label) const {
+		return planes(b, label);
+	}
+
+	//brick next to b in direction dir, -1 when missing or outside the volume
+	int neighbour_brick(int b, int dir) const {
+		size_t s = slots[b];
+		int bx = int(s % size_t(nbx));
+		int by = int((s / size_t(nbx)) % size_t(nby));
+		int bz = int(s / (size_t(nbx)*size_t(nby)));
+		switch (dir)
+		{
+		case FACE_XPLUS: bx++; break;
+		case FACE_XMINUS: bx--; break;
+		case FACE_YPLUS: by++; break;
+		case FACE_YMINUS: by--; break;
+		case FACE_ZPLUS: bz++; break;
+		case FACE_ZMINUS: bz--; break;
+		default: break;
+		}
+		if (bx < 0 || by < 0 || bz < 0 || bx >= nbx || by >= nby || bz >= nbz)
+		{
+			return -1;
+		}
+		return table[table_index(bx, by, bz)];
+	}
+
+	//bit y*8+x of the result is the voxel next to (x, y, k) in direction dir,
+	//p are the planes of the brick and q those of its neighbour in that
+	//direction (NULL reads as empty)
+	static uint64_t neighbour_word(int dir, const uint64_t *p, const uint64_t *q, int k) {
+		uint64_t w = p[k];
+		switch (dir)
+		{
+		case FACE_XPLUS: return ((w >> 1) & ~brick_column7) | (q ? (q[k] & brick_column0) << 7 : 0);
+		case FACE_XMINUS: return ((w << 1) & ~brick_column0) | (q ? (q[k] & brick_column7) >> 7 : 0);
+		case FACE_YPLUS: return (w >> 8) | (q ? q[k] << 56 : 0);
+		case FACE_YMINUS: return (w << 8) | (q ? q[k] >> 56 : 0);
+		case FACE_ZPLUS: return (k + 1 < BRICK_SIZE) ? p[k + 1] : (q ? q[0] : 0);
+		case FACE_ZMINUS: return (k > 0) ? p[k - 1] : (q ? q[BRICK_SIZE - 1] : 0);
+		default: return 0;
+		}
+	}
+
+	template <class F>
+	void for_each_face(int label, F f) const {
+		std::vector<int> order = brick_order();
+		for (int i = 0; i < order.size(); i++)
+		{
+			for_each_face_in_brick(label, order[i], f);
+		}
+	}
+
+private:
+	size_t table_index(int bx, int by, int bz) const {
+		return (size_t(bz)*size_t(nby) + size_t(by))*size_t(nbx) + size_t(bx);
+	}
+
+	uint64_t& plane(int b, int label, int k) {
+		return words[(size_t(b)*size_t(labels) + size_t(label))*BRICK_SIZE + k];
+	}
+
+	const uint64_t* planes(int b, int label) const {
+		return &words[(size_t(b)*size_t(labels) + size_t(label))*BRICK_SIZE];
+	}
+
+	int nx;
+	int ny;
+	int nz;
+	int nbx;
+	int nby;
+	int nbz;
+	int labels;
+	std::vector<int32_t> table;//brick of each block, -1 when empty
+	std::vector<size_t> slots;//table entry of each brick
+	std::vector<uint64_t> words;//labels*8 planes per brick
+};
+
+#endif
@@ -0,0 +1,158 @@
+#pragma once
+#ifndef _CORNER_WELDER_
+#define _CORNER_WELDER_
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "task_pool.h"
+
+#include "occupancy_grid.h"
+
+//below this many words per part the prefix sum runs on one thread
+#define WELDER_MIN_WORDS_PER_PART 8192
+
+//Renumbers lattice corners (see lattice_corner_index) to consecutive
+//vertex ids in ascending lattice order, the order std::map iterates them.
+//Corners in use are one bit of a dense table over the slab of lattice
+//slices [z_from, z_from + nb_slices], and a prefix sum of the bit counts
+//per word turns a lookup into one popcount, so welding is linear in the
+//slab size with no allocation per corner.
+class CornerWelder
+{
+public:
+	CornerWelder() : base_(0), nb_lattice_(0), nb_corners_(0) {}
+
+	//covers the corners of voxel slices [z_from, z_from + nb_slices)
+	void resize(int width, int height, int z_from, int nb_slices) {
+		base_ = int64_t(z_from)*(width + 1)*(height + 1);
+		nb_lattice_ = int64_t(std::max(nb_slices, 0) + 1)*(width + 1)*(height + 1);
+		bits_.assign(size_t((nb_lattice_ + 63) / 64), 0);
+		ranks_.clear();
+		nb_corners_ = 0;
+	}
+
+	void insert(int corner) {
+		int64_t l = corner - base_;
+		bits_[size_t(l >> 6)] |= uint64_t(1) << (l & 63);
+	}
+
+	//marks the 8 corners of every voxel
+	template <class Voxel>
+	void insert_voxels(const std::vector<Voxel> &voxels, int width, int height) {
+		for (int i = 0; i < voxels.size(); i++)
+		{
+			for (int k = 0; k < 8; k++)
+			{
+				const int *o = cube_corner_offset[k];
+				insert(lattice_corner_index(voxels[i].x + o[0], voxels[i].y + o[1],
+					voxels[i].z + o[2], width, height));
+			}
+		}
+	}
+
+	//assigns the ids, must be called after the last insert()
+	void build() {
+		const GEO::index_t nw = GEO::index_t(bits_.size());
+		ranks_.resize(nw);
+		if (nw == 0)
+		{
+			nb_corners_ = 0;
+			return;
+		}
+		const GEO::index_t nb_parts = task_nb_parts(nw, WELDER_MIN_WORDS_PER_PART);
+
+		//count per part, scan the parts, then each part writes its running sum
+		std::vector<uint32_t> part_offset(nb_parts + 1, 0);
+		task_parallel_ranges(nw, nb_parts, [&](GEO::index_t part, GEO::index_t w_from, GEO::index_t w_to) {
+			uint32_t n = 0;
+			for (GEO::index_t w = w_from; w < w_to; w++)
+			{
+				n += uint32_t(count_bits(bits_[w]));
+			}
+			part_offset[part + 1] = n;
+		});
+		for (GEO::index_t p = 0; p < nb_parts; p++)
+		{
+			part_offset[p + 1] += part_offset[p];
+		}
+		task_parallel_ranges(nw, nb_parts, [&](GEO::index_t part, GEO::index_t w_from, GEO::index_t w_to) {
+			uint32_t n = part_offset[part];
+			for (GEO::index_t w = w_from; w < w_to; w++)
+			{
+				ranks_[w] = n;
+				n += uint32_t(count_bits(bits_[w]));
+			}
+		});
+		nb_corners_ = int(part_offset[nb_parts]);
+	}
+
+	int nb_corners() const { return nb_corners_; }
+
+	bool contains(int corner) const {
+		int64_t l = corner - base_;
+		if (l < 0 || l >= nb_lattice_)
+		{
+			return false;
+		}
+		return (bits_[size_t(l >> 6)] >> (l & 63)) & 1;
+	}
+
+	//vertex id of an inserted corner, -1 otherwise
+	int id(int corner) const {
+		if (!contains(corner))
+		{
+			return -1;
+		}
+		int64_t l = corner - base_;
+		uint64_t below = bits_[size_t(l >> 6)] & ((uint64_t(1) << (l & 63)) - 1);
+		return int(ranks_[size_t(l >> 6)]) + count_bits(below);
+	}
+
+	//calls f(corner) for every inserted corner, in id order
+	template <class F>
+	void for_each_corner(F f) const {
+		for (size_t w = 0; w < bits_.size(); w++)
+		{
+			uint64_t m = bits_[w];
+			while (m)
+			{
+				f(int(base_ + int64_t(w << 6) + lowest_bit(m)));
+				m &= m - 1;
+			}
+		}
+	}
+
+	//calls f(id, corner) for every inserted corner, split over threads by
+	//words of the table, so f must only write what belongs to its id
+	template <class F>
+	void parallel_for_each_corner(F f) const {
+		task_parallel_parts(GEO::index_t(bits_.size()), WELDER_MIN_WORDS_PER_PART,
+			[&](GEO::index_t w_from, GEO::index_t w_to) {
+			for (GEO::index_t w = w_from; w < w_to; w++)
+			{
+				int id = int(ranks_[w]);
+				uint64_t m = bits_[w];
+				while (m)
+				{
+					f(id++, int(base_ + int64_t(uint64_t(w) << 6) + lowest_bit(m)));
+					m &= m - 1;
+				}
+			}
+		});
+	}
+
+	size_t memory_bytes() const {
+		return bits_.size()*sizeof(uint64_t) + ranks_.size()*sizeof(uint32_t);
+	}
+
+private:
+	int64_t base_;
+	int64_t nb_lattice_;
+	int nb_corners_;
+	std::vector<uint64_t> bits_;
+	std::vector<uint32_t> ranks_;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#pragma once
+#ifndef _FACE_MERGE_
+#define _FACE_MERGE_
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+#include "occupancy_grid.h"
+#include "brick_volume.h"
+#include "corner_welder.h"
+
+//Greedy meshing of cuberille faces. The faces a brick reports are
+//gathered per direction, label pair and group, and the faces of one
+//plane of the brick are merged into rectangles: a run along a row, grown
+//over the next rows while they hold the same run. A flat wall then costs
+//two triangles per brick plane instead of two per voxel.
+//A merged rectangle is only split into triangles once the corners of the
+//whole surface are welded: every welded corner on one of its sides
+//becomes a vertex (see stitch_rectangle), so the neighbours of a large
+//rectangle meet it at vertices and not inside its edges (no T-junction)
+//and the surface stays closed.
+
+//f(u, v, du, dv) for rectangles covering the bits of an 8x8 mask, bit
+//v*8+u, each bit in one rectangle
+template <class F>
+inline void greedy_rectangles(uint64_t mask, F f)
+{
+	while (mask)
+	{
+		const int bit = lowest_bit(mask);
+		const int u = bit & 7, v = bit >> 3;
+		const uint64_t row = (mask >> bit) & (uint64_t(0xff) >> u);
+		const int du = lowest_bit(~row);
+		const uint64_t run = ((uint64_t(1) << du) - 1) << bit;
+		int dv = 1;
+		while (v + dv < 8 && (mask & (run << (8 * dv))) == (run << (8 * dv)))
+		{
+			dv++;
+		}
+		for (int i = 0; i < dv; i++)
+		{
+			mask &= ~(run << (8 * i));
+		}
+		f(u, v, du, dv);
+	}
+}
+
+//Faces of one brick, merged when it is flushed. group keeps apart faces
+//that go to different face lists (pieces and seams of a slab).
+class BrickFaceMerger
+{
+public:
+	//the faces of mask (bit y*8+x) in brick slice k
+	void add(uint64_t mask, int k, int dir, int front, int back, int group) {
+		for (int i = 0; i < entries_.size(); i++)
+		{
+			Entry &e = entries_[i];
+			if (e.dir == dir && e.front == front && e.back == back && e.group == group)
+			{
+				e.planes[k] |= mask;
+				return;
+			}
+		}
+		Entry e = { dir, front, back, group, { 0 } };
+		e.planes[k] = mask;
+		entries_.push_back(e);
+	}
+
+	//f(q, front, back, group) for the rectangles of the faces added since
+	//the last flush, q the 4 lattice corners counter-clockwise seen from
+	//the front label's outside; (ox, oy, oz) is the brick origin in the
+	//w x h lattice
+	template <class F>
+	void flush(int ox, int oy, int oz, int w, int h, F f) {
+		for (int i = 0; i < entries_.size(); i++)
+		{
+			const Entry &e = entries_[i];
+			//voxel box of a rectangle, then its corners in face order
+			auto quad = [&](int x0, int y0, int z0, int x1, int y1, int z1) {
+				const int *tri = cube_face_triangles[e.dir];
+				const int order[4] = { tri[0], tri[1], tri[2], tri[5] };
+				int q[4];
+				for (int c = 0; c < 4; c++)
+				{
+					const int *o = cube_corner_offset[order[c]];
+					q[c] = lattice_corner_index(ox + (o[0] ? x1 + 1 : x0), oy + (o[1] ? y1 + 1 : y0),
+						oz + (o[2] ? z1 + 1 : z0), w, h);
+				}
+				f(q, e.front, e.back, e.group);
+			};
+			if (e.dir == FACE_ZPLUS || e.dir == FACE_ZMINUS)
+			{
+				for (int k = 0; k < BRICK_SIZE; k++)
+				{
+					greedy_rectangles(e.planes[k], [&](int u, int v, int du, int dv) {
+						quad(u, v, k, u + du - 1, v + dv - 1, k);
+					});
+				}
+			}
+			else if (e.dir == FACE_YPLUS || e.dir == FACE_YMINUS)
+			{
+				//plane y, bit k*8+x
+				for (int y = 0; y < BRICK_SIZE; y++)
+				{
+					uint64_t m = 0;
+					for (int k = 0; k < BRICK_SIZE; k++)
+					{
+						m |= ((e.planes[k] >> (8 * y)) & 0xff) << (8 * k);
+					}
+					greedy_rectangles(m, [&](int u, int v, int du, int dv) {
+						quad(u, y, v, u + du - 1, y, v + dv - 1);
+					});
+				}
+			}
+			else
+			{
+				//plane x, bit k*8+y
+				for (int x = 0; x < BRICK_SIZE; x++)
+				{
+					uint64_t m = 0;
+					for (int k = 0; k < BRICK_SIZE; k++)
+					{
+						for (int y = 0; y < BRICK_SIZE; y++)
+						{
+							m |= ((e.planes[k] >> (8 * y + x)) & 1) << (8 * k + y);
+						}
+					}
+					greedy_rectangles(m, [&](int u, int v, int du, int dv) {
+						quad(x, u, v, x, u + du - 1, v + dv - 1);
+					});
+				}
+			}
+		}
+		entries_.clear();
+	}
+
+private:
+	struct Entry
+	{
+		int dir;
+		int front;
+		int back;
+		int group;
+		uint64_t planes[BRICK_SIZE];
+	};
+
+	std::vector<Entry> entries_;
+};
+
+//lattice corners of side a -> b of a rectangle that are in welder,
+//a and b included; returns their number
+inline int rectangle_side(int a, int b, const CornerWelder &welder, int w, int h, int *out)
+{
+	int ax, ay, az, bx, by, bz;
+	lattice_corner_position(a, w, h, ax, ay, az);
+	lattice_corner_position(b, w, h, bx, by, bz);
+	const int sx = (bx > ax) - (bx < ax), sy = (by > ay) - (by < ay), sz = (bz > az) - (bz < az);
+	const int len = std::abs(bx - ax) + std::abs(by - ay) + std::abs(bz - az);
+	int n = 0;
+	out[n++] = a;
+	for (int t = 1; t < len; t++)
+	{
+		int c = lattice_corner_index(ax + t*sx, ay + t*sy, az + t*sz, w, h);
+		if (welder.contains(c))
+		{
+			out[n++] = c;
+		}
+	}
+	out[n++] = b;
+	return n;
+}
+
+//Splits rectangle q (from BrickFaceMerger) into triangles with the welded
+//corners on its sides as vertices, f(a, b, c) for each, in the
+//orientation of q. Every triangle has two vertices on one side and one
+//on another side, so none is flat: with A = q0..q1, B = q3..q2, a fan
+//from A's second vertex covers the left side q0..q3, a fan from B's next
+//to last vertex covers the right side q1..q2, and a strip between A and
+//B covers the rest. n boundary vertices give n - 2 triangles, two when
+//no side has a vertex inside it.
+template <class F>
+inline void stitch_rectangle(const int q[4], const CornerWelder &welder, int w, int h, F f)
+{
+	int A[BRICK_SIZE + 1], B[BRICK_SIZE + 1], L[BRICK_SIZE + 1], R[BRICK_SIZE + 1];
+	const int na = rectangle_side(q[0], q[1], welder, w, h, A);
+	const int nb = rectangle_side(q[3], q[2], welder, w, h, B);
+	const int nl = rectangle_side(q[0], q[3], welder, w, h, L);
+	const int nr = rectangle_side(q[1], q[2], welder, w, h, R);
+
+	//left: apex A[1] over q3, the inner left vertices downwards, q0
+	for (int i = nl - 1; i > 0; i--)
+	{
+		f(A[1], L[i], L[i - 1]);
+	}
+	//right: apex B[nb - 2] over q1, the inner right vertices upwards, q2
+	for (int i = 0; i + 1 < nr; i++)
+	{
+		f(B[nb - 2], R[i], R[i + 1]);
+	}
+	//strip from edge A[1]-B[0] to edge A[na - 1]-B[nb - 2], advancing on
+	//the side whose next vertex is nearer q0 (resp. q3)
+	int pa[BRICK_SIZE + 1], pb[BRICK_SIZE + 1];
+	int x0, y0, z0, x, y, z;
+	lattice_corner_position(q[0], w, h, x0, y0, z0);
+	for (int i = 0; i < na; i++)
+	{
+		lattice_corner_position(A[i], w, h, x, y, z);
+		pa[i] = std::abs(x - x0) + std::abs(y - y0) + std::abs(z - z0);
+	}
+	lattice_corner_position(q[3], w, h, x0, y0, z0);
+	for (int i = 0; i < nb; i++)
+	{
+		lattice_corner_position(B[i], w, h, x, y, z);
+		pb[i] = std::abs(x - x0) + std::abs(y - y0) + std::abs(z - z0);
+	}
+	int i = 1, j = 0;
+	while (i < na - 1 || j < nb - 2)
+	{
+		if (j == nb - 2 || (i < na - 1 && pa[i + 1] <= pb[j + 1]))
+		{
+			f(A[i], A[i + 1], B[j]);
+			i++;
+		}
+		else
+		{
+			f(A[i], B[j + 1], B[j]);
+			j++;
+		}
+	}
+}
+
+//number of triangles stitch_rectangle() gives
+inline int stitched_rectangle_size(const int q[4], const CornerWelder &welder, int w, int h)
+{
+	int s[BRICK_SIZE + 1];
+	int n = 0;
+	for (int k = 0; k < 4; k++)
+	{
+		n += rectangle_side(q[k], q[(k + 1) & 3], welder, w, h, s) - 1;
+	}
+	return n - 2;
+}
+
+#endif
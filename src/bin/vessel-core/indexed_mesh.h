@@ -0,0 +1,43 @@
+#pragma once
+#ifndef _INDEXED_MESH_
+#define _INDEXED_MESH_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//Triangle surface with shared vertices.
+//positions and normals hold xyz floats in the same vertex order,
+//indices hold three vertex ids per triangle, outward oriented.
+struct IndexedMesh
+{
+	std::vector<float> positions;
+	std::vector<float> normals;
+	std::vector<uint32_t> indices;
+
+	size_t nb_vertices() const { return positions.size() / 3; }
+	size_t nb_triangles() const { return indices.size() / 3; }
+	bool empty() const { return indices.empty(); }
+
+	const float* position(size_t v) const { return &positions[3 * v]; }
+	const float* normal(size_t v) const { return &normals[3 * v]; }
+
+	void clear() {
+		positions.clear();
+		normals.clear();
+		indices.clear();
+	}
+
+	void swap(IndexedMesh &other) {
+		positions.swap(other.positions);
+		normals.swap(other.normals);
+		indices.swap(other.indices);
+	}
+
+	size_t memory_bytes() const {
+		return (positions.size() + normals.size())*sizeof(float) +
+			indices.size()*sizeof(uint32_t);
+	}
+};
+
+#endif
@@ -0,0 +1,581 @@
+#pragma once
+#ifndef _LABEL_SURFACE_
+#define _LABEL_SURFACE_
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "task_pool.h"
+
+#include "brick_volume.h"
+#include "corner_welder.h"
+#include "voxel_geometry.h"
+#include "indexed_mesh.h"
+#include "vertex_normals.h"
+#include "face_merge.h"
+#include "surface_nets.h"
+
+#define LABEL_SURFACE_MAX_LABELS 8
+
+//triangles of lattice corner ids tagged with the label they face out of
+//(front) and the label behind them (back, -1 for the background), and
+//merged rectangles tagged the same way, only split into triangles once
+//welded (see face_merge.h)
+struct LabelFaces
+{
+	std::vector<int> corners;//3 per triangle, outward from front
+	std::vector<int8_t> front;//per triangle
+	std::vector<int8_t> back;//per triangle
+	std::vector<int> quad_corners;//4 per rectangle, outward from quad_front
+	std::vector<int8_t> quad_front;//per rectangle
+	std::vector<int8_t> quad_back;//per rectangle
+
+	size_t nb_triangles() const { return front.size(); }
+	size_t nb_quads() const { return quad_front.size(); }
+
+	//two triangles for every face of mask, bit y*8+x is voxel (ox+x, oy+y, z)
+	void emit(uint64_t mask, int ox, int oy, int z, int dir, int f, int b, int w, int h) {
+		const int *tri = cube_face_triangles[dir];
+		while (mask)
+		{
+			int bit = lowest_bit(mask);
+			int x = ox + (bit & 7), y = oy + (bit >> 3);
+			for (int k = 0; k < 6; k++)
+			{
+				const int *c = cube_corner_offset[tri[k]];
+				corners.push_back(lattice_corner_index(x + c[0], y + c[1], z + c[2], w, h));
+			}
+			front.push_back(int8_t(f)); front.push_back(int8_t(f));
+			back.push_back(int8_t(b)); back.push_back(int8_t(b));
+			mask &= mask - 1;
+		}
+	}
+
+	void emit_quad(const int q[4], int f, int b) {
+		quad_corners.insert(quad_corners.end(), q, q + 4);
+		quad_front.push_back(int8_t(f));
+		quad_back.push_back(int8_t(b));
+	}
+
+	void append(const LabelFaces &other) {
+		corners.insert(corners.end(), other.corners.begin(), other.corners.end());
+		front.insert(front.end(), other.front.begin(), other.front.end());
+		back.insert(back.end(), other.back.begin(), other.back.end());
+		quad_corners.insert(quad_corners.end(), other.quad_corners.begin(), other.quad_corners.end());
+		quad_front.insert(quad_front.end(), other.quad_front.begin(), other.quad_front.end());
+		quad_back.insert(quad_back.end(), other.quad_back.begin(), other.quad_back.end());
+	}
+};
+
+//a face tagged front/back belongs to a label other than label
+inline bool faces_other_label(int front, int back, int label)
+{
+	return (front >= 0 && front != label) || (back >= 0 && back != label);
+}
+
+//The label priority of the vessel stacks, labels numbered as the VesselType
+//of the apps (vein 0, artery 1, micro 2): where masks overlap, artery over
+//vein over micro, as the expand step decides.
+inline const std::vector<int>& vessel_label_priority()
+{
+	static const std::vector<int> priority = { 1, 0, 2 };
+	return priority;
+}
+
+//planes of brick b with every voxel kept in its first label of priority only
+inline void exclusive_label_planes(const BrickVolume &volume, const std::vector<int> &priority,
+	int b, uint64_t planes[][BRICK_SIZE])
+{
+	for (int l = 0; l < volume.nb_labels(); l++)
+	{
+		std::fill(planes[l], planes[l] + BRICK_SIZE, uint64_t(0));
+	}
+	for (int k = 0; k < BRICK_SIZE; k++)
+	{
+		uint64_t taken = 0;
+		for (int i = 0; i < priority.size(); i++)
+		{
+			int l = priority[i];
+			planes[l][k] = volume.label_planes(b, l)[k] & ~taken;
+			taken |= planes[l][k];
+		}
+	}
+}
+
+//calls f(mask, k, dir, front, back) for the faces of brick b, whose planes
+//come from exclusive_label_planes(). Bit y*8+x of mask is voxel (x, y, k)
+//of the brick. A face between two labels is reported once, from the side
+//of the lower label.
+template <class F>
+inline void for_each_label_face_in_brick(const BrickVolume &volume, const std::vector<int> &priority,
+	int b, const uint64_t own[][BRICK_SIZE], F f)
+{
+	uint64_t nbr[LABEL_SURFACE_MAX_LABELS][BRICK_SIZE];
+	const int nl = volume.nb_labels();
+	for (int dir = 0; dir < FACE_NB; dir++)
+	{
+		int n = volume.neighbour_brick(b, dir);
+		if (n >= 0)
+		{
+			exclusive_label_planes(volume, priority, n, nbr);
+		}
+		for (int k = 0; k < BRICK_SIZE; k++)
+		{
+			uint64_t nw[LABEL_SURFACE_MAX_LABELS];
+			uint64_t any = 0;
+			for (int l = 0; l < nl; l++)
+			{
+				nw[l] = BrickVolume::neighbour_word(dir, own[l], n >= 0 ? nbr[l] : NULL, k);
+				any |= nw[l];
+			}
+			for (int l = 0; l < nl; l++)
+			{
+				if (own[l][k] == 0)
+				{
+					continue;
+				}
+				uint64_t m = own[l][k] & ~any;
+				if (m)
+				{
+					f(m, k, dir, l, -1);
+				}
+				for (int o = l + 1; o < nl; o++)
+				{
+					m = own[l][k] & nw[o];
+					if (m)
+					{
+						f(m, k, dir, l, o);
+					}
+				}
+			}
+		}
+	}
+}
+
+//Closed surface of one label out of tagged triangles and rectangles,
+//interfaces turned to face out of it. Corners are welded over voxel slices
+//[z_from, z_from + nb_slices) of a width x height lattice, rectangles are
+//split against the welded corners. Only marking the corners is serial,
+//the vertices are placed and the triangles of each face list renumbered
+//in parallel. With nets the vertices are placed on the smooth surface of
+//the label in those slices instead of at the corners, and those it shares
+//with another label where every label places them (see surface_nets.h).
+inline void weld_label_faces(const std::vector<const LabelFaces*> &faces, int label,
+	int width, int height, int z_from, int nb_slices, const VoxelGeometry &geometry, IndexedMesh &mesh,
+	const SurfaceNets *nets = NULL)
+{
+	mesh.clear();
+	CornerWelder welder;
+	welder.resize(width, height, z_from, nb_slices);
+	for (int p = 0; p < faces.size(); p++)
+	{
+		const LabelFaces &in = *faces[p];
+		for (size_t t = 0; t < in.nb_triangles(); t++)
+		{
+			if (in.front[t] == label || in.back[t] == label)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					welder.insert(in.corners[3 * t + k]);
+				}
+			}
+		}
+		for (size_t q = 0; q < in.nb_quads(); q++)
+		{
+			if (in.quad_front[q] == label || in.quad_back[q] == label)
+			{
+				for (int k = 0; k < 4; k++)
+				{
+					welder.insert(in.quad_corners[4 * q + k]);
+				}
+			}
+		}
+	}
+	welder.build();
+	std::vector<char> shared;
+	if (nets)
+	{
+		//the welded corners on the faces of other labels, rectangles have
+		//them on their sides
+		shared.assign(welder.nb_corners(), 0);
+		int side[BRICK_SIZE + 1];
+		for (int p = 0; p < faces.size(); p++)
+		{
+			const LabelFaces &in = *faces[p];
+			for (size_t t = 0; t < in.nb_triangles(); t++)
+			{
+				if (faces_other_label(in.front[t], in.back[t], label))
+				{
+					for (int k = 0; k < 3; k++)
+					{
+						const int id = welder.id(in.corners[3 * t + k]);
+						if (id >= 0)
+						{
+							shared[id] = 1;
+						}
+					}
+				}
+			}
+			for (size_t q = 0; q < in.nb_quads(); q++)
+			{
+				if (faces_other_label(in.quad_front[q], in.quad_back[q], label))
+				{
+					const int *c = &in.quad_corners[4 * q];
+					for (int k = 0; k < 4; k++)
+					{
+						const int n = rectangle_side(c[k], c[(k + 1) & 3], welder, width, height, side);
+						for (int i = 0; i < n; i++)
+						{
+							const int id = welder.id(side[i]);
+							if (id >= 0)
+							{
+								shared[id] = 1;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	//first index of the triangles of each face list
+	std::vector<size_t> offset(faces.size() + 1, 0);
+	task_parallel_for(0, GEO::index_t(faces.size()), [&](GEO::index_t p) {
+		const LabelFaces &in = *faces[p];
+		size_t n = 0;
+		for (size_t t = 0; t < in.nb_triangles(); t++)
+		{
+			n += (in.front[t] == label || in.back[t] == label);
+		}
+		for (size_t q = 0; q < in.nb_quads(); q++)
+		{
+			if (in.quad_front[q] == label || in.quad_back[q] == label)
+			{
+				n += stitched_rectangle_size(&in.quad_corners[4 * q], welder, width, height);
+			}
+		}
+		offset[p + 1] = 3 * n;
+	});
+	for (int p = 0; p < faces.size(); p++)
+	{
+		offset[p + 1] += offset[p];
+	}
+
+	mesh.positions.resize(3 * size_t(welder.nb_corners()));
+	welder.parallel_for_each_corner([&](int v, int corner) {
+		int x, y, z;
+		lattice_corner_position(corner, width, height, x, y, z);
+		double p[3];
+		if (nets && shared[v])
+		{
+			nets->place_shared(x, y, z, z_from, z_from + nb_slices, geometry, p);
+		}
+		else if (nets)
+		{
+			nets->place(label, x, y, z, z_from, z_from + nb_slices, geometry, p);
+		}
+		else
+		{
+			geometry.corner(x, y, z, 0, p);
+		}
+		mesh.positions[3 * size_t(v)] = float(p[0]);
+		mesh.positions[3 * size_t(v) + 1] = float(p[1]);
+		mesh.positions[3 * size_t(v) + 2] = float(p[2]);
+	});
+	mesh.indices.resize(offset.back());
+	task_parallel_for(0, GEO::index_t(faces.size()), [&](GEO::index_t p) {
+		const LabelFaces &in = *faces[p];
+		uint32_t *out = mesh.indices.data() + offset[p];
+		for (size_t t = 0; t < in.nb_triangles(); t++)
+		{
+			if (in.front[t] == label)
+			{
+				*out++ = uint32_t(welder.id(in.corners[3 * t]));
+				*out++ = uint32_t(welder.id(in.corners[3 * t + 1]));
+				*out++ = uint32_t(welder.id(in.corners[3 * t + 2]));
+			}
+			else if (in.back[t] == label)
+			{
+				*out++ = uint32_t(welder.id(in.corners[3 * t]));
+				*out++ = uint32_t(welder.id(in.corners[3 * t + 2]));
+				*out++ = uint32_t(welder.id(in.corners[3 * t + 1]));
+			}
+		}
+		for (size_t q = 0; q < in.nb_quads(); q++)
+		{
+			const bool is_front = in.quad_front[q] == label;
+			if (!is_front && in.quad_back[q] != label)
+			{
+				continue;
+			}
+			stitch_rectangle(&in.quad_corners[4 * q], welder, width, height, [&](int a, int b, int c) {
+				*out++ = uint32_t(welder.id(a));
+				*out++ = uint32_t(welder.id(is_front ? b : c));
+				*out++ = uint32_t(welder.id(is_front ? c : b));
+			});
+		}
+	});
+	compute_vertex_normals(mesh);
+}
+
+//Cuberille surfaces of every label of a BrickVolume, extracted in one pass.
+//Each voxel belongs to one label (the first of priority it is set in), and
+//each face between two different labels is emitted once, tagged with the
+//label it faces out of (front) and the label behind it (back, -1 for the
+//background). All labels share one welded vertex set, so an interface
+//moves the same way for both labels when the vertices are placed,
+//smoothed or decimated; label_mesh() cuts the surface of one label out of
+//it, with the interfaces it has with other labels turned to face out of
+//it.
+class MultiLabelSurface
+{
+public:
+	MultiLabelSurface() : width_(0), height_(0), z_from_(0), nb_slices_(0) {}
+
+	std::vector<float> positions;
+	std::vector<int> lattice;//lattice corner per vertex
+	std::vector<uint32_t> indices;//3 per triangle, outward from front
+	std::vector<int8_t> front;//per triangle
+	std::vector<int8_t> back;//per triangle
+
+	size_t nb_vertices() const { return positions.size() / 3; }
+	size_t nb_triangles() const { return indices.size() / 3; }
+
+	void clear() {
+		positions.clear();
+		lattice.clear();
+		indices.clear();
+		front.clear();
+		back.clear();
+	}
+
+	size_t nb_interface_triangles() const {
+		return size_t(std::count_if(back.begin(), back.end(), [](int8_t l) { return l >= 0; }));
+	}
+
+	//triangles of the surface of label, its interfaces included
+	size_t nb_label_triangles(int label) const {
+		size_t n = 0;
+		for (size_t t = 0; t < nb_triangles(); t++)
+		{
+			n += (front[t] == label || back[t] == label);
+		}
+		return n;
+	}
+
+	//slice z of the volume is slice z + z_from of the geometry and lattice;
+	//merge merges coplanar faces into rectangles (see face_merge.h)
+	void extract(const BrickVolume &volume, const std::vector<int> &priority,
+		const VoxelGeometry &geometry, int z_from, bool merge = false) {
+		clear();
+		geometry_ = geometry;
+		width_ = volume.size_x();
+		height_ = volume.size_y();
+		z_from_ = z_from;
+		nb_slices_ = volume.size_z();
+		std::vector<int> order = volume.brick_order();
+		const GEO::index_t nb = GEO::index_t(order.size());
+		if (nb == 0 || volume.nb_labels() > LABEL_SURFACE_MAX_LABELS)
+		{
+			return;
+		}
+		const GEO::index_t nb_parts = task_nb_parts(nb, BRICKS_MIN_PER_PART);
+		std::vector<LabelFaces> parts(nb_parts);
+
+		const int w = volume.size_x(), h = volume.size_y();
+		task_parallel_ranges(nb, nb_parts, [&](GEO::index_t part, GEO::index_t b_from, GEO::index_t b_to) {
+			LabelFaces &out = parts[part];
+			BrickFaceMerger merger;
+			uint64_t own[LABEL_SURFACE_MAX_LABELS][BRICK_SIZE];
+			for (GEO::index_t i = b_from; i < b_to; i++)
+			{
+				int b = order[i];
+				int ox, oy, oz;
+				volume.brick_origin(b, ox, oy, oz);
+				exclusive_label_planes(volume, priority, b, own);
+				for_each_label_face_in_brick(volume, priority, b, own,
+					[&](uint64_t mask, int k, int dir, int f, int bk) {
+					if (merge)
+					{
+						merger.add(mask, k, dir, f, bk, 0);
+					}
+					else
+					{
+						out.emit(mask, ox, oy, oz + k + z_from, dir, f, bk, w, h);
+					}
+				});
+				merger.flush(ox, oy, oz + z_from, w, h, [&](const int q[4], int f, int bk, int) {
+					out.emit_quad(q, f, bk);
+				});
+			}
+		});
+
+		std::vector<const LabelFaces*> faces(nb_parts);
+		for (GEO::index_t p = 0; p < nb_parts; p++)
+		{
+			faces[p] = &parts[p];
+		}
+		weld(faces, w, h, z_from, volume.size_z(), geometry);
+	}
+
+	//the surface of tagged triangles and rectangles, corners welded over
+	//voxel slices [z_from, z_from + nb_slices) of a width x height lattice
+	//and placed at the corners of geometry, rectangles split against them;
+	//only marking the corners is serial
+	void weld(const std::vector<const LabelFaces*> &faces, int width, int height, int z_from, int nb_slices,
+		const VoxelGeometry &geometry) {
+		clear();
+		geometry_ = geometry;
+		width_ = width;
+		height_ = height;
+		z_from_ = z_from;
+		nb_slices_ = nb_slices;
+		const int w = width, h = height;
+		const GEO::index_t nb_parts = GEO::index_t(faces.size());
+		CornerWelder welder;
+		welder.resize(w, h, z_from, nb_slices);
+		for (GEO::index_t p = 0; p < nb_parts; p++)
+		{
+			for (size_t i = 0; i < faces[p]->corners.size(); i++)
+			{
+				welder.insert(faces[p]->corners[i]);
+			}
+			for (size_t i = 0; i < faces[p]->quad_corners.size(); i++)
+			{
+				welder.insert(faces[p]->quad_corners[i]);
+			}
+		}
+		welder.build();
+
+		//first index of the triangles of each part, rectangles split
+		std::vector<size_t> offset(nb_parts + 1, 0);
+		task_parallel_for(0, nb_parts, [&](GEO::index_t part) {
+			const LabelFaces &in = *faces[part];
+			size_t n = in.nb_triangles();
+			for (size_t q = 0; q < in.nb_quads(); q++)
+			{
+				n += stitched_rectangle_size(&in.quad_corners[4 * q], welder, w, h);
+			}
+			offset[part + 1] = 3 * n;
+		});
+		for (GEO::index_t p = 0; p < nb_parts; p++)
+		{
+			offset[p + 1] += offset[p];
+		}
+
+		positions.resize(3 * size_t(welder.nb_corners()));
+		lattice.resize(welder.nb_corners());
+		welder.parallel_for_each_corner([&](int v, int corner) {
+			lattice[v] = corner;
+			int x, y, z;
+			lattice_corner_position(corner, w, h, x, y, z);
+			double p[3];
+			geometry.corner(x, y, z, 0, p);
+			positions[3 * size_t(v)] = float(p[0]);
+			positions[3 * size_t(v) + 1] = float(p[1]);
+			positions[3 * size_t(v) + 2] = float(p[2]);
+		});
+
+		indices.resize(offset[nb_parts]);
+		front.resize(offset[nb_parts] / 3);
+		back.resize(offset[nb_parts] / 3);
+		task_parallel_for(0, nb_parts, [&](GEO::index_t part) {
+			const LabelFaces &in = *faces[part];
+			for (size_t i = 0; i < in.corners.size(); i++)
+			{
+				indices[offset[part] + i] = uint32_t(welder.id(in.corners[i]));
+			}
+			std::copy(in.front.begin(), in.front.end(), front.begin() + offset[part] / 3);
+			std::copy(in.back.begin(), in.back.end(), back.begin() + offset[part] / 3);
+			size_t t = offset[part] / 3 + in.nb_triangles();
+			for (size_t q = 0; q < in.nb_quads(); q++)
+			{
+				stitch_rectangle(&in.quad_corners[4 * q], welder, w, h, [&](int a, int b, int c) {
+					indices[3 * t] = uint32_t(welder.id(a));
+					indices[3 * t + 1] = uint32_t(welder.id(b));
+					indices[3 * t + 2] = uint32_t(welder.id(c));
+					front[t] = in.quad_front[q];
+					back[t] = in.quad_back[q];
+					t++;
+				});
+			}
+		});
+	}
+
+	//places the vertices on the smooth surfaces of nets, made on the volume
+	//given to extract(), a vertex of one label on the surface of that label
+	//and one where labels meet the same for all of them (see surface_nets.h)
+	void place(const SurfaceNets &nets) {
+		//label of the triangles around each vertex, SHARED where they differ
+		enum { NO_LABEL = -2, SHARED = -3 };
+		const GEO::index_t nv = GEO::index_t(nb_vertices());
+		std::vector<int8_t> label(nv, int8_t(NO_LABEL));
+		for (size_t t = 0; t < nb_triangles(); t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				int8_t &l = label[indices[3 * t + k]];
+				l = (back[t] < 0 && (l == NO_LABEL || l == front[t])) ? front[t] : int8_t(SHARED);
+			}
+		}
+		task_parallel_parts(nv, NETS_MIN_VERTICES_PER_PART, [&](GEO::index_t v_from, GEO::index_t v_to) {
+			for (GEO::index_t v = v_from; v < v_to; v++)
+			{
+				int x, y, z;
+				lattice_corner_position(lattice[v], width_, height_, x, y, z);
+				double p[3];
+				if (label[v] == SHARED)
+				{
+					nets.place_shared(x, y, z, z_from_, z_from_ + nb_slices_, geometry_, p);
+				}
+				else
+				{
+					nets.place(label[v], x, y, z, z_from_, z_from_ + nb_slices_, geometry_, p);
+				}
+				positions[3 * size_t(v)] = float(p[0]);
+				positions[3 * size_t(v) + 1] = float(p[1]);
+				positions[3 * size_t(v) + 2] = float(p[2]);
+			}
+		});
+	}
+
+	//closed surface of one label with its own vertices and normals, placed
+	//as the welded ones
+	void label_mesh(int label, IndexedMesh &mesh) const {
+		mesh.clear();
+		std::vector<int> local(nb_vertices(), -1);
+		for (size_t t = 0; t < nb_triangles(); t++)
+		{
+			uint32_t tri[3] = { indices[3 * t], indices[3 * t + 1], indices[3 * t + 2] };
+			if (back[t] == label)
+			{
+				std::swap(tri[1], tri[2]);
+			}
+			else if (front[t] != label)
+			{
+				continue;
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				if (local[tri[k]] < 0)
+				{
+					local[tri[k]] = int(mesh.nb_vertices());
+					mesh.positions.insert(mesh.positions.end(),
+						positions.begin() + 3 * size_t(tri[k]), positions.begin() + 3 * size_t(tri[k]) + 3);
+				}
+				mesh.indices.push_back(uint32_t(local[tri[k]]));
+			}
+		}
+		compute_vertex_normals(mesh);
+	}
+
+private:
+	VoxelGeometry geometry_;
+	int width_;
+	int height_;
+	int z_from_;
+	int nb_slices_;
+};
+
+#endif
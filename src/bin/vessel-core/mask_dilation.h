@@ -0,0 +1,138 @@
+#pragma once
+#ifndef _MASK_DILATION_
+#define _MASK_DILATION_
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "mask_loader.h"
+
+//Constrained 8-connected dilation of bit-packed slice masks.
+//A ring of a label is the 3x3 dilation of its previous ring, kept to the
+//pixels still free. It is computed a word at a time: the three rows
+//around y are ORed, then the result is ORed with itself shifted one bit
+//left and right, with the bits carried over word boundaries.
+
+//the pixels of src that fall inside a w x h mask
+inline void fit_mask(const SliceMask &src, int w, int h, SliceMask &dst)
+{
+	dst.resize(w, h);
+	if (src.empty() || dst.words_per_row == 0)
+	{
+		return;
+	}
+	const int nw = std::min(src.words_per_row, dst.words_per_row);
+	const uint64_t tail = (w & 63) ? (uint64_t(1) << (w & 63)) - 1 : ~uint64_t(0);
+	const int y_to = std::min(src.box.max_y, h - 1);
+	for (int y = src.box.min_y; y <= y_to; y++)
+	{
+		std::copy(src.row(y), src.row(y) + nw, dst.row(y));
+		dst.row(y)[dst.words_per_row - 1] &= tail;
+	}
+	dst.update_box();
+}
+
+//adds the pixels of src that fall inside dst
+inline void merge_mask(const SliceMask &src, SliceMask &dst)
+{
+	if (src.empty() || dst.words_per_row == 0)
+	{
+		return;
+	}
+	const int nw = std::min(src.words_per_row, dst.words_per_row);
+	const uint64_t tail = (dst.width & 63) ? (uint64_t(1) << (dst.width & 63)) - 1 : ~uint64_t(0);
+	const int y_to = std::min(src.box.max_y, dst.height - 1);
+	for (int y = src.box.min_y; y <= y_to; y++)
+	{
+		for (int i = 0; i < nw; i++)
+		{
+			dst.row(y)[i] |= src.row(y)[i];
+		}
+		dst.row(y)[dst.words_per_row - 1] &= tail;
+	}
+	dst.update_box();
+}
+
+//ring = 3x3 dilation of front restricted to free_, both of the same size
+inline void dilate_ring(const SliceMask &front, const SliceMask &free_, SliceMask &ring)
+{
+	ring.resize(free_.width, free_.height);
+	if (front.empty() || free_.empty())
+	{
+		return;
+	}
+	const int nw = free_.words_per_row;
+	const int y_from = std::max(front.box.min_y - 1, free_.box.min_y);
+	const int y_to = std::min(front.box.max_y + 1, free_.box.max_y);
+	std::vector<uint64_t> v(nw);
+	for (int y = y_from; y <= y_to; y++)
+	{
+		std::fill(v.begin(), v.end(), uint64_t(0));
+		for (int yy = std::max(y - 1, front.box.min_y); yy <= std::min(y + 1, front.box.max_y); yy++)
+		{
+			const uint64_t *r = front.row(yy);
+			for (int w = 0; w < nw; w++)
+			{
+				v[w] |= r[w];
+			}
+		}
+		const uint64_t *f = free_.row(y);
+		uint64_t *out = ring.row(y);
+		for (int w = 0; w < nw; w++)
+		{
+			uint64_t d = v[w] | (v[w] << 1) | (v[w] >> 1);
+			if (w > 0)
+			{
+				d |= v[w - 1] >> 63;
+			}
+			if (w + 1 < nw)
+			{
+				d |= v[w + 1] << 63;
+			}
+			out[w] = d & f[w];
+		}
+	}
+	ring.update_box();
+}
+
+//Grows labels a and b into the pixels of free_ neither of them covers,
+//one ring per level. In every level a takes its ring before b does, so a
+//pixel reached by both in the same level goes to a. The pixels each label
+//gained are returned as masks of the size of free_.
+inline void expand_labels(const SliceMask &a, const SliceMask &b, const SliceMask &free_,
+	int levels, SliceMask &a_added, SliceMask &b_added)
+{
+	const int w = free_.width, h = free_.height;
+	SliceMask left, front[2], ring;
+	fit_mask(free_, w, h, left);
+	fit_mask(a, w, h, front[0]);
+	fit_mask(b, w, h, front[1]);
+	SliceMask *added[2] = { &a_added, &b_added };
+	a_added.resize(w, h);
+	b_added.resize(w, h);
+	for (size_t i = 0; i < left.bits.size(); i++)
+	{
+		left.bits[i] &= ~(front[0].bits[i] | front[1].bits[i]);
+	}
+	left.update_box();
+
+	for (int level = 0; level < levels && !left.empty(); level++)
+	{
+		for (int l = 0; l < 2; l++)
+		{
+			dilate_ring(front[l], left, ring);
+			for (size_t i = 0; i < ring.bits.size(); i++)
+			{
+				left.bits[i] &= ~ring.bits[i];
+				added[l]->bits[i] |= ring.bits[i];
+			}
+			left.update_box();
+			std::swap(front[l], ring);
+		}
+	}
+	a_added.update_box();
+	b_added.update_box();
+}
+
+#endif
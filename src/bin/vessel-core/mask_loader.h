@@ -0,0 +1,293 @@
+#pragma once
+#ifndef _MASK_LOADER_
+#define _MASK_LOADER_
+
+#include <vector>
+#include <string>
+#include <climits>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#include <QtGlobal>
+#include <QDir>
+#include <QString>
+#include <QStringList>
+#include <QImage>
+#include <QImageReader>
+#include <QRgb>
+#include <QFileInfo>
+
+#include <geogram/basic/process.h>
+
+#include "occupancy_grid.h"
+#include "volume_cache.h"
+
+//bounding box of foreground pixels, min > max while empty
+struct PixelBox
+{
+	int min_x = INT_MAX;
+	int max_x = -1;
+	int min_y = INT_MAX;
+	int max_y = -1;
+
+	bool empty() const { return max_x < min_x; }
+
+	void add(int x, int y) {
+		min_x = std::min(min_x, x); max_x = std::max(max_x, x);
+		min_y = std::min(min_y, y); max_y = std::max(max_y, y);
+	}
+
+	void merge(const PixelBox &b) {
+		if (b.empty())
+		{
+			return;
+		}
+		add(b.min_x, b.min_y);
+		add(b.max_x, b.max_y);
+	}
+
+	int width() const { return empty() ? 0 : max_x - min_x + 1; }
+	int height() const { return empty() ? 0 : max_y - min_y + 1; }
+};
+
+//One decoded mask slice, bit-packed with rows along x.
+//y is flipped so that y = 0 is the bottom image row, as in the former
+//QImage::pixel(wid, height - 1 - hei) loops.
+struct SliceMask
+{
+	int width = 0;
+	int height = 0;
+	int words_per_row = 0;
+	std::vector<uint64_t> bits;
+	PixelBox box;
+
+	void resize(int w, int h) {
+		width = w;
+		height = h;
+		words_per_row = (w + 63) / 64;
+		bits.assign(size_t(words_per_row)*size_t(h), 0);
+		box = PixelBox();
+	}
+
+	bool empty() const { return box.empty(); }
+
+	uint64_t* row(int y) { return &bits[size_t(y)*size_t(words_per_row)]; }
+	const uint64_t* row(int y) const { return &bits[size_t(y)*size_t(words_per_row)]; }
+
+	bool get(int x, int y) const {
+		if (x < 0 || y < 0 || x >= width || y >= height)
+		{
+			return false;
+		}
+		return (row(y)[x >> 6] >> (x & 63)) & 1;
+	}
+
+	//f(x, y) for every foreground pixel, rows in memory order
+	template <class F>
+	void for_each_pixel(F f) const {
+		if (empty())
+		{
+			return;
+		}
+		for (int y = box.min_y; y <= box.max_y; y++)
+		{
+			const uint64_t *r = row(y);
+			for (int w = 0; w < words_per_row; w++)
+			{
+				uint64_t m = r[w];
+				while (m)
+				{
+					f((w << 6) + lowest_bit(m), y);
+					m &= m - 1;
+				}
+			}
+		}
+	}
+
+	size_t count() const {
+		size_t n = 0;
+		for (size_t i = 0; i < bits.size(); i++)
+		{
+			n += count_bits(bits[i]);
+		}
+		return n;
+	}
+
+	//recomputes box after the bits were written directly
+	void update_box() {
+		box = PixelBox();
+		for (int y = 0; y < height; y++)
+		{
+			const uint64_t *r = row(y);
+			int first = 0, last = words_per_row - 1;
+			while (first <= last && r[first] == 0)
+			{
+				first++;
+			}
+			if (first > last)
+			{
+				continue;
+			}
+			while (r[last] == 0)
+			{
+				last--;
+			}
+			box.add((first << 6) + lowest_bit(r[first]), y);
+			box.add((last << 6) + highest_bit(r[last]), y);
+		}
+	}
+};
+
+//*.png of a directory, sorted by the number after the last '_' (mask_12.png)
+inline std::vector<QString> list_mask_files(const std::string &dir)
+{
+	QDir qdir(QString::fromStdString(dir));
+	QStringList names = qdir.entryList(QStringList("*.png"), QDir::Files);
+	std::vector<std::pair<int, QString>> indexed;
+	for (int i = 0; i < names.size(); i++)
+	{
+		int index = names[i].split(".").at(0).split("_").last().toInt();
+		indexed.push_back(std::pair<int, QString>(index, qdir.filePath(names[i])));
+	}
+	std::stable_sort(indexed.begin(), indexed.end(),
+		[](const std::pair<int, QString> &a, const std::pair<int, QString> &b) {
+		return a.first < b.first;
+	});
+	std::vector<QString> files;
+	for (int i = 0; i < indexed.size(); i++)
+	{
+		files.push_back(indexed[i].second);
+	}
+	return files;
+}
+
+//image size from the file header, without decoding the pixels
+inline bool read_mask_size(const QString &file, int &w, int &h)
+{
+	QImageReader reader(file);
+	QSize s = reader.size();
+	if (!s.isValid())
+	{
+		QImage im;
+		if (!im.load(file))
+		{
+			return false;
+		}
+		s = im.size();
+	}
+	w = s.width();
+	h = s.height();
+	return true;
+}
+
+//A pixel is foreground when its gray value differs from the background
+//guessed from the top-left pixel (0 if black, 255 otherwise).
+inline bool decode_mask_slice(const QString &file, SliceMask &mask)
+{
+	QImage im;
+	if (!im.load(file))
+	{
+		mask.resize(0, 0);
+		return false;
+	}
+	const int w = im.width();
+	const int h = im.height();
+	mask.resize(w, h);
+	if (w == 0 || h == 0)
+	{
+		return true;
+	}
+
+	bool gray8 = false;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+	gray8 = (im.format() == QImage::Format_Grayscale8);
+#endif
+	if (!gray8 && im.format() != QImage::Format_RGB32 && im.format() != QImage::Format_ARGB32)
+	{
+		im = im.convertToFormat(QImage::Format_RGB32);
+	}
+
+	int background = gray8 ? im.constScanLine(0)[0] :
+		qGray(reinterpret_cast<const QRgb*>(im.constScanLine(0))[0]);
+	const int check_value = background == 0 ? 0 : 255;
+
+	for (int r = 0; r < h; r++)
+	{
+		const int y = h - 1 - r;
+		uint64_t *dst = mask.row(y);
+		int first = -1, last = -1;
+		if (gray8)
+		{
+			const uchar *line = im.constScanLine(r);
+			for (int x = 0; x < w; x++)
+			{
+				if (line[x] != check_value)
+				{
+					dst[x >> 6] |= uint64_t(1) << (x & 63);
+					if (first < 0) first = x;
+					last = x;
+				}
+			}
+		}
+		else
+		{
+			const QRgb *line = reinterpret_cast<const QRgb*>(im.constScanLine(r));
+			for (int x = 0; x < w; x++)
+			{
+				if (qGray(line[x]) != check_value)
+				{
+					dst[x >> 6] |= uint64_t(1) << (x & 63);
+					if (first < 0) first = x;
+					last = x;
+				}
+			}
+		}
+		if (first >= 0)
+		{
+			mask.box.add(first, y);
+			mask.box.add(last, y);
+		}
+	}
+	return true;
+}
+
+//Decodes files on geogram's thread pool and hands every slice to
+//on_slice(i, mask) from the worker that decoded it, so only one decoded
+//image per worker is alive at a time. Falls back to a plain loop when
+//called from an already parallel region.
+template <class F>
+inline void for_each_mask_slice(const std::vector<QString> &files, F on_slice)
+{
+	GEO::parallel_for(0, GEO::index_t(files.size()), [&](GEO::index_t i) {
+		SliceMask mask;
+		decode_mask_slice(files[i], mask);
+		on_slice(int(i), mask);
+	}, 1, true);
+}
+
+//name, size and modification time of every mask, enough to notice an
+//edited or replaced image without reading it
+inline void add_mask_files_key(CacheKey &key, const std::vector<QString> &files)
+{
+	key.add(int(files.size()));
+	for (int i = 0; i < files.size(); i++)
+	{
+		QFileInfo info(files[i]);
+		key.add(info.fileName().toStdString());
+		key.add(int64_t(info.size()));
+		key.add(int64_t(info.lastModified().toMSecsSinceEpoch()));
+	}
+}
+
+//whole stack in memory, slices[i] is files[i]
+inline void load_mask_stack(const std::vector<QString> &files, std::vector<SliceMask> &slices)
+{
+	slices.clear();
+	slices.resize(files.size());
+	for_each_mask_slice(files, [&](int i, SliceMask &mask) {
+		slices[i] = std::move(mask);
+	});
+}
+
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+#ifndef _MASK_STACK_
+#define _MASK_STACK_
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "mask_loader.h"
+#include "stack_dims.h"
+
+//The mask directories of one scan, one per label (dir/vein/, ...), read a
+//slice at a time. The stack is as deep as the label with the most files
+//and a label with fewer is centered in it, as the viewer lays vein and
+//artery out against micro (see combo_layout()): slice z of label l is its
+//file z - first[l] in number order. The voxel spacing is that of
+//dir/spacing.txt.
+struct MaskStack
+{
+	std::vector<std::vector<QString>> files;//per label
+	std::vector<int> first;//per label, slice of its first file
+	int nb_slices = 0;
+	StackDims dims;
+
+	//lists label_dirs under dir, false when no label has a readable mask;
+	//spacing is used when dir has no spacing.txt
+	bool open(const std::string &dir, const std::vector<std::string> &label_dirs,
+		const VoxelSpacing &spacing = VoxelSpacing()) {
+		files.assign(label_dirs.size(), std::vector<QString>());
+		first.assign(label_dirs.size(), 0);
+		nb_slices = 0;
+		dims = StackDims();
+		dims.spacing = spacing;
+		dims.spacing.read(dir);
+		bool readable = false;
+		for (int l = 0; l < label_dirs.size(); l++)
+		{
+			files[l] = list_mask_files(dir + label_dirs[l]);
+			if (!files[l].empty())
+			{
+				readable = dims.add_mask_files(files[l]) || readable;
+			}
+			nb_slices = std::max(nb_slices, int(files[l].size()));
+		}
+		if (!readable)
+		{
+			nb_slices = 0;
+			return false;
+		}
+		for (int l = 0; l < files.size(); l++)
+		{
+			first[l] = (nb_slices - int(files[l].size())) / 2;
+		}
+		return true;
+	}
+
+	int nb_labels() const { return int(files.size()); }
+
+	//label l has a mask for slice z
+	bool has_mask(int l, int z) const {
+		return z >= first[l] && z - first[l] < int(files[l].size());
+	}
+
+	//one mask per label for slice z, in image coordinates; labels without
+	//a file for z get an empty one
+	void read_slice(int z, std::vector<SliceMask> &masks) const {
+		masks.resize(files.size());
+		for (int l = 0; l < files.size(); l++)
+		{
+			if (has_mask(l, z))
+			{
+				decode_mask_slice(files[l][z - first[l]], masks[l]);
+			}
+			else
+			{
+				masks[l] = SliceMask();
+			}
+		}
+	}
+
+	//crops dims to the pixels of every label, decoding each mask once
+	void crop() {
+		std::vector<PixelBox> slice_box(nb_slices);
+		for (int l = 0; l < files.size(); l++)
+		{
+			for_each_mask_slice(files[l], [&](int i, SliceMask &mask) {
+				slice_box[first[l] + i].merge(mask.box);
+			});
+		}
+		dims.crop_to(slice_box);
+	}
+};
+
+#endif
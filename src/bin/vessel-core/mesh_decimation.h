@@ -0,0 +1,832 @@
+#pragma once
+#ifndef _MESH_DECIMATION_
+#define _MESH_DECIMATION_
+
+#include <vector>
+#include <queue>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "task_pool.h"
+
+#include "indexed_mesh.h"
+#include "vertex_normals.h"
+#include "label_surface.h"
+
+//triangles per cell of the parallel pass, the cells do not depend on the
+//number of threads so neither does the result
+#define DECIMATION_TRIANGLES_PER_CELL 32768
+#define DECIMATION_MAX_CELLS 1024
+//below this many vertices per part the setup runs on one thread
+#define DECIMATION_MIN_VERTICES_PER_PART 4096
+//no collapse turns a triangle by more than this (cosine of the angle)
+#define DECIMATION_MIN_NORMAL_COS 0.2
+
+//Symmetric 4x4 error quadric, the sum of w (n.p + d)^2 over planes
+//n.p + d = 0, stored as its upper triangle.
+struct Quadric
+{
+	double q[10];
+
+	Quadric() { std::fill(q, q + 10, 0.0); }
+
+	void add_plane(const double n[3], double d, double w) {
+		q[0] += w*n[0] * n[0]; q[1] += w*n[0] * n[1]; q[2] += w*n[0] * n[2]; q[3] += w*n[0] * d;
+		q[4] += w*n[1] * n[1]; q[5] += w*n[1] * n[2]; q[6] += w*n[1] * d;
+		q[7] += w*n[2] * n[2]; q[8] += w*n[2] * d;
+		q[9] += w*d*d;
+	}
+
+	void add(const Quadric &o) {
+		for (int i = 0; i < 10; i++)
+		{
+			q[i] += o.q[i];
+		}
+	}
+
+	double error(const double p[3]) const {
+		const double x = p[0], y = p[1], z = p[2];
+		return q[0] * x*x + 2 * q[1] * x*y + 2 * q[2] * x*z + 2 * q[3] * x
+			+ q[4] * y*y + 2 * q[5] * y*z + 2 * q[6] * y
+			+ q[7] * z*z + 2 * q[8] * z + q[9];
+	}
+
+	//the point of least error, false when it is not unique (flat or
+	//straight neighbourhoods, as on most of a voxel surface)
+	bool optimum(double p[3]) const {
+		const double a = q[0], b = q[1], c = q[2], e = q[4], f = q[5], i = q[7];
+		const double c0 = e*i - f*f, c1 = c*f - b*i, c2 = b*f - c*e;
+		const double det = a*c0 + b*c1 + c*c2;
+		const double trace = a + e + i;
+		if (!(std::fabs(det) > 1e-6*trace*trace*trace))
+		{
+			return false;
+		}
+		const double r0 = -q[3], r1 = -q[6], r2 = -q[8];
+		p[0] = (c0*r0 + c1*r1 + c2*r2) / det;
+		p[1] = (c1*r0 + (a*i - c*c)*r1 + (b*c - a*f)*r2) / det;
+		p[2] = (c2*r0 + (b*c - a*f)*r1 + (a*e - b*b)*r2) / det;
+		return true;
+	}
+};
+
+//Quadric error edge collapse decimation of a closed indexed surface down
+//to a triangle budget. The bounding box is cut into cells; the triangles
+//with their three vertices in one cell are decimated by that cell on its
+//own thread, with a heap of its edges by error, while the vertices of the
+//triangles across cells stay locked, so cells never touch the same
+//vertex or triangle. Each cell removes its share of the triangles, then a
+//last pass over the whole surface, locks lifted, reaches the budget.
+//A collapse must keep the surface manifold (link condition, no vertex
+//left with fewer than three neighbours): a vessel one voxel wide gets
+//down to a triangular tube but never pinches off, and the components of
+//the surface stay as they were. Vertices that are not manifold or on a
+//border never move, the last pass only collapses their neighbours into
+//them.
+//The surface may be the welded surfaces of several labels (see
+//MultiLabelSurface), each with a budget of its own that counts its
+//interfaces: an interface collapses once for both labels, so they keep
+//meeting, and a collapse is only made while a label of the two triangles
+//it removes is over budget. Where three labels meet the vertices are not
+//manifold, so the outline of an interface stays.
+class QuadricDecimator
+{
+public:
+	explicit QuadricDecimator(IndexedMesh &mesh) : positions_(mesh.positions), indices_(mesh.indices),
+		front_(NULL), back_(NULL), lattice_(NULL) {}
+
+	explicit QuadricDecimator(MultiLabelSurface &surface) : positions_(surface.positions),
+		indices_(surface.indices), front_(&surface.front), back_(&surface.back), lattice_(&surface.lattice) {}
+
+	//keeps at most target triangles, fewer are removed when the topology
+	//does not allow more
+	void decimate(size_t target) {
+		decimate(std::vector<size_t>(1, target));
+	}
+
+	//keeps at most targets[l] triangles of label l, one target for a
+	//surface without labels
+	void decimate(const std::vector<size_t> &targets) {
+		const size_t nt = nb_triangles();
+		const size_t nl = targets.size();
+		std::vector<size_t> count(nl, 0);
+		for (uint32_t t = 0; t < nt; t++)
+		{
+			int l[2];
+			labels(t, l);
+			for (int k = 0; k < 2; k++)
+			{
+				if (l[k] >= 0)
+				{
+					count[l[k]]++;
+				}
+			}
+		}
+		std::vector<double> ratio(nl, 1.0);
+		bool over = false;
+		for (size_t l = 0; l < nl; l++)
+		{
+			if (count[l] > targets[l])
+			{
+				ratio[l] = double(targets[l]) / double(count[l]);
+				over = true;
+			}
+		}
+		if (!over)
+		{
+			return;
+		}
+		setup();
+		const size_t nb_cells = cut_cells();
+
+		//each cell keeps its share of the budget of every label
+		std::vector<std::vector<size_t>> removed(nb_cells);
+		task_parallel_for(0, GEO::index_t(nb_cells), [&](GEO::index_t c) {
+			std::vector<size_t> n(nl, 0);
+			for (size_t i = 0; i < cell_triangles_[c].size(); i++)
+			{
+				int l[2];
+				labels(cell_triangles_[c][i], l);
+				for (int k = 0; k < 2; k++)
+				{
+					if (l[k] >= 0)
+					{
+						n[l[k]]++;
+					}
+				}
+			}
+			std::vector<size_t> remove(nl);
+			for (size_t l = 0; l < nl; l++)
+			{
+				remove[l] = n[l] - std::min(size_t(std::ceil(double(n[l])*ratio[l])), n[l]);
+			}
+			removed[c] = run(int(c), cell_triangles_[c], remove);
+			std::vector<uint32_t>().swap(cell_triangles_[c]);
+		});
+		std::vector<size_t> remove(nl, 0);
+		over = false;
+		for (size_t l = 0; l < nl; l++)
+		{
+			size_t alive = count[l];
+			for (size_t c = 0; c < nb_cells; c++)
+			{
+				alive -= removed[c][l];
+			}
+			remove[l] = alive - std::min(targets[l], alive);
+			over = over || remove[l] > 0;
+		}
+
+		if (over)
+		{
+			std::vector<uint32_t> triangles;
+			for (uint32_t t = 0; t < nt; t++)
+			{
+				if (!dead_[t])
+				{
+					triangles.push_back(t);
+				}
+			}
+			run(ALL_CELLS, triangles, remove);
+		}
+		compact();
+	}
+
+private:
+	//cell_ of a vertex that is not in one cell
+	enum
+	{
+		LOCKED = -1,//on a triangle across cells, movable in the last pass
+		FIXED = -2,//not manifold or on a border
+		REMOVED = -3,//collapsed into another vertex
+		ALL_CELLS = -4//run() over the whole surface
+	};
+
+	static const uint32_t NONE = 0xffffffffu;
+
+	//collapse of b into a at p, p is only set for the collapse popped from
+	//the heap so that its entries stay small
+	struct Collapse
+	{
+		float cost;
+		float length;
+		uint32_t a, b;
+		uint32_t stamp_a, stamp_b;
+		float p[3];
+	};
+
+	//heap entry
+	struct Edge
+	{
+		float cost;
+		float length;
+		uint32_t a, b;
+		uint32_t stamp_a, stamp_b;
+
+		explicit Edge(const Collapse &x) : cost(x.cost), length(x.length), a(x.a), b(x.b),
+			stamp_a(x.stamp_a), stamp_b(x.stamp_b) {}
+
+		//cheapest first, then shortest
+		bool operator<(const Edge &o) const {
+			return cost > o.cost || (cost == o.cost && length > o.length);
+		}
+	};
+
+	size_t nb_vertices() const { return positions_.size() / 3; }
+	size_t nb_triangles() const { return indices_.size() / 3; }
+	const float* position(size_t v) const { return &positions_[3 * v]; }
+
+	//labels of triangle t, the second -1 for none; label 0 without labels
+	void labels(uint32_t t, int l[2]) const {
+		l[0] = front_ ? (*front_)[t] : 0;
+		l[1] = back_ ? (*back_)[t] : -1;
+	}
+
+	//corner lists, quadrics and the vertices that never move
+	void setup() {
+		const size_t nv = nb_vertices(), nt = nb_triangles();
+		head_.assign(nv, uint32_t(NONE));
+		next_.resize(3 * nt);
+		for (size_t c = 3 * nt; c-- > 0;)
+		{
+			next_[c] = head_[indices_[c]];
+			head_[indices_[c]] = uint32_t(c);
+		}
+		dead_.assign(nt, 0);
+		stamp_.assign(nv, 0);
+		cell_.assign(nv, 0);
+		quadrics_.assign(nv, Quadric());
+		task_parallel_parts(GEO::index_t(nv), DECIMATION_MIN_VERTICES_PER_PART,
+			[&](GEO::index_t v_from, GEO::index_t v_to) {
+			std::vector<uint32_t> fan;
+			for (GEO::index_t v = v_from; v < v_to; v++)
+			{
+				for (uint32_t c = head_[v]; c != NONE; c = next_[c])
+				{
+					double n[3], d, area;
+					if (plane(c / 3, n, d, area))
+					{
+						quadrics_[v].add_plane(n, d, area);
+					}
+				}
+				if (!manifold(v, fan))
+				{
+					cell_[v] = FIXED;
+				}
+			}
+		});
+	}
+
+	//unit normal, offset and area of triangle t, false when degenerate
+	bool plane(uint32_t t, double n[3], double &d, double &area) const {
+		const float *p0 = position(indices_[3 * t]);
+		const float *p1 = position(indices_[3 * t + 1]);
+		const float *p2 = position(indices_[3 * t + 2]);
+		const double e1[3] = { double(p1[0]) - p0[0], double(p1[1]) - p0[1], double(p1[2]) - p0[2] };
+		const double e2[3] = { double(p2[0]) - p0[0], double(p2[1]) - p0[1], double(p2[2]) - p0[2] };
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		const double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (!(len > 0.0))
+		{
+			return false;
+		}
+		n[0] /= len; n[1] /= len; n[2] /= len;
+		d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+		area = len / 2;
+		return true;
+	}
+
+	//the triangles around v form a single closed fan
+	bool manifold(uint32_t v, std::vector<uint32_t> &fan) const {
+		//fan holds the (next, previous) vertices of v in each triangle
+		fan.clear();
+		for (uint32_t c = head_[v]; c != NONE; c = next_[c])
+		{
+			const uint32_t t = c / 3, k = c % 3;
+			fan.push_back(indices_[3 * t + (k + 1) % 3]);
+			fan.push_back(indices_[3 * t + (k + 2) % 3]);
+		}
+		const size_t n = fan.size() / 2;
+		if (n < 3)
+		{
+			return false;
+		}
+		//walk from the first triangle to the one whose next vertex is its previous one
+		size_t i = 0, steps = 0;
+		do
+		{
+			size_t j = 0;
+			while (j < n && fan[2 * j] != fan[2 * i + 1])
+			{
+				j++;
+			}
+			if (j == n)
+			{
+				return false;
+			}
+			i = j;
+			steps++;
+		} while (i != 0 && steps <= n);
+		if (steps != n)
+		{
+			return false;
+		}
+		for (size_t j = 0; j < n; j++)
+		{
+			for (size_t k = j + 1; k < n; k++)
+			{
+				if (fan[2 * j] == fan[2 * k])
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	//cuts the bounding box into cells, sorts the triangles within one cell
+	//into cell_triangles_ and locks the vertices of the others
+	size_t cut_cells() {
+		const size_t nv = nb_vertices(), nt = nb_triangles();
+		float lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+		for (size_t v = 0; v < nv; v++)
+		{
+			for (int a = 0; a < 3; a++)
+			{
+				lo[a] = (v == 0) ? positions_[3 * v + a] : std::min(lo[a], positions_[3 * v + a]);
+				hi[a] = (v == 0) ? positions_[3 * v + a] : std::max(hi[a], positions_[3 * v + a]);
+			}
+		}
+		//halve the longest cells until there are enough
+		const size_t wanted = std::min(std::max(nt / DECIMATION_TRIANGLES_PER_CELL, size_t(1)),
+			size_t(DECIMATION_MAX_CELLS));
+		int n[3] = { 1, 1, 1 };
+		while (size_t(n[0])*n[1] * n[2] < wanted)
+		{
+			int a = 0;
+			for (int k = 1; k < 3; k++)
+			{
+				if ((hi[k] - lo[k]) / n[k] > (hi[a] - lo[a]) / n[a])
+				{
+					a = k;
+				}
+			}
+			n[a] *= 2;
+		}
+		const size_t nb_cells = size_t(n[0])*n[1] * n[2];
+
+		std::vector<int> cell(nv);
+		task_parallel_parts(GEO::index_t(nv), DECIMATION_MIN_VERTICES_PER_PART,
+			[&](GEO::index_t v_from, GEO::index_t v_to) {
+			for (GEO::index_t v = v_from; v < v_to; v++)
+			{
+				int id = 0;
+				for (int a = 2; a >= 0; a--)
+				{
+					const float size = hi[a] - lo[a];
+					int i = (size > 0) ? int((positions_[3 * v + a] - lo[a]) / size*n[a]) : 0;
+					id = id*n[a] + std::min(std::max(i, 0), n[a] - 1);
+				}
+				cell[v] = id;
+			}
+		});
+		cell_triangles_.assign(nb_cells, std::vector<uint32_t>());
+		std::vector<char> across(nv, 0);
+		for (uint32_t t = 0; t < nt; t++)
+		{
+			const uint32_t *tri = &indices_[3 * size_t(t)];
+			if (cell[tri[0]] == cell[tri[1]] && cell[tri[0]] == cell[tri[2]])
+			{
+				cell_triangles_[cell[tri[0]]].push_back(t);
+			}
+			else
+			{
+				across[tri[0]] = across[tri[1]] = across[tri[2]] = 1;
+			}
+		}
+		for (size_t v = 0; v < nv; v++)
+		{
+			if (cell_[v] != FIXED)
+			{
+				cell_[v] = across[v] ? int(LOCKED) : cell[v];
+			}
+		}
+		return nb_cells;
+	}
+
+	bool movable(uint32_t v, int cell) const {
+		return (cell == ALL_CELLS) ? cell_[v] >= LOCKED : cell_[v] == cell;
+	}
+
+	//edge (a, b) may collapse in run(cell), b into a; the last pass also
+	//collapses into the vertices that never move, they then come as a
+	bool collapsible(uint32_t &a, uint32_t &b, int cell) const {
+		if (cell == ALL_CELLS && cell_[b] == FIXED)
+		{
+			std::swap(a, b);
+		}
+		return movable(b, cell) && (movable(a, cell) || (cell == ALL_CELLS && cell_[a] == FIXED));
+	}
+
+	//alive triangles around v, dropping the dead ones from its list
+	void ring(uint32_t v, std::vector<uint32_t> &triangles) {
+		triangles.clear();
+		uint32_t *link = &head_[v];
+		while (*link != NONE)
+		{
+			const uint32_t t = *link / 3;
+			if (dead_[t])
+			{
+				*link = next_[*link];
+			}
+			else
+			{
+				triangles.push_back(t);
+				link = &next_[*link];
+			}
+		}
+	}
+
+	//vertices of the triangles but v
+	void neighbours(uint32_t v, const std::vector<uint32_t> &triangles, std::vector<uint32_t> &out) const {
+		out.clear();
+		for (size_t i = 0; i < triangles.size(); i++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				const uint32_t w = indices_[3 * size_t(triangles[i]) + k];
+				if (w != v)
+				{
+					out.push_back(w);
+				}
+			}
+		}
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	}
+
+	//cost and position of collapsing b into a
+	Collapse evaluate(uint32_t a, uint32_t b) const {
+		Quadric q = quadrics_[a];
+		q.add(quadrics_[b]);
+		const float *pa = position(a), *pb = position(b);
+		const double mid[3] = { (double(pa[0]) + pb[0]) / 2, (double(pa[1]) + pb[1]) / 2, (double(pa[2]) + pb[2]) / 2 };
+		const double len2 = (double(pb[0]) - pa[0])*(double(pb[0]) - pa[0]) +
+			(double(pb[1]) - pa[1])*(double(pb[1]) - pa[1]) + (double(pb[2]) - pa[2])*(double(pb[2]) - pa[2]);
+		//a vertex that never moves stays where it is, else the midpoint, the
+		//optimum or an end, whichever is cheapest (the first on ties)
+		const bool fixed = (cell_[a] == FIXED);
+		double best[3] = { fixed ? pa[0] : mid[0], fixed ? pa[1] : mid[1], fixed ? pa[2] : mid[2] };
+		double cost = q.error(best);
+		if (!fixed)
+		{
+			double p[3][3] = { { 0, 0, 0 }, { pa[0], pa[1], pa[2] }, { pb[0], pb[1], pb[2] } };
+			//the optimum only when it stays near the edge
+			const bool near = q.optimum(p[0]) && (p[0][0] - mid[0])*(p[0][0] - mid[0]) +
+				(p[0][1] - mid[1])*(p[0][1] - mid[1]) + (p[0][2] - mid[2])*(p[0][2] - mid[2]) <= len2;
+			for (int k = near ? 0 : 1; k < 3; k++)
+			{
+				const double c = q.error(p[k]);
+				if (c < cost)
+				{
+					cost = c;
+					std::copy(p[k], p[k] + 3, best);
+				}
+			}
+		}
+		Collapse x;
+		x.cost = float(std::max(cost, 0.0));
+		x.length = float(len2);
+		x.p[0] = float(best[0]); x.p[1] = float(best[1]); x.p[2] = float(best[2]);
+		x.a = a;
+		x.b = b;
+		x.stamp_a = stamp_[a];
+		x.stamp_b = stamp_[b];
+		return x;
+	}
+
+	//triangle t turns by less than the limit with v moved to p
+	bool keeps_normal(uint32_t t, uint32_t v, const float p[3]) const {
+		const float *q[3];
+		for (int k = 0; k < 3; k++)
+		{
+			q[k] = position(indices_[3 * size_t(t) + k]);
+		}
+		double before[3], after[3];
+		for (int pass = 0; pass < 2; pass++)
+		{
+			const float *r[3];
+			for (int k = 0; k < 3; k++)
+			{
+				r[k] = (pass == 1 && indices_[3 * size_t(t) + k] == v) ? p : q[k];
+			}
+			const double e1[3] = { double(r[1][0]) - r[0][0], double(r[1][1]) - r[0][1], double(r[1][2]) - r[0][2] };
+			const double e2[3] = { double(r[2][0]) - r[0][0], double(r[2][1]) - r[0][1], double(r[2][2]) - r[0][2] };
+			double *n = pass ? after : before;
+			n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+			n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+			n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		}
+		const double lb = std::sqrt(before[0] * before[0] + before[1] * before[1] + before[2] * before[2]);
+		const double la = std::sqrt(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+		const double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+		return la > 0.0 && dot >= DECIMATION_MIN_NORMAL_COS*lb*la;
+	}
+
+	//link condition and normals; ring_a and ring_b are the triangles around a and b
+	bool can_collapse(const Collapse &x, const std::vector<uint32_t> &ring_a,
+		const std::vector<uint32_t> &ring_b, std::vector<uint32_t> &na, std::vector<uint32_t> &nb) const {
+		//the edge is on exactly two triangles, whose third vertices are
+		//the only neighbours a and b have in common
+		uint32_t opposite[2];
+		int shared = 0;
+		for (size_t i = 0; i < ring_a.size(); i++)
+		{
+			const uint32_t *tri = &indices_[3 * size_t(ring_a[i])];
+			if (tri[0] == x.b || tri[1] == x.b || tri[2] == x.b)
+			{
+				if (shared == 2)
+				{
+					return false;
+				}
+				opposite[shared++] = tri[0] ^ tri[1] ^ tri[2] ^ x.a ^ x.b;
+			}
+		}
+		if (shared != 2 || opposite[0] == opposite[1])
+		{
+			return false;
+		}
+		//nor do a and b both make a triangle with them, there would be two
+		bool joined[2] = { false, false };
+		for (int k = 0; k < 2; k++)
+		{
+			const std::vector<uint32_t> &ring = k ? ring_b : ring_a;
+			for (size_t i = 0; i < ring.size(); i++)
+			{
+				const uint32_t *tri = &indices_[3 * size_t(ring[i])];
+				joined[k] = joined[k] || ((tri[0] == opposite[0] || tri[1] == opposite[0] || tri[2] == opposite[0]) &&
+					(tri[0] == opposite[1] || tri[1] == opposite[1] || tri[2] == opposite[1]));
+			}
+		}
+		if (joined[0] && joined[1])
+		{
+			return false;
+		}
+		neighbours(x.a, ring_a, na);
+		neighbours(x.b, ring_b, nb);
+		size_t common = 0;
+		for (size_t i = 0, j = 0; i < na.size() && j < nb.size();)
+		{
+			if (na[i] < nb[j])
+			{
+				i++;
+			}
+			else if (nb[j] < na[i])
+			{
+				j++;
+			}
+			else
+			{
+				if (na[i] != opposite[0] && na[i] != opposite[1])
+				{
+					return false;
+				}
+				common++;
+				i++;
+				j++;
+			}
+		}
+		//a keeps at least three neighbours
+		if (common != 2 || na.size() + nb.size() - common - 2 < 3)
+		{
+			return false;
+		}
+		for (int k = 0; k < 2; k++)
+		{
+			const std::vector<uint32_t> &ring = k ? ring_b : ring_a;
+			const uint32_t v = k ? x.b : x.a, other = k ? x.a : x.b;
+			for (size_t i = 0; i < ring.size(); i++)
+			{
+				const uint32_t *tri = &indices_[3 * size_t(ring[i])];
+				if (tri[0] != other && tri[1] != other && tri[2] != other && !keeps_normal(ring[i], v, x.p))
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	//b into a at x.p
+	void collapse(const Collapse &x, const std::vector<uint32_t> &ring_b) {
+		for (size_t i = 0; i < ring_b.size(); i++)
+		{
+			uint32_t *tri = &indices_[3 * size_t(ring_b[i])];
+			if (tri[0] == x.a || tri[1] == x.a || tri[2] == x.a)
+			{
+				dead_[ring_b[i]] = 1;
+			}
+			else
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					tri[k] = (tri[k] == x.b) ? x.a : tri[k];
+				}
+			}
+		}
+		//the corners of b go to the end of the list of a
+		uint32_t *link = &head_[x.a];
+		while (*link != NONE)
+		{
+			link = &next_[*link];
+		}
+		*link = head_[x.b];
+		head_[x.b] = NONE;
+		std::copy(x.p, x.p + 3, &positions_[3 * size_t(x.a)]);
+		quadrics_[x.a].add(quadrics_[x.b]);
+		stamp_[x.a]++;
+		stamp_[x.b]++;
+		cell_[x.b] = REMOVED;
+	}
+
+	//labels of the two triangles the collapse removes, which are in the fan
+	//of b so of the same labels; -1 for none when the edge is gone
+	void removed_labels(const Collapse &x, const std::vector<uint32_t> &ring_b, int l[2]) const {
+		l[0] = l[1] = -1;
+		for (size_t i = 0; i < ring_b.size(); i++)
+		{
+			const uint32_t *tri = &indices_[3 * size_t(ring_b[i])];
+			if (tri[0] == x.a || tri[1] == x.a || tri[2] == x.a)
+			{
+				labels(ring_b[i], l);
+				return;
+			}
+		}
+	}
+
+	//collapses the cheapest edges of the triangles among the movable vertices
+	//of cell until count[l] triangles of every label l are gone, returns how
+	//many are
+	std::vector<size_t> run(int cell, const std::vector<uint32_t> &triangles, const std::vector<size_t> &count) {
+		std::vector<Edge> edges;
+		for (size_t i = 0; i < triangles.size(); i++)
+		{
+			const uint32_t *tri = &indices_[3 * size_t(triangles[i])];
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t a = tri[k], b = tri[(k + 1) % 3];
+				if (a < b && collapsible(a, b, cell))
+				{
+					edges.push_back(Edge(evaluate(a, b)));
+				}
+			}
+		}
+		std::priority_queue<Edge> heap(std::less<Edge>(), std::move(edges));
+		std::vector<size_t> removed(count.size(), 0);
+		size_t left = 0;
+		for (size_t l = 0; l < count.size(); l++)
+		{
+			left += (removed[l] < count[l]);
+		}
+		std::vector<uint32_t> ring_a, ring_b, na, nb;
+		while (left > 0 && !heap.empty())
+		{
+			const Edge e = heap.top();
+			heap.pop();
+			if (cell_[e.a] == REMOVED || cell_[e.b] == REMOVED ||
+				e.stamp_a != stamp_[e.a] || e.stamp_b != stamp_[e.b])
+			{
+				continue;
+			}
+			const Collapse x = evaluate(e.a, e.b);
+			ring(x.a, ring_a);
+			ring(x.b, ring_b);
+			//only while one of its labels is over budget
+			int l[2];
+			removed_labels(x, ring_b, l);
+			const bool wanted = (l[0] >= 0 && removed[l[0]] < count[l[0]]) || (l[1] >= 0 && removed[l[1]] < count[l[1]]);
+			if (!wanted || !can_collapse(x, ring_a, ring_b, na, nb))
+			{
+				continue;
+			}
+			collapse(x, ring_b);
+			for (int k = 0; k < 2; k++)
+			{
+				if (l[k] >= 0)
+				{
+					left -= (removed[l[k]] < count[l[k]] && removed[l[k]] + 2 >= count[l[k]]);
+					removed[l[k]] += 2;
+				}
+			}
+			ring(x.a, ring_a);
+			neighbours(x.a, ring_a, na);
+			for (size_t i = 0; i < na.size(); i++)
+			{
+				uint32_t a = x.a, b = na[i];
+				if (collapsible(a, b, cell))
+				{
+					heap.push(Edge(evaluate(a, b)));
+				}
+			}
+		}
+		return removed;
+	}
+
+	//drops the dead triangles and the vertices no longer used, with their
+	//labels and lattice corners
+	void compact() {
+		const size_t nv = nb_vertices(), nt = nb_triangles();
+		std::vector<uint32_t> id(nv, uint32_t(NONE));
+		std::vector<float> positions;
+		std::vector<uint32_t> indices;
+		std::vector<int> lattice;
+		indices.reserve(3 * nt);
+		size_t kept = 0;
+		for (size_t t = 0; t < nt; t++)
+		{
+			if (dead_[t])
+			{
+				continue;
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				const uint32_t v = indices_[3 * t + k];
+				if (id[v] == NONE)
+				{
+					id[v] = uint32_t(positions.size() / 3);
+					positions.insert(positions.end(), positions_.begin() + 3 * v, positions_.begin() + 3 * v + 3);
+					if (lattice_)
+					{
+						lattice.push_back((*lattice_)[v]);
+					}
+				}
+				indices.push_back(id[v]);
+			}
+			if (front_)
+			{
+				(*front_)[kept] = (*front_)[t];
+				(*back_)[kept] = (*back_)[t];
+			}
+			kept++;
+		}
+		positions_.swap(positions);
+		indices_.swap(indices);
+		if (front_)
+		{
+			front_->resize(kept);
+			back_->resize(kept);
+		}
+		if (lattice_)
+		{
+			lattice_->swap(lattice);
+		}
+		std::vector<uint32_t>().swap(head_);
+		std::vector<uint32_t>().swap(next_);
+		std::vector<char>().swap(dead_);
+		std::vector<uint32_t>().swap(stamp_);
+		std::vector<int>().swap(cell_);
+		std::vector<Quadric>().swap(quadrics_);
+	}
+
+	std::vector<float> &positions_;
+	std::vector<uint32_t> &indices_;
+	std::vector<int8_t> *front_;//per triangle, NULL without labels
+	std::vector<int8_t> *back_;
+	std::vector<int> *lattice_;//per vertex, NULL without lattice corners
+	//per vertex
+	std::vector<uint32_t> head_;//first corner of the list of its triangles
+	std::vector<uint32_t> stamp_;//bumped when it moves or goes
+	std::vector<int> cell_;//the cell that may move it, or LOCKED, FIXED, REMOVED
+	std::vector<Quadric> quadrics_;
+	//per corner, the next of the same vertex
+	std::vector<uint32_t> next_;
+	//per triangle
+	std::vector<char> dead_;
+	std::vector<std::vector<uint32_t>> cell_triangles_;
+};
+
+//Mesh down to at most target triangles, see QuadricDecimator, normals
+//recomputed.
+inline void decimate_surface(IndexedMesh &mesh, size_t target)
+{
+	if (target < mesh.nb_triangles())
+	{
+		QuadricDecimator(mesh).decimate(target);
+		compute_vertex_normals(mesh);
+	}
+}
+
+//Surfaces of every label at once, label l down to at most targets[l]
+//triangles its interfaces included, see QuadricDecimator: each interface
+//collapses the same way for both labels, which keep meeting exactly, and
+//label_mesh() cuts each label out after.
+inline void decimate_surface(MultiLabelSurface &surface, const std::vector<size_t> &targets)
+{
+	QuadricDecimator(surface).decimate(targets);
+}
+
+#endif
@@ -0,0 +1,180 @@
+#pragma once
+#ifndef _MESH_SMOOTHING_
+#define _MESH_SMOOTHING_
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "task_pool.h"
+
+#include "indexed_mesh.h"
+#include "vertex_normals.h"
+#include "voxel_geometry.h"
+#include "label_surface.h"
+
+//below this many vertices per part smoothing runs on one thread
+#define SMOOTHING_MIN_VERTICES_PER_PART 4096
+
+//Taubin steps: lambda shrinks, mu inflates back, so the volume is kept
+#define TAUBIN_LAMBDA 0.5f
+#define TAUBIN_MU -0.53f
+
+//Vertex neighbours of an indexed surface in compressed rows: the
+//neighbours of v are neighbours[offsets[v]] .. neighbours[offsets[v + 1]],
+//each once even where the cuberille surface is not manifold. Incidences
+//are bucketed in one pass, then each row is sorted and made unique on
+//its own thread and the rows are packed.
+struct VertexAdjacency
+{
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> neighbours;
+
+	//indices hold three of the nb_vertices vertex ids per triangle
+	void build(const std::vector<uint32_t> &indices, size_t nb_vertices) {
+		const GEO::index_t nv = GEO::index_t(nb_vertices);
+		std::vector<uint32_t> start(size_t(nv) + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			start[indices[i] + 1] += 2;
+		}
+		for (GEO::index_t v = 0; v < nv; v++)
+		{
+			start[v + 1] += start[v];
+		}
+		std::vector<uint32_t> all(start[nv]);
+		std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+		for (size_t t = 0; t < indices.size() / 3; t++)
+		{
+			const uint32_t *tri = &indices[3 * t];
+			for (int k = 0; k < 3; k++)
+			{
+				all[fill[tri[k]]++] = tri[(k + 1) % 3];
+				all[fill[tri[k]]++] = tri[(k + 2) % 3];
+			}
+		}
+
+		offsets.assign(size_t(nv) + 1, 0);
+		task_parallel_parts(nv, SMOOTHING_MIN_VERTICES_PER_PART,
+			[&](GEO::index_t v_from, GEO::index_t v_to) {
+			for (GEO::index_t v = v_from; v < v_to; v++)
+			{
+				std::sort(all.begin() + start[v], all.begin() + start[v + 1]);
+				offsets[v + 1] = uint32_t(std::unique(all.begin() + start[v], all.begin() + start[v + 1]) -
+					(all.begin() + start[v]));
+			}
+		});
+		for (GEO::index_t v = 0; v < nv; v++)
+		{
+			offsets[v + 1] += offsets[v];
+		}
+		neighbours.resize(offsets[nv]);
+		task_parallel_parts(nv, SMOOTHING_MIN_VERTICES_PER_PART,
+			[&](GEO::index_t v_from, GEO::index_t v_to) {
+			for (GEO::index_t v = v_from; v < v_to; v++)
+			{
+				std::copy(all.begin() + start[v], all.begin() + start[v] + (offsets[v + 1] - offsets[v]),
+					neighbours.begin() + offsets[v]);
+			}
+		});
+	}
+};
+
+//Taubin lambda/mu smoothing of the vertices of a triangle surface,
+//iterations pairs of umbrella steps. Every step computes the moves of all
+//vertices from the previous positions, then applies them, both in
+//parallel over vertex ranges, so the result does not depend on the number
+//of threads. With limit, no vertex ends further than limit[axis] from
+//where it started along each axis: half a voxel keeps a cuberille vertex
+//in the voxel corner cell it stands for, so steps are rounded off but
+//vessels one voxel wide stay open and never move off their voxels.
+inline void taubin_smooth(std::vector<float> &positions, const std::vector<uint32_t> &indices, int iterations,
+	const float *limit = NULL, float lambda = TAUBIN_LAMBDA, float mu = TAUBIN_MU)
+{
+	const GEO::index_t nv = GEO::index_t(positions.size() / 3);
+	if (iterations <= 0 || nv == 0)
+	{
+		return;
+	}
+	VertexAdjacency adjacency;
+	adjacency.build(indices, nv);
+	const std::vector<float> start = positions;
+	std::vector<float> move(positions.size());
+	float *p = positions.data();
+	for (int i = 0; i < 2 * iterations; i++)
+	{
+		const float step = (i & 1) ? mu : lambda;
+		task_parallel_parts(nv, SMOOTHING_MIN_VERTICES_PER_PART,
+			[&](GEO::index_t v_from, GEO::index_t v_to) {
+			for (GEO::index_t v = v_from; v < v_to; v++)
+			{
+				const uint32_t n_from = adjacency.offsets[v], n_to = adjacency.offsets[v + 1];
+				float *m = &move[3 * size_t(v)];
+				m[0] = m[1] = m[2] = 0.0f;
+				if (n_to == n_from)
+				{
+					continue;
+				}
+				//step times the offset to the mean of the neighbours
+				float s[3] = { 0.0f, 0.0f, 0.0f };
+				for (uint32_t k = n_from; k < n_to; k++)
+				{
+					const float *q = p + 3 * size_t(adjacency.neighbours[k]);
+					s[0] += q[0]; s[1] += q[1]; s[2] += q[2];
+				}
+				const float w = 1.0f / float(n_to - n_from);
+				const float *o = p + 3 * size_t(v);
+				m[0] = step*(w*s[0] - o[0]);
+				m[1] = step*(w*s[1] - o[1]);
+				m[2] = step*(w*s[2] - o[2]);
+			}
+		});
+		task_parallel_parts(nv, SMOOTHING_MIN_VERTICES_PER_PART,
+			[&](GEO::index_t v_from, GEO::index_t v_to) {
+			float *q = p + 3 * size_t(v_from);
+			const float *m = &move[3 * size_t(v_from)];
+			const size_t n = 3 * size_t(v_to - v_from);
+			for (size_t k = 0; k < n; k++)
+			{
+				q[k] += m[k];
+			}
+			if (limit)
+			{
+				const float *s = &start[3 * size_t(v_from)];
+				for (size_t k = 0; k < n; k += 3)
+				{
+					for (int a = 0; a < 3; a++)
+					{
+						q[k + a] = std::min(std::max(q[k + a], s[k + a] - limit[a]), s[k + a] + limit[a]);
+					}
+				}
+			}
+		});
+	}
+}
+
+//taubin_smooth() of a mesh, normals recomputed
+inline void taubin_smooth(IndexedMesh &mesh, int iterations, const float *limit = NULL,
+	float lambda = TAUBIN_LAMBDA, float mu = TAUBIN_MU)
+{
+	if (iterations <= 0 || mesh.empty())
+	{
+		return;
+	}
+	taubin_smooth(mesh.positions, mesh.indices, iterations, limit, lambda, mu);
+	compute_vertex_normals(mesh);
+}
+
+//Smoothing of the surfaces of every label at once, kept within half a
+//voxel of geometry. The labels share their welded vertices, so each
+//interface moves once for both labels, which keep meeting exactly, and
+//is rounded off like the rest; label_mesh() cuts each label out after.
+inline void smooth_voxel_surface(MultiLabelSurface &surface, const VoxelGeometry &geometry, int iterations)
+{
+	double size[3];
+	geometry.voxel_size(size);
+	const float limit[3] = { float(size[0] / 2), float(size[1] / 2), float(size[2] / 2) };
+	taubin_smooth(surface.positions, surface.indices, iterations, limit);
+}
+
+#endif
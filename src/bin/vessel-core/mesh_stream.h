@@ -0,0 +1,518 @@
+#pragma once
+#ifndef _MESH_STREAM_
+#define _MESH_STREAM_
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+
+#include <geogram/third_party/zlib/zlib.h>
+
+#include "indexed_mesh.h"
+
+//vertices or triangles kept in memory before they go to a spill file
+#define MESH_STREAM_BUFFER_BYTES (size_t(32) << 20)
+//bytes formatted before each write to the file
+#define MESH_STREAM_CHUNK_BYTES (size_t(4) << 20)
+
+enum MeshFileFormat
+{
+	MESH_FILE_OBJ, MESH_FILE_PLY, MESH_FILE_STL, MESH_FILE_GEOGRAM, MESH_FILE_UNKNOWN
+};
+
+//format of a file from its extension, a trailing ".gz" is skipped
+inline MeshFileFormat mesh_file_format(const std::string &file)
+{
+	std::string name = file;
+	if (name.size() > 3 && name.compare(name.size() - 3, 3, ".gz") == 0)
+	{
+		name.resize(name.size() - 3);
+	}
+	size_t dot = name.find_last_of('.');
+	std::string ext = (dot == std::string::npos) ? std::string() : name.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return char(::tolower(c)); });
+	if (ext == "obj") return MESH_FILE_OBJ;
+	if (ext == "ply") return MESH_FILE_PLY;
+	if (ext == "stl") return MESH_FILE_STL;
+	if (ext == "geogram") return MESH_FILE_GEOGRAM;
+	return MESH_FILE_UNKNOWN;
+}
+
+//Writes a triangle mesh while it is built, so that it never has to be held
+//in memory: vertices and triangles are buffered, and past
+//MESH_STREAM_BUFFER_BYTES spilled raw to temporary files. close() writes
+//the file in one pass of large writes once the counts are known: binary
+//PLY, binary STL, geogram (readable by GEO::mesh_load, connected) or OBJ
+//text, by extension, optionally through zlib (but geogram, which geogram
+//does not read compressed). Triangles refer to the ids add_vertex()
+//returned, from 0. STL repeats the positions in every triangle, so close()
+//reads the vertices back into memory for it, and geogram the triangles to
+//connect them. Only write() has vertex normals to write, streamed
+//vertices have none.
+class MeshStreamWriter
+{
+public:
+	MeshStreamWriter() : format_(MESH_FILE_UNKNOWN), compress_(false), is_open_(false),
+		vertex_spill_(NULL), triangle_spill_(NULL), nb_vertices_(0), nb_triangles_(0) {}
+
+	~MeshStreamWriter() { discard(); }
+
+	//false when the extension is not one of the formats, or geogram compressed
+	bool open(const std::string &file, bool compress = false) {
+		discard();
+		format_ = mesh_file_format(file);
+		if (format_ == MESH_FILE_UNKNOWN || (format_ == MESH_FILE_GEOGRAM && compress))
+		{
+			return false;
+		}
+		file_ = file;
+		compress_ = compress;
+		is_open_ = true;
+		return true;
+	}
+
+	bool is_open() const { return is_open_; }
+
+	int64_t add_vertex(float x, float y, float z) {
+		vertices_.push_back(x);
+		vertices_.push_back(y);
+		vertices_.push_back(z);
+		if (vertices_.size()*sizeof(float) >= MESH_STREAM_BUFFER_BYTES)
+		{
+			spill(vertices_, vertex_spill_);
+		}
+		return nb_vertices_++;
+	}
+
+	void add_triangle(int64_t a, int64_t b, int64_t c) {
+		triangles_.push_back(uint32_t(a));
+		triangles_.push_back(uint32_t(b));
+		triangles_.push_back(uint32_t(c));
+		if (triangles_.size()*sizeof(uint32_t) >= MESH_STREAM_BUFFER_BYTES)
+		{
+			spill(triangles_, triangle_spill_);
+		}
+		nb_triangles_++;
+	}
+
+	int64_t nb_vertices() const { return nb_vertices_; }
+	int64_t nb_triangles() const { return nb_triangles_; }
+
+	//writes the file, false when anything could not be written
+	bool close() {
+		if (!is_open_)
+		{
+			return false;
+		}
+		bool ok = spill_ok_ && out_open();
+		if (ok)
+		{
+			switch (format_)
+			{
+			case MESH_FILE_OBJ: ok = write_obj(); break;
+			case MESH_FILE_PLY: ok = write_ply(); break;
+			case MESH_FILE_STL: ok = write_stl(); break;
+			case MESH_FILE_GEOGRAM: ok = write_geogram(); break;
+			default: ok = false; break;
+			}
+		}
+		ok = out_close() && ok;
+		discard();
+		return ok;
+	}
+
+	//the whole mesh at once, with its normals when it has them (but in STL,
+	//which only has facet normals)
+	static bool write(const IndexedMesh &mesh, const std::string &file, bool compress = false) {
+		MeshStreamWriter writer;
+		if (!writer.open(file, compress))
+		{
+			return false;
+		}
+		writer.vertices_ = mesh.positions;
+		if (mesh.normals.size() == mesh.positions.size())
+		{
+			writer.normals_ = mesh.normals;
+		}
+		writer.triangles_ = mesh.indices;
+		writer.nb_vertices_ = int64_t(mesh.nb_vertices());
+		writer.nb_triangles_ = int64_t(mesh.nb_triangles());
+		return writer.close();
+	}
+
+private:
+	//appends buffer to its spill file, created on first use
+	template <class T>
+	void spill(std::vector<T> &buffer, FILE *&file) {
+		if (file == NULL)
+		{
+			file = std::tmpfile();
+		}
+		if (file == NULL || std::fwrite(buffer.data(), sizeof(T), buffer.size(), file) != buffer.size())
+		{
+			spill_ok_ = false;
+		}
+		buffer.clear();
+	}
+
+	//f(items, count) over the spilled items then the buffered ones, count
+	//a multiple of 3 (one vertex or triangle)
+	template <class T, class F>
+	bool for_each_chunk(FILE *file, const std::vector<T> &buffer, F f) const {
+		if (file != NULL)
+		{
+			std::vector<T> chunk(MESH_STREAM_CHUNK_BYTES / (3 * sizeof(T)) * 3);
+			std::rewind(file);
+			size_t n;
+			while ((n = std::fread(chunk.data(), sizeof(T), chunk.size(), file)) > 0)
+			{
+				f(chunk.data(), n);
+			}
+			if (std::ferror(file))
+			{
+				return false;
+			}
+		}
+		if (!buffer.empty())
+		{
+			f(buffer.data(), buffer.size());
+		}
+		return true;
+	}
+
+	void discard() {
+		if (vertex_spill_ != NULL)
+		{
+			std::fclose(vertex_spill_);
+		}
+		if (triangle_spill_ != NULL)
+		{
+			std::fclose(triangle_spill_);
+		}
+		vertex_spill_ = NULL;
+		triangle_spill_ = NULL;
+		std::vector<float>().swap(vertices_);
+		std::vector<float>().swap(normals_);
+		std::vector<uint32_t>().swap(triangles_);
+		nb_vertices_ = 0;
+		nb_triangles_ = 0;
+		spill_ok_ = true;
+		is_open_ = false;
+	}
+
+	//output, through zlib when compressed
+	bool out_open() {
+		out_ok_ = true;
+		out_file_ = NULL;
+		out_gz_ = NULL;
+		if (compress_)
+		{
+			out_gz_ = gzopen(file_.c_str(), "wb3");
+			return out_gz_ != NULL;
+		}
+		out_file_ = std::fopen(file_.c_str(), "wb");
+		return out_file_ != NULL;
+	}
+
+	void out_write(const void *data, size_t size) {
+		if (size == 0 || !out_ok_)
+		{
+			return;
+		}
+		if (out_gz_ != NULL)
+		{
+			const char *p = static_cast<const char*>(data);
+			while (size > 0 && out_ok_)
+			{
+				unsigned n = unsigned(std::min(size, MESH_STREAM_CHUNK_BYTES));
+				out_ok_ = gzwrite(out_gz_, p, n) == int(n);
+				p += n;
+				size -= n;
+			}
+		}
+		else
+		{
+			out_ok_ = std::fwrite(data, 1, size, out_file_) == size;
+		}
+	}
+
+	bool out_close() {
+		bool ok = out_ok_;
+		if (out_gz_ != NULL)
+		{
+			ok = gzclose(out_gz_) == Z_OK && ok;
+		}
+		if (out_file_ != NULL)
+		{
+			ok = std::fclose(out_file_) == 0 && ok;
+		}
+		out_gz_ = NULL;
+		out_file_ = NULL;
+		return ok;
+	}
+
+	//chunk buffer flushed to the output when full
+	void put(const void *data, size_t size) {
+		if (chunk_size_ + size > chunk_.size())
+		{
+			flush();
+			chunk_.resize(std::max(MESH_STREAM_CHUNK_BYTES, size));
+		}
+		std::memcpy(&chunk_[chunk_size_], data, size);
+		chunk_size_ += size;
+	}
+
+	void flush() {
+		out_write(chunk_.data(), chunk_size_);
+		chunk_size_ = 0;
+	}
+
+	bool write_obj() {
+		char line[96];
+		bool ok = for_each_chunk(vertex_spill_, vertices_, [&](const float *p, size_t n) {
+			for (size_t i = 0; i < n; i += 3)
+			{
+				int len = std::snprintf(line, sizeof(line), "v %.9g %.9g %.9g\n", p[i], p[i + 1], p[i + 2]);
+				put(line, size_t(len));
+			}
+		});
+		for (size_t i = 0; i < normals_.size(); i += 3)
+		{
+			int len = std::snprintf(line, sizeof(line), "vn %.6g %.6g %.6g\n", normals_[i], normals_[i + 1],
+				normals_[i + 2]);
+			put(line, size_t(len));
+		}
+		const char *face = normals_.empty() ? "f %u %u %u\n" : "f %u//%u %u//%u %u//%u\n";
+		ok = for_each_chunk(triangle_spill_, triangles_, [&](const uint32_t *t, size_t n) {
+			for (size_t i = 0; i < n; i += 3)
+			{
+				int len = normals_.empty() ?
+					std::snprintf(line, sizeof(line), face, t[i] + 1, t[i + 1] + 1, t[i + 2] + 1) :
+					std::snprintf(line, sizeof(line), face, t[i] + 1, t[i] + 1, t[i + 1] + 1, t[i + 1] + 1,
+						t[i + 2] + 1, t[i + 2] + 1);
+				put(line, size_t(len));
+			}
+		}) && ok;
+		flush();
+		return ok && out_ok_;
+	}
+
+	//binary_little_endian, as are the machines it is written on
+	bool write_ply() {
+		const bool normals = !normals_.empty();
+		char header[320];
+		int len = std::snprintf(header, sizeof(header),
+			"ply\nformat binary_little_endian 1.0\n"
+			"element vertex %lld\nproperty float x\nproperty float y\nproperty float z\n%s"
+			"element face %lld\nproperty list uchar int vertex_indices\nend_header\n",
+			(long long)nb_vertices_, normals ? "property float nx\nproperty float ny\nproperty float nz\n" : "",
+			(long long)nb_triangles_);
+		out_write(header, size_t(len));
+		bool ok = for_each_chunk(vertex_spill_, vertices_, [&](const float *p, size_t n) {
+			if (!normals)
+			{
+				out_write(p, n*sizeof(float));
+				return;
+			}
+			//normals only come with unspilled vertices, p is vertices_
+			for (size_t i = 0; i < n; i += 3)
+			{
+				put(p + i, 3 * sizeof(float));
+				put(&normals_[i], 3 * sizeof(float));
+			}
+		});
+		ok = for_each_chunk(triangle_spill_, triangles_, [&](const uint32_t *t, size_t n) {
+			char face[13];
+			face[0] = 3;
+			for (size_t i = 0; i < n; i += 3)
+			{
+				std::memcpy(face + 1, t + i, 3 * sizeof(uint32_t));
+				put(face, sizeof(face));
+			}
+		}) && ok;
+		flush();
+		return ok && out_ok_;
+	}
+
+	bool write_stl() {
+		std::vector<float> positions;
+		bool ok = for_each_chunk(vertex_spill_, vertices_, [&](const float *p, size_t n) {
+			positions.insert(positions.end(), p, p + n);
+		});
+		char header[80];
+		std::memset(header, 0, sizeof(header));
+		std::strncpy(header, "binary STL", sizeof(header));
+		out_write(header, sizeof(header));
+		uint32_t count = uint32_t(nb_triangles_);
+		out_write(&count, sizeof(count));
+		ok = for_each_chunk(triangle_spill_, triangles_, [&](const uint32_t *t, size_t n) {
+			char facet[50];
+			std::memset(facet + 48, 0, 2);
+			for (size_t i = 0; i < n; i += 3)
+			{
+				const float *a = &positions[3 * size_t(t[i])];
+				const float *b = &positions[3 * size_t(t[i + 1])];
+				const float *c = &positions[3 * size_t(t[i + 2])];
+				float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+				float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+				float nrm[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+					e1[0] * e2[1] - e1[1] * e2[0] };
+				float l = std::sqrt(nrm[0] * nrm[0] + nrm[1] * nrm[1] + nrm[2] * nrm[2]);
+				if (l > 0)
+				{
+					nrm[0] /= l; nrm[1] /= l; nrm[2] /= l;
+				}
+				std::memcpy(facet, nrm, 12);
+				std::memcpy(facet + 12, a, 12);
+				std::memcpy(facet + 24, b, 12);
+				std::memcpy(facet + 36, c, 12);
+				put(facet, sizeof(facet));
+			}
+		}) && ok;
+		flush();
+		return ok && out_ok_;
+	}
+
+	//the chunks GEO::OutputGeoFile writes for a triangulated GEO::Mesh with
+	//single precision points
+	bool write_geogram() {
+		geo_chunk("HEAD", geo_string_size("GEOGRAM") + geo_string_size("1.0"));
+		geo_string("GEOGRAM");
+		geo_string("1.0");
+
+		geo_set("GEO::Mesh::vertices", nb_vertices_);
+		geo_attribute("GEO::Mesh::vertices", "point_fp32", "float", sizeof(float), 3, nb_vertices_);
+		flush();
+		bool ok = for_each_chunk(vertex_spill_, vertices_, [&](const float *p, size_t n) {
+			out_write(p, n*sizeof(float));
+		});
+		if (!normals_.empty())
+		{
+			geo_attribute("GEO::Mesh::vertices", "normal", "float", sizeof(float), 3, nb_vertices_);
+			flush();
+			out_write(normals_.data(), normals_.size()*sizeof(float));
+		}
+		geo_set("GEO::Mesh::facets", nb_triangles_);
+		geo_set("GEO::Mesh::facet_corners", 3 * nb_triangles_);
+		std::vector<uint32_t> corners;
+		ok = for_each_chunk(triangle_spill_, triangles_, [&](const uint32_t *t, size_t n) {
+			corners.insert(corners.end(), t, t + n);
+		}) && ok;
+		geo_attribute("GEO::Mesh::facet_corners", "GEO::Mesh::facet_corners::corner_vertex",
+			"index_t", sizeof(uint32_t), 1, 3 * nb_triangles_);
+		flush();
+		out_write(corners.data(), corners.size()*sizeof(uint32_t));
+		//GEO::mesh_load() does not connect the facets of geogram files
+		std::vector<uint32_t> adjacent;
+		adjacent_facets(corners, nb_vertices_, adjacent);
+		geo_attribute("GEO::Mesh::facet_corners", "GEO::Mesh::facet_corners::corner_adjacent_facet",
+			"index_t", sizeof(uint32_t), 1, 3 * nb_triangles_);
+		flush();
+		out_write(adjacent.data(), adjacent.size()*sizeof(uint32_t));
+		return ok && out_ok_;
+	}
+
+	//per corner c of the triangles, the triangle across the edge from c to
+	//the next corner, as GEO::MeshFacets::connect() pairs them: the edge
+	//taken the other way, else GEO::NO_FACET. Corners are bucketed by their
+	//vertex so the opposite edge is looked for among the corners of one vertex.
+	static void adjacent_facets(const std::vector<uint32_t> &corners, int64_t nb_vertices,
+		std::vector<uint32_t> &adjacent) {
+		const uint32_t no_facet = ~uint32_t(0);
+		const size_t nc = corners.size();
+		std::vector<uint32_t> start(size_t(nb_vertices) + 1, 0);
+		for (size_t c = 0; c < nc; c++)
+		{
+			start[corners[c] + 1]++;
+		}
+		for (size_t v = 0; v < size_t(nb_vertices); v++)
+		{
+			start[v + 1] += start[v];
+		}
+		std::vector<uint32_t> around(nc);
+		std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+		for (size_t c = 0; c < nc; c++)
+		{
+			around[fill[corners[c]]++] = uint32_t(c);
+		}
+		adjacent.assign(nc, no_facet);
+		for (size_t c = 0; c < nc; c++)
+		{
+			if (adjacent[c] != no_facet)
+			{
+				continue;
+			}
+			const uint32_t a = corners[c], b = corners[c - c % 3 + (c + 1) % 3];
+			for (uint32_t k = start[b]; k < start[b + 1]; k++)
+			{
+				const uint32_t d = around[k];
+				if (adjacent[d] == no_facet && d / 3 != c / 3 && corners[d - d % 3 + (d + 1) % 3] == a)
+				{
+					adjacent[c] = d / 3;
+					adjacent[d] = uint32_t(c / 3);
+					break;
+				}
+			}
+		}
+	}
+
+	static size_t geo_string_size(const std::string &s) { return sizeof(uint32_t) + s.size(); }
+
+	void geo_chunk(const char *name, size_t size) {
+		uint64_t s = size;
+		put(name, 4);
+		put(&s, sizeof(s));
+	}
+
+	void geo_string(const std::string &s) {
+		uint32_t n = uint32_t(s.size());
+		put(&n, sizeof(n));
+		put(s.data(), s.size());
+	}
+
+	void geo_set(const std::string &name, int64_t nb_items) {
+		geo_chunk("ATTS", geo_string_size(name) + sizeof(uint32_t));
+		geo_string(name);
+		uint32_t n = uint32_t(nb_items);
+		put(&n, sizeof(n));
+	}
+
+	//header of an attribute, its data follows
+	void geo_attribute(const std::string &set, const std::string &name, const std::string &type,
+		uint32_t element_size, uint32_t dimension, int64_t nb_items) {
+		size_t data = size_t(element_size)*dimension*size_t(nb_items);
+		geo_chunk("ATTR", geo_string_size(set) + geo_string_size(name) + geo_string_size(type) +
+			2 * sizeof(uint32_t) + data);
+		geo_string(set);
+		geo_string(name);
+		geo_string(type);
+		put(&element_size, sizeof(element_size));
+		put(&dimension, sizeof(dimension));
+	}
+
+	std::string file_;
+	MeshFileFormat format_;
+	bool compress_;
+	bool is_open_;
+	std::vector<float> vertices_;//3 per vertex not spilled yet
+	std::vector<float> normals_;//3 per vertex, only from write()
+	std::vector<uint32_t> triangles_;//3 per triangle not spilled yet
+	FILE *vertex_spill_;
+	FILE *triangle_spill_;
+	bool spill_ok_ = true;
+	int64_t nb_vertices_;
+	int64_t nb_triangles_;
+
+	FILE *out_file_ = NULL;
+	gzFile out_gz_ = NULL;
+	bool out_ok_ = true;
+	std::vector<char> chunk_;
+	size_t chunk_size_ = 0;//bytes of chunk_ in use
+};
+
+#endif
@@ -0,0 +1,283 @@
+#pragma once
+#ifndef _OCCUPANCY_GRID_
+#define _OCCUPANCY_GRID_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//Dense occupancy volume, one bit per voxel.
+//Rows run along x and are padded to whole 64-bit words, so a row can be
+//compared with its y/z neighbour rows word by word and the x neighbours
+//are obtained by shifting the row by one bit.
+
+enum FaceDirection
+{
+	FACE_XPLUS, FACE_XMINUS, FACE_YPLUS, FACE_YMINUS, FACE_ZPLUS, FACE_ZMINUS, FACE_NB
+};
+
+//cube corners: -x-y-z:0; x-y-z:1; xy-z:2; -xy-z:3; then the same at +z
+static const int cube_corner_offset[8][3] = {
+	{ 0,0,0 },{ 1,0,0 },{ 1,1,0 },{ 0,1,0 },
+	{ 0,0,1 },{ 1,0,1 },{ 1,1,1 },{ 0,1,1 } };
+
+//two triangles per face, outward oriented, same split as the former xfacet..z_facet code
+static const int cube_face_triangles[FACE_NB][6] = {
+	{ 1,2,6, 1,6,5 },//x
+	{ 0,4,7, 0,7,3 },//-x
+	{ 2,3,7, 2,7,6 },//y
+	{ 0,1,5, 0,5,4 },//-y
+	{ 4,5,6, 4,6,7 },//z
+	{ 0,3,2, 0,2,1 } //-z
+};
+
+inline int count_bits(uint64_t w)
+{
+#ifdef _MSC_VER
+	return int(__popcnt64(w));
+#else
+	return __builtin_popcountll(w);
+#endif
+}
+
+inline int lowest_bit(uint64_t w)
+{
+#ifdef _MSC_VER
+	unsigned long id;
+	_BitScanForward64(&id, w);
+	return int(id);
+#else
+	return __builtin_ctzll(w);
+#endif
+}
+
+inline int highest_bit(uint64_t w)
+{
+#ifdef _MSC_VER
+	unsigned long id;
+	_BitScanReverse64(&id, w);
+	return int(id);
+#else
+	return 63 - __builtin_clzll(w);
+#endif
+}
+
+//lattice index of a voxel corner, the numbering used by corners_pts
+inline int lattice_corner_index(int x, int y, int z, int width_, int height_)
+{
+	return x*(height_ + 1) + y + z*(width_ + 1)*(height_ + 1);
+}
+
+//inverse of lattice_corner_index
+inline void lattice_corner_position(int corner, int width_, int height_, int &x, int &y, int &z)
+{
+	int layer = (width_ + 1)*(height_ + 1);
+	z = corner / layer;
+	x = (corner % layer) / (height_ + 1);
+	y = corner % (height_ + 1);
+}
+
+class OccupancyGrid
+{
+public:
+	OccupancyGrid() : nx(0), ny(0), nz(0), words_per_row(0) {}
+
+	OccupancyGrid(int nx_, int ny_, int nz_) : nx(0), ny(0), nz(0), words_per_row(0) {
+		resize(nx_, ny_, nz_);
+	}
+
+	void resize(int nx_, int ny_, int nz_) {
+		nx = std::max(nx_, 0);
+		ny = std::max(ny_, 0);
+		nz = std::max(nz_, 0);
+		words_per_row = (nx + 63) / 64;
+		bits.assign(size_t(words_per_row)*size_t(ny)*size_t(nz), 0);
+	}
+
+	void clear() {
+		std::fill(bits.begin(), bits.end(), 0);
+	}
+
+	int size_x() const { return nx; }
+	int size_y() const { return ny; }
+	int size_z() const { return nz; }
+	int row_words() const { return words_per_row; }
+
+	bool inside(int x, int y, int z) const {
+		return x >= 0 && y >= 0 && z >= 0 && x < nx && y < ny && z < nz;
+	}
+
+	//out of range reads as empty
+	bool get(int x, int y, int z) const {
+		if (!inside(x, y, z))
+		{
+			return false;
+		}
+		return (row(y, z)[x >> 6] >> (x & 63)) & 1;
+	}
+
+	void set(int x, int y, int z) {
+		row(y, z)[x >> 6] |= uint64_t(1) << (x & 63);
+	}
+
+	void reset(int x, int y, int z) {
+		row(y, z)[x >> 6] &= ~(uint64_t(1) << (x & 63));
+	}
+
+	uint64_t* row(int y, int z) {
+		return &bits[(size_t(z)*size_t(ny) + size_t(y))*size_t(words_per_row)];
+	}
+
+	const uint64_t* row(int y, int z) const {
+		return &bits[(size_t(z)*size_t(ny) + size_t(y))*size_t(words_per_row)];
+	}
+
+	//NULL outside the grid so callers can treat it as an empty row
+	const uint64_t* row_or_null(int y, int z) const {
+		if (y < 0 || z < 0 || y >= ny || z >= nz)
+		{
+			return NULL;
+		}
+		return row(y, z);
+	}
+
+	size_t count() const {
+		size_t n = 0;
+		for (size_t i = 0; i < bits.size(); i++)
+		{
+			n += count_bits(bits[i]);
+		}
+		return n;
+	}
+
+	size_t memory_bytes() const {
+		return bits.size()*sizeof(uint64_t);
+	}
+
+	//raw words, for bulk copies to and from the volume cache
+	uint64_t* data() { return bits.empty() ? NULL : &bits[0]; }
+	const uint64_t* data() const { return bits.empty() ? NULL : &bits[0]; }
+	size_t nb_words() const { return bits.size(); }
+
+	//calls f(x, y, z) for every occupied voxel, z then y then x ascending
+	template <class F>
+	void for_each_voxel(F f) const {
+		for (int z = 0; z < nz; z++)
+		{
+			for (int y = 0; y < ny; y++)
+			{
+				const uint64_t *r = row(y, z);
+				for (int w = 0; w < words_per_row; w++)
+				{
+					uint64_t m = r[w];
+					while (m)
+					{
+						f((w << 6) + lowest_bit(m), y, z);
+						m &= m - 1;
+					}
+				}
+			}
+		}
+	}
+
+	//bit x of mask[] is set when voxel (x,y,z) is occupied and
+	//its neighbour in direction dir is empty (or outside the grid)
+	void face_mask(int y, int z, int dir, uint64_t *mask) const {
+		const uint64_t *r = row(y, z);
+		const uint64_t *n = NULL;
+		switch (dir)
+		{
+		case FACE_XPLUS:
+			for (int w = 0; w < words_per_row; w++)
+			{
+				uint64_t next = (w + 1 < words_per_row) ? r[w + 1] : 0;
+				mask[w] = r[w] & ~((r[w] >> 1) | (next << 63));
+			}
+			return;
+		case FACE_XMINUS:
+			for (int w = 0; w < words_per_row; w++)
+			{
+				uint64_t prev = (w > 0) ? r[w - 1] : 0;
+				mask[w] = r[w] & ~((r[w] << 1) | (prev >> 63));
+			}
+			return;
+		case FACE_YPLUS: n = row_or_null(y + 1, z); break;
+		case FACE_YMINUS: n = row_or_null(y - 1, z); break;
+		case FACE_ZPLUS: n = row_or_null(y, z + 1); break;
+		case FACE_ZMINUS: n = row_or_null(y, z - 1); break;
+		default: break;
+		}
+		if (n == NULL)
+		{
+			std::copy(r, r + words_per_row, mask);
+			return;
+		}
+		for (int w = 0; w < words_per_row; w++)
+		{
+			mask[w] = r[w] & ~n[w];
+		}
+	}
+
+	//calls f(x, y, z, dir) for every exposed voxel face, row by row
+	template <class F>
+	void for_each_face(F f) const {
+		std::vector<uint64_t> mask(words_per_row);
+		for (int z = 0; z < nz; z++)
+		{
+			for (int y = 0; y < ny; y++)
+			{
+				for_each_face_in_row(y, z, mask, f);
+			}
+		}
+	}
+
+	//same as for_each_face() restricted to one row, mask is scratch space
+	template <class F>
+	void for_each_face_in_row(int y, int z, std::vector<uint64_t> &mask, F f) const {
+		if (!row_occupied(y, z))
+		{
+			return;
+		}
+		mask.resize(words_per_row);
+		for (int dir = 0; dir < FACE_NB; dir++)
+		{
+			face_mask(y, z, dir, &mask[0]);
+			for (int w = 0; w < words_per_row; w++)
+			{
+				uint64_t m = mask[w];
+				while (m)
+				{
+					int x = (w << 6) + lowest_bit(m);
+					f(x, y, z, dir);
+					m &= m - 1;
+				}
+			}
+		}
+	}
+
+	bool row_occupied(int y, int z) const {
+		const uint64_t *r = row(y, z);
+		for (int w = 0; w < words_per_row; w++)
+		{
+			if (r[w])
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	int nx;
+	int ny;
+	int nz;
+	int words_per_row;
+	std::vector<uint64_t> bits;
+};
+
+#endif
@@ -0,0 +1,222 @@
+#pragma once
+#ifndef _SLAB_STREAM_
+#define _SLAB_STREAM_
+
+#include <map>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <functional>
+
+#include "task_pool.h"
+
+#include "label_surface.h"
+#include "stack_dims.h"
+#include "mesh_stream.h"
+
+//Surfaces of every label of a stack too big for memory, streamed to disk
+//slab by slab. The slices of a slab and one on each side of it (the halo
+//the faces across its bounds are tested against) are asked for, their
+//faces extracted, welded and written, then the slab is dropped, so the
+//working set is one slab whatever the size of the stack. The vertices on
+//the top bound of a slab are kept for the next one, so the surfaces stay
+//welded across slabs: the files hold the surfaces a whole stack
+//extraction gives, up to the order of vertices and triangles.
+class SlabStream
+{
+public:
+	//source(z, masks) fills one mask per label for slice z, in image
+	//coordinates; it is called from several threads at once
+	typedef std::function<void(int, std::vector<SliceMask>&)> SliceSource;
+	//called once a slab of slices [z0, z1) is written
+	typedef std::function<void(int, int)> SlabDone;
+
+	//the masks are cropped to dims, the geometry places the whole stack
+	SlabStream(const StackDims &dims, int nb_slices, int nb_labels, const std::vector<int> &priority,
+		const VoxelGeometry &geometry) : dims_(dims), nb_slices_(nb_slices), nb_labels_(nb_labels),
+		priority_(priority), geometry_(geometry) {}
+
+	//writes the surface of label l to writers[l], slab_slices slices at a time
+	void write(const SliceSource &source, int slab_slices, const std::vector<MeshStreamWriter*> &writers,
+		const SlabDone &done = SlabDone()) {
+		if (nb_labels_ > LABEL_SURFACE_MAX_LABELS || writers.size() < nb_labels_)
+		{
+			return;
+		}
+		slab_slices = std::max(slab_slices, 1);
+		std::map<int, std::vector<SliceMask>> slices;//the slab and its halo
+		std::vector<std::vector<Bound>> bounds(nb_labels_);
+		for (int z0 = 0; z0 < nb_slices_; z0 += slab_slices)
+		{
+			const int z1 = std::min(z0 + slab_slices, nb_slices_);
+			const int h0 = std::max(z0 - 1, 0), h1 = std::min(z1 + 1, nb_slices_);
+
+			//the halo below was the top of the previous slab, only decode the rest
+			slices.erase(slices.begin(), slices.lower_bound(h0));
+			std::vector<int> missing;
+			for (int z = h0; z < h1; z++)
+			{
+				if (slices.find(z) == slices.end())
+				{
+					missing.push_back(z);
+				}
+			}
+			std::vector<std::vector<SliceMask>> fetched(missing.size());
+			task_parallel_for(0, GEO::index_t(missing.size()), [&](GEO::index_t i) {
+				source(missing[i], fetched[i]);
+			});
+			for (int i = 0; i < missing.size(); i++)
+			{
+				slices[missing[i]].swap(fetched[i]);
+			}
+
+			BrickVolume volume(dims_.width, dims_.height, h1 - h0, nb_labels_);
+			fill_volume(slices, h0, volume);
+			std::vector<LabelFaces> parts;
+			extract_slab(volume, z0 - h0, z1 - h0, parts);
+			task_parallel_for(0, GEO::index_t(nb_labels_), [&](GEO::index_t l) {
+				write_label(int(l), parts, z0 - h0, z1 - h0, h0, bounds[l], *writers[l]);
+			});
+			if (done)
+			{
+				done(z0, z1);
+			}
+		}
+	}
+
+private:
+	//a vertex on a slab bound, its corner in the plane and its id in the file
+	typedef std::pair<int, int64_t> Bound;
+
+	void fill_volume(const std::map<int, std::vector<SliceMask>> &slices, int h0, BrickVolume &volume) const {
+		const int w = dims_.width, h = dims_.height;
+		for (std::map<int, std::vector<SliceMask>>::const_iterator it = slices.begin(); it != slices.end(); ++it)
+		{
+			const int z = it->first - h0;
+			for (int l = 0; l < nb_labels_ && l < it->second.size(); l++)
+			{
+				it->second[l].for_each_pixel([&](int x, int y) {
+					x -= dims_.min_x;
+					y -= dims_.min_y;
+					if (x >= 0 && y >= 0 && x < w && y < h)
+					{
+						volume.set(l, x, y, z);
+					}
+				});
+			}
+		}
+	}
+
+	//faces of the voxels of volume slices [s0, s1), the others only answer
+	//the neighbour tests; lattice z is that of the volume
+	void extract_slab(const BrickVolume &volume, int s0, int s1, std::vector<LabelFaces> &parts) const {
+		std::vector<int> order = volume.brick_order(s0, s1);
+		const GEO::index_t nb = GEO::index_t(order.size());
+		const GEO::index_t nb_parts = task_nb_parts(nb, BRICKS_MIN_PER_PART);
+		parts.assign(nb_parts, LabelFaces());
+
+		const int w = volume.size_x(), h = volume.size_y();
+		task_parallel_ranges(nb, nb_parts, [&](GEO::index_t part, GEO::index_t b_from, GEO::index_t b_to) {
+			LabelFaces &out = parts[part];
+			uint64_t own[LABEL_SURFACE_MAX_LABELS][BRICK_SIZE];
+			for (GEO::index_t i = b_from; i < b_to; i++)
+			{
+				int b = order[i];
+				int ox, oy, oz;
+				volume.brick_origin(b, ox, oy, oz);
+				exclusive_label_planes(volume, priority_, b, own);
+				for_each_label_face_in_brick(volume, priority_, b, own,
+					[&](uint64_t mask, int k, int dir, int f, int bk) {
+					int z = oz + k;
+					if (z >= s0 && z < s1)
+					{
+						out.emit(mask, ox, oy, z, dir, f, bk, w, h);
+					}
+				});
+			}
+		});
+	}
+
+	//welds the faces of label l over volume slices [s0, s1) and appends
+	//them to the file; bound holds the vertices of the bottom plane on
+	//entry, those of the top plane on return
+	void write_label(int label, const std::vector<LabelFaces> &parts, int s0, int s1, int h0,
+		std::vector<Bound> &bound, MeshStreamWriter &writer) const {
+		const int w = dims_.width, h = dims_.height;
+		CornerWelder welder;
+		welder.resize(w, h, s0, s1 - s0);
+		for (int p = 0; p < parts.size(); p++)
+		{
+			const LabelFaces &in = parts[p];
+			for (size_t t = 0; t < in.nb_triangles(); t++)
+			{
+				if (in.front[t] == label || in.back[t] == label)
+				{
+					for (int k = 0; k < 3; k++)
+					{
+						welder.insert(in.corners[3 * t + k]);
+					}
+				}
+			}
+		}
+		welder.build();
+
+		//corners come in lattice order, so the planes come out sorted
+		std::vector<int64_t> ids(welder.nb_corners());
+		std::vector<Bound> top;
+		int v = 0;
+		welder.for_each_corner([&](int corner) {
+			int x, y, z;
+			lattice_corner_position(corner, w, h, x, y, z);
+			const int in_plane = lattice_corner_index(x, y, 0, w, h);
+			int64_t id = -1;
+			if (z == s0)
+			{
+				std::vector<Bound>::const_iterator it = std::lower_bound(bound.begin(), bound.end(),
+					Bound(in_plane, int64_t(-1)));
+				if (it != bound.end() && it->first == in_plane)
+				{
+					id = it->second;
+				}
+			}
+			if (id < 0)
+			{
+				double p[3];
+				geometry_.corner(x, y, z + h0, 0, p);
+				id = writer.add_vertex(float(p[0]), float(p[1]), float(p[2]));
+			}
+			if (z == s1)
+			{
+				top.push_back(Bound(in_plane, id));
+			}
+			ids[v++] = id;
+		});
+		bound.swap(top);
+
+		for (int p = 0; p < parts.size(); p++)
+		{
+			const LabelFaces &in = parts[p];
+			for (size_t t = 0; t < in.nb_triangles(); t++)
+			{
+				const int *c = &in.corners[3 * t];
+				if (in.front[t] == label)
+				{
+					writer.add_triangle(ids[welder.id(c[0])], ids[welder.id(c[1])], ids[welder.id(c[2])]);
+				}
+				else if (in.back[t] == label)
+				{
+					writer.add_triangle(ids[welder.id(c[0])], ids[welder.id(c[2])], ids[welder.id(c[1])]);
+				}
+			}
+		}
+	}
+
+	StackDims dims_;
+	int nb_slices_;
+	int nb_labels_;
+	std::vector<int> priority_;
+	VoxelGeometry geometry_;
+};
+
+#endif
@@ -0,0 +1,325 @@
+#pragma once
+#ifndef _SLAB_SURFACE_
+#define _SLAB_SURFACE_
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <mutex>
+
+#include "task_pool.h"
+
+#include "label_surface.h"
+
+//Surfaces of windows of consecutive slices, assembled from pieces that are
+//extracted once. The stack is cut at every window bound:
+//- a piece, between two cuts, keeps the faces inside it;
+//- a seam, at an inner cut, keeps the faces across that cut.
+//Window [c_a, c_b) is the pieces and seams in between plus two caps, the
+//faces its first and last slices have against the background, which are
+//generated from the volume when the window is assembled. So a slice is
+//meshed once however many windows overlap it and a window only costs its
+//caps and welding. With a cut at every slice any slab of the stack can be
+//assembled that way. Pieces are extracted all at once by extract(), or
+//per window on first use by extract_window().
+class SlabSurfaces
+{
+public:
+	SlabSurfaces() : volume_(NULL), z_from_(0), width_(0), height_(0), merge_(false), smooth_(false) {}
+
+	//cuts are slices of the lattice, those outside the volume are dropped.
+	//The volume is kept to extract pieces and caps, it must outlive them.
+	//merge merges coplanar faces into rectangles (see face_merge.h), smooth
+	//places the vertices of the windows on a surface net (see
+	//surface_nets.h) and then faces are never merged, a bent rectangle
+	//would no longer follow the surface.
+	void set_volume(const BrickVolume &volume, const std::vector<int> &priority,
+		const std::vector<int> &window_cuts, int z_from, bool merge = false, bool smooth = false) {
+		volume_ = &volume;
+		merge_ = merge && !smooth;
+		smooth_ = smooth;
+		nets_ = SurfaceNets(volume, priority, z_from);
+		priority_ = priority;
+		z_from_ = z_from;
+		width_ = volume.size_x();
+		height_ = volume.size_y();
+		const int nz = volume.size_z();
+		cuts.clear();
+		cuts.push_back(z_from);
+		cuts.push_back(z_from + nz);
+		for (int i = 0; i < window_cuts.size(); i++)
+		{
+			if (window_cuts[i] > z_from && window_cuts[i] < z_from + nz)
+			{
+				cuts.push_back(window_cuts[i]);
+			}
+		}
+		std::sort(cuts.begin(), cuts.end());
+		cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+		fragments.assign(SLAB_NB_KINDS * cuts.size(), LabelFaces());
+		done.assign(fragments.size(), 0);
+
+		//piece of every slice, cut index of every slice bound (-1 for none)
+		piece_of.assign(nz, 0);
+		cut_of.assign(nz + 1, -1);
+		for (int c = 0; c < cuts.size(); c++)
+		{
+			cut_of[cuts[c] - z_from] = c;
+		}
+		for (int z = 0, c = 0; z < nz; z++)
+		{
+			if (cut_of[z] >= 0)
+			{
+				c = cut_of[z];
+			}
+			piece_of[z] = c;
+		}
+	}
+
+	//every piece at once
+	void extract(const BrickVolume &volume, const std::vector<int> &priority,
+		const std::vector<int> &window_cuts, int z_from, bool merge = false, bool smooth = false) {
+		set_volume(volume, priority, window_cuts, z_from, merge, smooth);
+		extract_window(cuts.front(), cuts.back());
+	}
+
+	//extracts the pieces of window [z0, z1) not extracted yet, concurrent
+	//calls are serialized. The lock is held while the extraction forks: a
+	//thread waiting for those tasks only runs them and the ones they fork
+	//(see task_pool.h), never another extract_window() of the same thread.
+	void extract_window(int z0, int z1) {
+		int ca, cb;
+		if (volume_ == NULL || !window_cuts(z0, z1, ca, cb))
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::vector<char> wanted(fragments.size(), 0);
+		for (int c = ca; c < cb; c++)
+		{
+			wanted[fragment(SLAB_PIECE, c)] = 1;
+			wanted[fragment(SLAB_SEAM, c)] = (c > ca);
+		}
+		bool any = false;
+		for (int id = 0; id < wanted.size(); id++)
+		{
+			wanted[id] = wanted[id] && !done[id];
+			any = any || wanted[id];
+		}
+		if (any)
+		{
+			extract_fragments(wanted, ca, cb);
+		}
+	}
+
+	//caps of window [z0, z1), to pass to window_mesh() for every label
+	void window_caps(int z0, int z1, LabelFaces &caps) const {
+		caps = LabelFaces();
+		int ca, cb;
+		if (volume_ == NULL || !window_cuts(z0, z1, ca, cb))
+		{
+			return;
+		}
+		add_cap(cuts[ca] - z_from_, FACE_ZMINUS, caps);
+		add_cap(cuts[cb] - 1 - z_from_, FACE_ZPLUS, caps);
+	}
+
+	//surface of one label in lattice slices [z0, z1), both must be cuts or
+	//outside the volume, and the window extracted
+	void window_mesh(int label, int z0, int z1, const LabelFaces &caps,
+		const VoxelGeometry &geometry, IndexedMesh &mesh) const {
+		int ca, cb;
+		if (!window_cuts(z0, z1, ca, cb))
+		{
+			mesh.clear();
+			return;
+		}
+		std::vector<const LabelFaces*> faces;
+		window_faces(ca, cb, caps, faces);
+		weld_label_faces(faces, label, width_, height_, cuts[ca], cuts[cb] - cuts[ca], geometry, mesh,
+			smooth_ ? &nets_ : NULL);
+	}
+
+	//surfaces of every label in the same window welded together, to be
+	//smoothed or decimated as one before label_mesh() cuts them out (see
+	//MultiLabelSurface)
+	void window_surface(int z0, int z1, const LabelFaces &caps, const VoxelGeometry &geometry,
+		MultiLabelSurface &surface) const {
+		int ca, cb;
+		if (!window_cuts(z0, z1, ca, cb))
+		{
+			surface.clear();
+			return;
+		}
+		std::vector<const LabelFaces*> faces;
+		window_faces(ca, cb, caps, faces);
+		surface.weld(faces, width_, height_, cuts[ca], cuts[cb] - cuts[ca], geometry);
+		if (smooth_)
+		{
+			surface.place(nets_);
+		}
+	}
+
+	const std::vector<int>& get_cuts() const { return cuts; }
+
+private:
+	enum SlabKind
+	{
+		SLAB_PIECE, SLAB_SEAM, SLAB_NB_KINDS
+	};
+
+	int fragment(int kind, int cut) const {
+		return kind*int(cuts.size()) + cut;
+	}
+
+	//the caps, pieces and seams of the window between cuts ca and cb
+	void window_faces(int ca, int cb, const LabelFaces &caps, std::vector<const LabelFaces*> &faces) const {
+		faces.clear();
+		faces.push_back(&caps);
+		for (int c = ca; c < cb; c++)
+		{
+			if (c > ca)
+			{
+				faces.push_back(&fragments[fragment(SLAB_SEAM, c)]);
+			}
+			faces.push_back(&fragments[fragment(SLAB_PIECE, c)]);
+		}
+	}
+
+	//the wanted fragments, all between cuts ca and cb
+	void extract_fragments(const std::vector<char> &wanted, int ca, int cb) {
+		const BrickVolume &volume = *volume_;
+		if (volume.nb_labels() > LABEL_SURFACE_MAX_LABELS)
+		{
+			return;
+		}
+		//the slices next to the window hold one side of its seams
+		std::vector<int> order = volume.brick_order(cuts[ca] - z_from_ - 1, cuts[cb] - z_from_ + 1);
+		const GEO::index_t nb = GEO::index_t(order.size());
+		const GEO::index_t nb_parts = task_nb_parts(nb, BRICKS_MIN_PER_PART);
+		std::vector<std::vector<LabelFaces>> parts(nb_parts, std::vector<LabelFaces>(fragments.size()));
+
+		const int w = width_, h = height_;
+		const int last = int(cuts.size()) - 1;
+		task_parallel_ranges(nb, nb_parts, [&](GEO::index_t part, GEO::index_t b_from, GEO::index_t b_to) {
+			std::vector<LabelFaces> &out = parts[part];
+			BrickFaceMerger merger;
+			uint64_t own[LABEL_SURFACE_MAX_LABELS][BRICK_SIZE];
+			for (GEO::index_t i = b_from; i < b_to; i++)
+			{
+				int b = order[i];
+				int ox, oy, oz;
+				volume.brick_origin(b, ox, oy, oz);
+				exclusive_label_planes(volume, priority_, b, own);
+				for_each_label_face_in_brick(volume, priority_, b, own,
+					[&](uint64_t mask, int k, int dir, int f, int bk) {
+					int z = oz + k;
+					int c = (dir == FACE_ZPLUS) ? cut_of[z + 1] : (dir == FACE_ZMINUS) ? cut_of[z] : -1;
+					if (c == 0 || c == last)
+					{
+						return;//the outer caps
+					}
+					int id = (c > 0) ? fragment(SLAB_SEAM, c) : fragment(SLAB_PIECE, piece_of[z]);
+					if (!wanted[id])
+					{
+						return;
+					}
+					if (merge_)
+					{
+						merger.add(mask, k, dir, f, bk, id);
+					}
+					else
+					{
+						out[id].emit(mask, ox, oy, z + z_from_, dir, f, bk, w, h);
+					}
+				});
+				merger.flush(ox, oy, oz + z_from_, w, h, [&](const int q[4], int f, int bk, int id) {
+					out[id].emit_quad(q, f, bk);
+				});
+			}
+		});
+
+		task_parallel_for(0, GEO::index_t(fragments.size()), [&](GEO::index_t id) {
+			if (!wanted[id])
+			{
+				return;
+			}
+			for (GEO::index_t p = 0; p < nb_parts; p++)
+			{
+				fragments[id].append(parts[p][id]);
+			}
+			done[id] = 1;
+		});
+	}
+
+	//faces of volume slice z against the background in direction dir
+	void add_cap(int z, int dir, LabelFaces &cap) const {
+		const BrickVolume &volume = *volume_;
+		if (volume.nb_labels() > LABEL_SURFACE_MAX_LABELS)
+		{
+			return;
+		}
+		uint64_t own[LABEL_SURFACE_MAX_LABELS][BRICK_SIZE];
+		BrickFaceMerger merger;
+		std::vector<int> order = volume.brick_order(z, z + 1);
+		for (int i = 0; i < order.size(); i++)
+		{
+			int ox, oy, oz;
+			volume.brick_origin(order[i], ox, oy, oz);
+			exclusive_label_planes(volume, priority_, order[i], own);
+			for (int l = 0; l < volume.nb_labels(); l++)
+			{
+				if (merge_)
+				{
+					if (own[l][z - oz])
+					{
+						merger.add(own[l][z - oz], z - oz, dir, l, -1, 0);
+					}
+				}
+				else
+				{
+					cap.emit(own[l][z - oz], ox, oy, z + z_from_, dir, l, -1, width_, height_);
+				}
+			}
+			merger.flush(ox, oy, oz + z_from_, width_, height_, [&](const int q[4], int f, int bk, int) {
+				cap.emit_quad(q, f, bk);
+			});
+		}
+	}
+
+	//cut indices of window [z0, z1) clamped to the volume, false when empty or not on cuts
+	bool window_cuts(int z0, int z1, int &ca, int &cb) const {
+		if (cuts.empty())
+		{
+			return false;
+		}
+		z0 = std::max(z0, cuts.front());
+		z1 = std::min(z1, cuts.back());
+		std::vector<int>::const_iterator a = std::lower_bound(cuts.begin(), cuts.end(), z0);
+		std::vector<int>::const_iterator b = std::lower_bound(cuts.begin(), cuts.end(), z1);
+		if (z0 >= z1 || *a != z0 || *b != z1)
+		{
+			return false;
+		}
+		ca = int(a - cuts.begin());
+		cb = int(b - cuts.begin());
+		return true;
+	}
+
+	const BrickVolume *volume_;
+	std::vector<int> priority_;
+	int z_from_;
+	int width_;
+	int height_;
+	bool merge_;
+	bool smooth_;
+	SurfaceNets nets_;
+	std::vector<int> cuts;//sorted, the volume bounds included
+	std::vector<int> piece_of;//per slice of the volume
+	std::vector<int> cut_of;//per slice bound of the volume, -1 when not a cut
+	std::vector<LabelFaces> fragments;//SLAB_NB_KINDS per cut
+	std::vector<char> done;//per fragment
+	std::mutex mutex_;//extract_window()
+};
+
+#endif
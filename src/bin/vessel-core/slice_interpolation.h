@@ -0,0 +1,154 @@
+#pragma once
+#ifndef _SLICE_INTERPOLATION_
+#define _SLICE_INTERPOLATION_
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "mask_loader.h"
+
+//Shape-based interpolation of slice masks. Each mask becomes the signed
+//distance to its edge (exact Euclidean distance transform, two 1D passes
+//of lower parabola envelopes), the distances of two consecutive masks are
+//blended linearly and the slices in between are where the blend is
+//negative. A vessel cut obliquely thus slides and narrows from one mask
+//to the next instead of stepping by a whole slice, and a vessel that ends
+//tapers off. Interpolated pixels always belong to one of the two masks.
+
+//far from any site, as in the usual distance transform implementations
+#define DISTANCE_FAR 1e20f
+
+//d[i] = min over j of (i - j)^2 + f[j] for n samples; v and z hold n and
+//n + 1 values
+inline void squared_distance_1d(const float *f, int n, float *d, int *v, float *z)
+{
+	int k = 0;
+	v[0] = 0;
+	z[0] = -DISTANCE_FAR;
+	z[1] = DISTANCE_FAR;
+	for (int q = 1; q < n; q++)
+	{
+		float s = ((f[q] + float(q)*q) - (f[v[k]] + float(v[k])*v[k])) / (2.0f*(q - v[k]));
+		while (s <= z[k])
+		{
+			k--;
+			s = ((f[q] + float(q)*q) - (f[v[k]] + float(v[k])*v[k])) / (2.0f*(q - v[k]));
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = DISTANCE_FAR;
+	}
+	k = 0;
+	for (int q = 0; q < n; q++)
+	{
+		while (z[k + 1] < q)
+		{
+			k++;
+		}
+		d[q] = float(q - v[k])*(q - v[k]) + f[v[k]];
+	}
+}
+
+//squared distance of every pixel of a w x h grid to the nearest pixel
+//where site is 0 (DISTANCE_FAR elsewhere), in place
+inline void squared_distance_2d(std::vector<float> &grid, int w, int h)
+{
+	const int n = std::max(w, h);
+	std::vector<float> f(n), d(n), z(n + 1);
+	std::vector<int> v(n);
+	for (int x = 0; x < w; x++)
+	{
+		for (int y = 0; y < h; y++)
+		{
+			f[y] = grid[size_t(y)*w + x];
+		}
+		squared_distance_1d(&f[0], h, &d[0], &v[0], &z[0]);
+		for (int y = 0; y < h; y++)
+		{
+			grid[size_t(y)*w + x] = d[y];
+		}
+	}
+	for (int y = 0; y < h; y++)
+	{
+		float *row = &grid[size_t(y)*w];
+		squared_distance_1d(row, w, &d[0], &v[0], &z[0]);
+		std::copy(d.begin(), d.begin() + w, row);
+	}
+}
+
+//signed distance to the edge of mask over the pixels of box (which must
+//have a pixel outside the mask on each side), negative inside, half a
+//pixel off the pixel centers so that thresholding it at 0 gives the mask
+//back; an empty mask is half a pixel away everywhere
+inline void signed_distance(const SliceMask &mask, const PixelBox &box, std::vector<float> &sd)
+{
+	const int w = box.width(), h = box.height();
+	sd.assign(size_t(w)*h, 0.5f);
+	if (mask.empty())
+	{
+		return;
+	}
+	std::vector<float> inside(size_t(w)*h), outside(size_t(w)*h);
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			const bool in = mask.get(box.min_x + x, box.min_y + y);
+			inside[size_t(y)*w + x] = in ? 0.0f : DISTANCE_FAR;
+			outside[size_t(y)*w + x] = in ? DISTANCE_FAR : 0.0f;
+		}
+	}
+	squared_distance_2d(inside, w, h);
+	squared_distance_2d(outside, w, h);
+	for (size_t i = 0; i < sd.size(); i++)
+	{
+		sd[i] = (outside[i] > 0.0f) ? 0.5f - std::sqrt(outside[i]) : std::sqrt(inside[i]) - 0.5f;
+	}
+}
+
+//the n masks between a and b, evenly spaced
+inline void interpolate_masks(const SliceMask &a, const SliceMask &b, int n, std::vector<SliceMask> &out)
+{
+	out.resize(std::max(n, 0));
+	const int width = std::max(a.width, b.width), height = std::max(a.height, b.height);
+	for (int i = 0; i < out.size(); i++)
+	{
+		out[i].resize(width, height);
+	}
+	PixelBox box;
+	box.merge(a.box);
+	box.merge(b.box);
+	if (n <= 0 || box.empty())
+	{
+		return;
+	}
+	//a pixel of margin so that both masks have outside pixels all around
+	box.add(box.min_x - 1, box.min_y - 1);
+	box.add(box.max_x + 1, box.max_y + 1);
+	std::vector<float> da, db;
+	signed_distance(a, box, da);
+	signed_distance(b, box, db);
+	const int w = box.width(), h = box.height();
+	for (int i = 0; i < n; i++)
+	{
+		const float t = float(i + 1) / float(n + 1);
+		SliceMask &m = out[i];
+		for (int y = 0; y < h; y++)
+		{
+			for (int x = 0; x < w; x++)
+			{
+				const size_t p = size_t(y)*w + x;
+				if ((1.0f - t)*da[p] + t*db[p] < 0.0f)
+				{
+					const int px = box.min_x + x, py = box.min_y + y;
+					m.row(py)[px >> 6] |= uint64_t(1) << (px & 63);
+					m.box.add(px, py);
+				}
+			}
+		}
+	}
+}
+
+#endif
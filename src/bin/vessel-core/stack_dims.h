@@ -0,0 +1,61 @@
+#pragma once
+#ifndef _STACK_DIMS_
+#define _STACK_DIMS_
+
+#include <vector>
+#include <algorithm>
+
+#include "mask_loader.h"
+#include "voxel_spacing.h"
+
+//Size of one mask stack. Each loader owns its own instead of writing
+//process globals, so stacks can be loaded side by side. width/height are
+//those of the box the masks were cropped to, min_x/min_y its corner in
+//the images, slice the number of slices the geometry spreads over and
+//spacing the size of their voxels.
+struct StackDims
+{
+	int width = 0;
+	int height = 0;
+	int slice = 0;
+	int min_x = 0;
+	int min_y = 0;
+	VoxelSpacing spacing;
+
+	int voxel_index(int x, int y, int z) const {
+		return x*height + y + z*width*height;
+	}
+
+	//grows to hold the images of files, false when the first one cannot be read
+	bool add_mask_files(const std::vector<QString> &files) {
+		int w = 0, h = 0;
+		if (files.empty() || !read_mask_size(files[0], w, h))
+		{
+			return false;
+		}
+		width = std::max(width, w);
+		height = std::max(height, h);
+		slice = std::max(slice, int(files.size()));
+		return true;
+	}
+
+	//the union of the boxes of every slice, each found by its own worker;
+	//an empty stack keeps one pixel
+	void crop_to(const std::vector<PixelBox> &slice_box) {
+		PixelBox box;
+		for (int i = 0; i < slice_box.size(); i++)
+		{
+			box.merge(slice_box[i]);
+		}
+		if (box.empty())
+		{
+			box.add(0, 0);
+		}
+		min_x = box.min_x;
+		min_y = box.min_y;
+		width = box.width();
+		height = box.height();
+	}
+};
+
+#endif
@@ -0,0 +1,125 @@
+#pragma once
+#ifndef _SURFACE_GFX_
+#define _SURFACE_GFX_
+
+#include <cstring>
+
+#include <geogram_gfx/basic/GL.h>
+#include <geogram_gfx/GLUP/GLUP_private.h>
+
+#include "indexed_mesh.h"
+
+//Draws an IndexedMesh with glupDrawElements from buffer objects that are
+//uploaded once, on the first draw after set_mesh(). The mesh is not copied
+//and must outlive the SurfaceGfx. Falls back to immediate mode with the
+//VanillaGL profile, as MeshGfx does.
+class SurfaceGfx
+{
+public:
+	SurfaceGfx() : mesh_(NULL), VAO_(0), positions_VBO_(0), normals_VBO_(0),
+		indices_VBO_(0), dirty_(true) {}
+
+	//buffer objects need a GL context, call GL_terminate() to release them
+	~SurfaceGfx() {}
+
+	void set_mesh(const IndexedMesh *mesh) {
+		mesh_ = mesh;
+		dirty_ = true;
+	}
+
+	const IndexedMesh* mesh() const { return mesh_; }
+
+	void draw() {
+		if (mesh_ == NULL || mesh_->empty())
+		{
+			return;
+		}
+		if (!strcmp(glupCurrentProfileName(), "VanillaGL"))
+		{
+			draw_immediate([](uint32_t) {});
+			return;
+		}
+		update_buffer_objects_if_needed();
+		glupBindVertexArray(VAO_);
+		glupDrawElements(GLUP_TRIANGLES, GLUPsizei(mesh_->indices.size()),
+			GL_UNSIGNED_INT, nullptr);
+		glupBindVertexArray(0);
+	}
+
+	//immediate mode, before_vertex(v) is called before each vertex is
+	//emitted so that per-vertex state (colors) can be set
+	template <class F>
+	void draw_immediate(F before_vertex) const {
+		if (mesh_ == NULL || mesh_->empty())
+		{
+			return;
+		}
+		glupBegin(GLUP_TRIANGLES);
+		for (size_t i = 0; i < mesh_->indices.size(); i++)
+		{
+			uint32_t v = mesh_->indices[i];
+			const float *n = mesh_->normal(v);
+			glupNormal3f(n[0], n[1], n[2]);
+			before_vertex(v);
+			glupVertex3fv(mesh_->position(v));
+		}
+		glupEnd();
+	}
+
+	void GL_terminate() {
+		if (VAO_ != 0)
+		{
+			glupDeleteVertexArrays(1, &VAO_);
+			VAO_ = 0;
+		}
+		GLuint *buffers[3] = { &positions_VBO_, &normals_VBO_, &indices_VBO_ };
+		for (int i = 0; i < 3; i++)
+		{
+			if (*buffers[i] != 0)
+			{
+				glDeleteBuffers(1, buffers[i]);
+				*buffers[i] = 0;
+			}
+		}
+		dirty_ = true;
+	}
+
+private:
+	void update_buffer_objects_if_needed() {
+		if (!dirty_)
+		{
+			return;
+		}
+		GEO::update_buffer_object(positions_VBO_, GL_ARRAY_BUFFER,
+			mesh_->positions.size()*sizeof(float), mesh_->positions.data());
+		GEO::update_buffer_object(normals_VBO_, GL_ARRAY_BUFFER,
+			mesh_->normals.size()*sizeof(float), mesh_->normals.data());
+		GEO::update_buffer_object(indices_VBO_, GL_ELEMENT_ARRAY_BUFFER,
+			mesh_->indices.size()*sizeof(uint32_t), mesh_->indices.data());
+
+		if (VAO_ == 0)
+		{
+			glupGenVertexArrays(1, &VAO_);
+		}
+		glupBindVertexArray(VAO_);
+		glBindBuffer(GL_ARRAY_BUFFER, positions_VBO_);
+		glEnableVertexAttribArray(GLUP::GLUP_VERTEX_ATTRIBUTE);
+		glVertexAttribPointer(GLUP::GLUP_VERTEX_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+		glBindBuffer(GL_ARRAY_BUFFER, normals_VBO_);
+		glEnableVertexAttribArray(GLUP::GLUP_NORMAL_ATTRIBUTE);
+		glVertexAttribPointer(GLUP::GLUP_NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_VBO_);
+		glupBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		dirty_ = false;
+	}
+
+	const IndexedMesh *mesh_;
+	GLuint VAO_;
+	GLuint positions_VBO_;
+	GLuint normals_VBO_;
+	GLuint indices_VBO_;
+	bool dirty_;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#pragma once
+#ifndef _SURFACE_NETS_
+#define _SURFACE_NETS_
+
+#include <vector>
+#include <algorithm>
+
+#include "brick_volume.h"
+#include "voxel_geometry.h"
+
+//below this many vertices per part they are placed on one thread
+#define NETS_MIN_VERTICES_PER_PART 4096
+
+//furthest a vertex goes from its corner, in voxels
+#define NETS_CELL_MARGIN 0.45
+
+//Smooth vertex positions for cuberille surfaces, by naive surface nets.
+//The cuberille surface of a label is the dual of its surface net: a
+//lattice corner is the center of the cell of the 8 voxels around it, and
+//a voxel face is the quad of the net across the cell edge it cuts. So the
+//welded cuberille surface is kept as it is, watertight and with the same
+//triangles, and only its vertices move: each one goes to the mean of the
+//points where the edges of its cell cross the isosurface. The field is
+//the label occupancy blurred by a 1-2-1 binomial filter along each axis,
+//so the crossings slide along their edges with the local shape instead
+//of sitting at the edge midpoints, and a vertex stays inside its cell.
+//A vertex on the surfaces of several labels, where they meet, is placed
+//the same for all of them, from the owners of its cell rather than the
+//field of one label, or the meshes would crack or overlap there.
+//Vertices are placed independently of each other, so they are placed in
+//parallel like the corners they replace.
+class SurfaceNets
+{
+public:
+	SurfaceNets() : volume_(NULL), z_from_(0) {}
+
+	//slice z of the volume is lattice slice z + z_from, the volume must
+	//outlive the net
+	SurfaceNets(const BrickVolume &volume, const std::vector<int> &priority, int z_from) :
+		volume_(&volume), priority_(priority), z_from_(z_from) {}
+
+	//position of lattice corner (x, y, z) on the surface of label, over
+	//the voxels of lattice slices [z0, z1) only, the others read as empty
+	//as the caps of a window do
+	void place(int label, int x, int y, int z, int z0, int z1, const VoxelGeometry &geometry,
+		double p[3]) const {
+		//occupancy of the 4^3 voxels whose blur reaches the cell, voxel
+		//x - 2 + i first
+		float in[4][4][4];
+		for (int k = 0; k < 4; k++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				for (int i = 0; i < 4; i++)
+				{
+					const int vz = z - 2 + k;
+					in[k][j][i] = (vz >= z0 && vz < z1 && owner(x - 2 + i, y - 2 + j, vz - z_from_) == label)
+						? 1.0f : 0.0f;
+				}
+			}
+		}
+		//blurred field at the 8 voxels of the cell
+		static const float w[3] = { 0.25f, 0.5f, 0.25f };
+		float f[2][2][2];
+		for (int k = 0; k < 2; k++)
+		{
+			for (int j = 0; j < 2; j++)
+			{
+				for (int i = 0; i < 2; i++)
+				{
+					float s = 0.0f;
+					for (int c = 0; c < 3; c++)
+					{
+						for (int b = 0; b < 3; b++)
+						{
+							for (int a = 0; a < 3; a++)
+							{
+								s += w[a] * w[b] * w[c] * in[k + c][j + b][i + a];
+							}
+						}
+					}
+					f[k][j][i] = s;
+				}
+			}
+		}
+		//crossings of the edges whose voxels differ, in voxels from the
+		//corner (the cell voxels are at -1/2 and 1/2)
+		double d[3] = { 0.0, 0.0, 0.0 };
+		int n = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (int e = 0; e < 4; e++)
+			{
+				int lo[3], hi[3];
+				lo[axis] = 0;
+				lo[(axis + 1) % 3] = e & 1;
+				lo[(axis + 2) % 3] = e >> 1;
+				std::copy(lo, lo + 3, hi);
+				hi[axis] = 1;
+				if (in[lo[2] + 1][lo[1] + 1][lo[0] + 1] == in[hi[2] + 1][hi[1] + 1][hi[0] + 1])
+				{
+					continue;
+				}
+				//the midpoint where the blur loses the edge, or thin vessels
+				//would collapse onto their center line
+				const float f0 = f[lo[2]][lo[1]][lo[0]], f1 = f[hi[2]][hi[1]][hi[0]];
+				const bool lo_in = in[lo[2] + 1][lo[1] + 1][lo[0] + 1] > 0.0f;
+				const float f_in = lo_in ? f0 : f1, f_out = lo_in ? f1 : f0;
+				const float t = (f_in >= 0.5f && f_out < 0.5f) ? (0.5f - f0) / (f1 - f0) : 0.5f;
+				for (int a = 0; a < 3; a++)
+				{
+					d[a] += (a == axis) ? t - 0.5 : lo[a] - 0.5;
+				}
+				n++;
+			}
+		}
+		cell_point(x, y, z, d, n, geometry, p);
+	}
+
+	//position of lattice corner (x, y, z) where labels meet, the same for
+	//every label: the mean of the midpoints of the cell edges whose voxels
+	//have different owners, over lattice slices [z0, z1) as place()
+	void place_shared(int x, int y, int z, int z0, int z1, const VoxelGeometry &geometry, double p[3]) const {
+		int own[2][2][2];
+		for (int k = 0; k < 2; k++)
+		{
+			for (int j = 0; j < 2; j++)
+			{
+				for (int i = 0; i < 2; i++)
+				{
+					const int vz = z - 1 + k;
+					own[k][j][i] = (vz >= z0 && vz < z1) ? owner(x - 1 + i, y - 1 + j, vz - z_from_) : -1;
+				}
+			}
+		}
+		double d[3] = { 0.0, 0.0, 0.0 };
+		int n = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (int e = 0; e < 4; e++)
+			{
+				int lo[3], hi[3];
+				lo[axis] = 0;
+				lo[(axis + 1) % 3] = e & 1;
+				lo[(axis + 2) % 3] = e >> 1;
+				std::copy(lo, lo + 3, hi);
+				hi[axis] = 1;
+				if (own[lo[2]][lo[1]][lo[0]] == own[hi[2]][hi[1]][hi[0]])
+				{
+					continue;
+				}
+				for (int a = 0; a < 3; a++)
+				{
+					d[a] += (a == axis) ? 0.0 : lo[a] - 0.5;
+				}
+				n++;
+			}
+		}
+		cell_point(x, y, z, d, n, geometry, p);
+	}
+
+private:
+	//corner (x, y, z) moved by the mean of the n offsets summed in d, kept
+	//off the cell faces, where the vertex of a cell whose crossings are all
+	//on one face would meet that of the cell across it
+	static void cell_point(int x, int y, int z, double d[3], int n, const VoxelGeometry &geometry, double p[3]) {
+		for (int a = 0; a < 3; a++)
+		{
+			d[a] = (n > 0) ? std::min(std::max(d[a] / n, -NETS_CELL_MARGIN), NETS_CELL_MARGIN) : 0.0;
+		}
+		geometry.lattice_point(x, y, z, d, p);
+	}
+
+	//label voxel (x, y, z) of the volume is kept in, -1 for none
+	int owner(int x, int y, int z) const {
+		for (int i = 0; i < priority_.size(); i++)
+		{
+			if (volume_->get(priority_[i], x, y, z))
+			{
+				return priority_[i];
+			}
+		}
+		return -1;
+	}
+
+	const BrickVolume *volume_;
+	std::vector<int> priority_;
+	int z_from_;
+};
+
+#endif
@@ -0,0 +1,329 @@
+#pragma once
+#ifndef _TASK_POOL_
+#define _TASK_POOL_
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+#include <geogram/basic/process.h>
+
+//Work-stealing pool for nested fork-join parallelism.
+//Every worker owns a deque of tasks: it pushes and pops at the back, idle
+//workers steal from the front of the others, so the oldest (biggest) tasks
+//spread first and the small ones they fork stay local. Threads outside the
+//pool hand their tasks over through one shared deque. A TaskGroup runs
+//tasks while it waits for its own, so a task can fork and join a group of
+//its own without tying up a worker: combo windows, the labels of a window
+//and the slabs of a label are all tasks of one pool and the biggest window
+//gets split like the others instead of running on one thread. A waiting
+//group only runs its own tasks and those of the groups they open, never
+//an unrelated one that could block on a lock the waiter holds, and sleeps
+//when none is queued.
+
+class TaskPool;
+
+class TaskGroup
+{
+public:
+	inline explicit TaskGroup(TaskPool &pool);
+
+	~TaskGroup() { wait(); }
+
+	inline void spawn(std::function<void()> f);
+
+	//runs tasks of the group until the spawned ones are done
+	inline void wait();
+
+private:
+	friend class TaskPool;
+
+	//g is this group or was opened, maybe indirectly, by one of its tasks
+	bool contains(const TaskGroup *g) const {
+		for (; g != NULL; g = g->parent_)
+		{
+			if (g == this)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	TaskPool &pool_;
+	TaskGroup *parent_;//group of the task that opened it, NULL outside tasks
+	std::atomic<int> pending_;
+};
+
+class TaskPool
+{
+public:
+	//nb_threads workers, 0 for one per core but the one of the caller of run()
+	explicit TaskPool(int nb_threads = 0) : stop_(false), queued_(0), pushed_(0), waiting_(0) {
+		if (nb_threads <= 0)
+		{
+			nb_threads = std::max(int(GEO::Process::maximum_concurrent_threads()) - 1, 1);
+		}
+		nb_queues_ = nb_threads + 1;
+		queues_.reset(new Queue[nb_queues_]);
+		for (int i = 0; i < nb_threads; i++)
+		{
+			workers_.push_back(std::thread(&TaskPool::work, this, i));
+		}
+	}
+
+	~TaskPool() {
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex_);
+			stop_ = true;
+		}
+		wake_.notify_all();
+		for (int i = 0; i < workers_.size(); i++)
+		{
+			workers_[i].join();
+		}
+	}
+
+	int nb_workers() const { return int(workers_.size()); }
+
+	//the pool the calling thread runs tasks for, NULL on any other thread
+	static TaskPool* current() { return context().pool; }
+
+	//runs f on the pool, the calling thread takes part until it is done;
+	//several threads may call it at the same time
+	void run(const std::function<void()> &f) {
+		Context saved = context();
+		context().pool = this;
+		context().queue = nb_queues_ - 1;
+		{
+			TaskGroup group(*this);
+			group.spawn(f);
+			group.wait();
+		}
+		context() = saved;
+	}
+
+private:
+	friend class TaskGroup;
+
+	struct Task
+	{
+		std::function<void()> run;
+		TaskGroup *group;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	struct Context
+	{
+		TaskPool *pool;
+		int queue;
+		TaskGroup *running;//group of the task the thread runs
+	};
+
+	static Context& context() {
+		static thread_local Context c = { NULL, 0, NULL };
+		return c;
+	}
+
+	//the queue of the calling worker, the shared one for other threads
+	int own_queue() const {
+		return (context().pool == this) ? context().queue : nb_queues_ - 1;
+	}
+
+	void push(const Task &task) {
+		Queue &q = queues_[own_queue()];
+		{
+			std::lock_guard<std::mutex> lock(q.mutex);
+			q.tasks.push_back(task);
+		}
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex_);
+			queued_++;
+			pushed_++;
+			if (waiting_ > 0)
+			{
+				done_.notify_all();
+			}
+		}
+		wake_.notify_one();
+	}
+
+	//pops from the back of the own queue, else steals from the front of
+	//another; a task of within only, unless it is NULL
+	bool try_run_one(const TaskGroup *within) {
+		const int own = own_queue();
+		Task task;
+		bool found = false;
+		for (int k = 0; k < nb_queues_ && !found; k++)
+		{
+			Queue &q = queues_[(own + k) % nb_queues_];
+			std::lock_guard<std::mutex> lock(q.mutex);
+			const size_t n = q.tasks.size();
+			for (size_t j = 0; j < n && !found; j++)
+			{
+				const size_t i = (k == 0) ? n - 1 - j : j;
+				if (within == NULL || within->contains(q.tasks[i].group))
+				{
+					task = q.tasks[i];
+					q.tasks.erase(q.tasks.begin() + i);
+					found = true;
+				}
+			}
+		}
+		if (!found)
+		{
+			return false;
+		}
+		queued_--;
+		TaskGroup *saved = context().running;
+		context().running = task.group;
+		task.run();
+		context().running = saved;
+		//the group may be gone as soon as its count is 0, only the pool is used then
+		if (--task.group->pending_ == 0)
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex_);
+			done_.notify_all();
+		}
+		return true;
+	}
+
+	void work(int i) {
+		context().pool = this;
+		context().queue = i;
+		while (true)
+		{
+			if (try_run_one(NULL))
+			{
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleep_mutex_);
+			wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+			if (stop_)
+			{
+				return;
+			}
+		}
+	}
+
+	int nb_queues_;//one per worker, the last for other threads
+	std::unique_ptr<Queue[]> queues_;
+	std::vector<std::thread> workers_;
+	bool stop_;
+	std::atomic<int> queued_;//tasks in the queues
+	std::atomic<unsigned> pushed_;//tasks ever queued, to tell waiters something new came
+	int waiting_;//groups asleep in wait()
+	std::mutex sleep_mutex_;
+	std::condition_variable wake_;//idle workers
+	std::condition_variable done_;//waiting groups
+};
+
+TaskGroup::TaskGroup(TaskPool &pool) : pool_(pool), pending_(0)
+{
+	parent_ = (TaskPool::current() == &pool) ? TaskPool::context().running : NULL;
+}
+
+void TaskGroup::spawn(std::function<void()> f)
+{
+	pending_++;
+	TaskPool::Task task = { f, this };
+	pool_.push(task);
+}
+
+void TaskGroup::wait()
+{
+	while (pending_ > 0)
+	{
+		const unsigned seen = pool_.pushed_;
+		if (pool_.try_run_one(this))
+		{
+			continue;
+		}
+		//none of its tasks queued: sleep until they are done or more come
+		std::unique_lock<std::mutex> lock(pool_.sleep_mutex_);
+		pool_.waiting_++;
+		pool_.done_.wait(lock, [&] { return pending_ == 0 || pool_.pushed_ != seen; });
+		pool_.waiting_--;
+	}
+}
+
+//the pool of the process, its workers sleep while it has nothing to do
+inline TaskPool& task_pool()
+{
+	static TaskPool pool;
+	return pool;
+}
+
+//f(i) for i in [from, to): tasks of the pool when called from one of its
+//tasks, GEO::parallel_for on any other thread
+template <class F>
+inline void task_parallel_for(GEO::index_t from, GEO::index_t to, F f)
+{
+	TaskPool *pool = TaskPool::current();
+	if (pool == NULL)
+	{
+		GEO::parallel_for(from, to, std::function<void(GEO::index_t)>(f));
+		return;
+	}
+	if (from >= to)
+	{
+		return;
+	}
+	TaskGroup group(*pool);
+	for (GEO::index_t i = from + 1; i < to; i++)
+	{
+		group.spawn([&f, i] { f(i); });
+	}
+	f(from);
+	group.wait();
+}
+
+//parts n items are split into: one per thread, each of at least
+//min_per_part items, a single one below that
+inline GEO::index_t task_nb_parts(GEO::index_t n, GEO::index_t min_per_part)
+{
+	const GEO::index_t nb_parts = std::max(n / std::max(min_per_part, GEO::index_t(1)), GEO::index_t(1));
+	return std::min(nb_parts, std::max(GEO::Process::maximum_concurrent_threads(), GEO::index_t(1)));
+}
+
+//first item of part of [0, n) split into nb_parts ranges
+inline GEO::index_t task_part_begin(GEO::index_t n, GEO::index_t part, GEO::index_t nb_parts)
+{
+	return GEO::index_t(uint64_t(n) * part / nb_parts);
+}
+
+//f(part, from, to) for each of the nb_parts ranges of [0, n), see
+//task_parallel_for
+template <class F>
+inline void task_parallel_ranges(GEO::index_t n, GEO::index_t nb_parts, F f)
+{
+	task_parallel_for(0, nb_parts, [&](GEO::index_t part) {
+		f(part, task_part_begin(n, part, nb_parts), task_part_begin(n, part + 1, nb_parts));
+	});
+}
+
+//f(from, to) over [0, n) split into task_nb_parts(n, min_per_part) ranges
+template <class F>
+inline void task_parallel_parts(GEO::index_t n, GEO::index_t min_per_part, F f)
+{
+	if (n == 0)
+	{
+		return;
+	}
+	task_parallel_ranges(n, task_nb_parts(n, min_per_part), [&](GEO::index_t, GEO::index_t from, GEO::index_t to) {
+		f(from, to);
+	});
+}
+
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+#ifndef _VERTEX_NORMALS_
+#define _VERTEX_NORMALS_
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "task_pool.h"
+
+#include "indexed_mesh.h"
+
+//below this many triangles per part the extra buffers cost more than they save
+#define NORMALS_MIN_TRIANGLES_PER_PART 4096
+
+//Area-weighted vertex normals of an indexed triangle surface.
+//The cross product of two edges is the face normal scaled by twice the
+//triangle area, so summing it at the three corners gives the area
+//weighting for free. For cuberille surfaces the face normals are the axis
+//directions, so the result only depends on how many faces of each
+//direction meet at a corner.
+//Triangles are split into one part per thread, each part accumulates into
+//its own buffer (the first one directly into mesh.normals) and the buffers
+//are summed and normalized per vertex afterwards, so no atomics are needed.
+inline void compute_vertex_normals(IndexedMesh &mesh)
+{
+	const GEO::index_t nv = GEO::index_t(mesh.nb_vertices());
+	const GEO::index_t nt = GEO::index_t(mesh.nb_triangles());
+	mesh.normals.assign(3 * size_t(nv), 0.0f);
+	if (nt == 0)
+	{
+		return;
+	}
+
+	const GEO::index_t nb_parts = task_nb_parts(nt, NORMALS_MIN_TRIANGLES_PER_PART);
+	std::vector<std::vector<float>> partial(nb_parts - 1);
+
+	task_parallel_ranges(nt, nb_parts, [&](GEO::index_t part, GEO::index_t t_from, GEO::index_t t_to) {
+		float *acc = &mesh.normals[0];
+		if (part > 0)
+		{
+			partial[part - 1].assign(3 * size_t(nv), 0.0f);
+			acc = &partial[part - 1][0];
+		}
+		for (GEO::index_t t = t_from; t < t_to; t++)
+		{
+			const uint32_t *tri = &mesh.indices[3 * size_t(t)];
+			const float *p0 = mesh.position(tri[0]);
+			const float *p1 = mesh.position(tri[1]);
+			const float *p2 = mesh.position(tri[2]);
+			float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			float n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0] };
+			for (int k = 0; k < 3; k++)
+			{
+				float *a = acc + 3 * size_t(tri[k]);
+				a[0] += n[0]; a[1] += n[1]; a[2] += n[2];
+			}
+		}
+	});
+
+	task_parallel_ranges(nv, nb_parts, [&](GEO::index_t, GEO::index_t v_from, GEO::index_t v_to) {
+		for (GEO::index_t v = v_from; v < v_to; v++)
+		{
+			float *n = &mesh.normals[3 * size_t(v)];
+			for (size_t p = 0; p < partial.size(); p++)
+			{
+				const float *a = &partial[p][3 * size_t(v)];
+				n[0] += a[0]; n[1] += a[1]; n[2] += a[2];
+			}
+			float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (len > 0.0f)
+			{
+				n[0] /= len; n[1] /= len; n[2] /= len;
+			}
+		}
+	});
+}
+
+#endif
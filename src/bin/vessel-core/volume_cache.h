@@ -0,0 +1,411 @@
+#pragma once
+#ifndef _VOLUME_CACHE_
+#define _VOLUME_CACHE_
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "occupancy_grid.h"
+#include "indexed_mesh.h"
+
+//.vvox: cropped volume of a mask stack (bit-packed labels) plus the
+//surfaces extracted from it, so that an unchanged dataset is reloaded
+//with a few memcpy from a mapped file instead of decoding and meshing.
+//
+//layout: VolumeCacheHeader, one VolumeCacheBlock per label then three
+//per surface (positions, normals, indices), then the 8-byte aligned
+//payloads the blocks point to.
+
+#define VVOX_MAGIC 0x584f5656u //"VVOX"
+#define VVOX_VERSION 4u
+
+//FNV-1a over everything the cached data depends on
+class CacheKey
+{
+public:
+	CacheKey() : h(14695981039346656037ULL) {}
+
+	void add(const void *data, size_t n) {
+		const unsigned char *p = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < n; i++)
+		{
+			h ^= p[i];
+			h *= 1099511628211ULL;
+		}
+	}
+	void add(const std::string &s) { add(s.data(), s.size()); add(int(s.size())); }
+	void add(int v) { add(&v, sizeof(v)); }
+	void add(int64_t v) { add(&v, sizeof(v)); }
+	void add(double v) { add(&v, sizeof(v)); }
+
+	uint64_t value() const { return h; }
+
+private:
+	uint64_t h;
+};
+
+//read-only view of a whole file
+class MappedFile
+{
+public:
+	MappedFile() : data_(NULL), size_(0) {
+#ifdef _WIN32
+		file_ = INVALID_HANDLE_VALUE;
+		mapping_ = NULL;
+#else
+		fd_ = -1;
+#endif
+	}
+
+	~MappedFile() { close(); }
+
+	bool open(const std::string &filename) {
+		close();
+#ifdef _WIN32
+		file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file_ == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER s;
+		if (!GetFileSizeEx(file_, &s) || s.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+		size_ = size_t(s.QuadPart);
+		mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping_ == NULL)
+		{
+			close();
+			return false;
+		}
+		data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+#else
+		fd_ = ::open(filename.c_str(), O_RDONLY);
+		if (fd_ < 0)
+		{
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd_, &st) != 0 || st.st_size == 0)
+		{
+			close();
+			return false;
+		}
+		size_ = size_t(st.st_size);
+		void *p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+		data_ = (p == MAP_FAILED) ? NULL : static_cast<const char*>(p);
+#endif
+		if (data_ == NULL)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (data_ != NULL) UnmapViewOfFile(data_);
+		if (mapping_ != NULL) CloseHandle(mapping_);
+		if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+		mapping_ = NULL;
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		if (data_ != NULL) munmap(const_cast<char*>(data_), size_);
+		if (fd_ >= 0) ::close(fd_);
+		fd_ = -1;
+#endif
+		data_ = NULL;
+		size_ = 0;
+	}
+
+	const char* data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const char *data_;
+	size_t size_;
+#ifdef _WIN32
+	HANDLE file_;
+	HANDLE mapping_;
+#else
+	int fd_;
+#endif
+};
+
+struct VolumeCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	int32_t width;
+	int32_t height;
+	int32_t slice;
+	int32_t min_x;
+	int32_t min_y;
+	uint32_t nb_labels;
+	uint32_t nb_surfaces;
+	uint32_t reserved;
+};
+
+enum VolumeCacheBlockType
+{
+	VVOX_LABEL_BITS, VVOX_POSITIONS, VVOX_NORMALS, VVOX_INDICES
+};
+
+struct VolumeCacheBlock
+{
+	int32_t dim[3];//label: grid size, surface: unused
+	uint32_t type;//VolumeCacheBlockType
+	uint64_t offset;
+	uint64_t bytes;
+};
+
+struct VolumeCache
+{
+	//cropped volume
+	int width = 0;
+	int height = 0;
+	int slice = 0;
+	//position of the crop in the images
+	int min_x = 0;
+	int min_y = 0;
+
+	std::vector<OccupancyGrid> labels;
+	std::vector<IndexedMesh> surfaces;
+
+	bool save(const std::string &filename, uint64_t key) const {
+		//write to a temporary file first so that a crash never leaves a half cache
+		std::string tmp = filename + ".tmp";
+		FILE *f = fopen(tmp.c_str(), "wb");
+		if (f == NULL)
+		{
+			return false;
+		}
+		VolumeCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		header.magic = VVOX_MAGIC;
+		header.version = VVOX_VERSION;
+		header.key = key;
+		header.width = width;
+		header.height = height;
+		header.slice = slice;
+		header.min_x = min_x;
+		header.min_y = min_y;
+		header.nb_labels = uint32_t(labels.size());
+		header.nb_surfaces = uint32_t(surfaces.size());
+
+		std::vector<VolumeCacheBlock> blocks;
+		std::vector<const void*> payloads;
+		for (size_t i = 0; i < labels.size(); i++)
+		{
+			VolumeCacheBlock b = make_block(VVOX_LABEL_BITS, labels[i].nb_words()*sizeof(uint64_t));
+			b.dim[0] = labels[i].size_x();
+			b.dim[1] = labels[i].size_y();
+			b.dim[2] = labels[i].size_z();
+			blocks.push_back(b);
+			payloads.push_back(labels[i].data());
+		}
+		for (size_t i = 0; i < surfaces.size(); i++)
+		{
+			blocks.push_back(make_block(VVOX_POSITIONS, surfaces[i].positions.size()*sizeof(float)));
+			payloads.push_back(surfaces[i].positions.data());
+			blocks.push_back(make_block(VVOX_NORMALS, surfaces[i].normals.size()*sizeof(float)));
+			payloads.push_back(surfaces[i].normals.data());
+			blocks.push_back(make_block(VVOX_INDICES, surfaces[i].indices.size()*sizeof(uint32_t)));
+			payloads.push_back(surfaces[i].indices.data());
+		}
+		uint64_t offset = sizeof(VolumeCacheHeader) + blocks.size()*sizeof(VolumeCacheBlock);
+		for (size_t i = 0; i < blocks.size(); i++)
+		{
+			offset = (offset + 7) & ~uint64_t(7);
+			blocks[i].offset = offset;
+			offset += blocks[i].bytes;
+		}
+
+		bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+		if (!blocks.empty())
+		{
+			ok = ok && fwrite(&blocks[0], sizeof(VolumeCacheBlock), blocks.size(), f) == blocks.size();
+		}
+		uint64_t pos = sizeof(VolumeCacheHeader) + blocks.size()*sizeof(VolumeCacheBlock);
+		static const char zeros[8] = { 0,0,0,0,0,0,0,0 };
+		for (size_t i = 0; i < blocks.size() && ok; i++)
+		{
+			if (blocks[i].offset > pos)
+			{
+				ok = fwrite(zeros, 1, size_t(blocks[i].offset - pos), f) == blocks[i].offset - pos;
+				pos = blocks[i].offset;
+			}
+			if (blocks[i].bytes > 0)
+			{
+				ok = ok && fwrite(payloads[i], 1, size_t(blocks[i].bytes), f) == blocks[i].bytes;
+			}
+			pos += blocks[i].bytes;
+		}
+		ok = (fclose(f) == 0) && ok;
+		if (!ok)
+		{
+			remove(tmp.c_str());
+			return false;
+		}
+		remove(filename.c_str());
+		return rename(tmp.c_str(), filename.c_str()) == 0;
+	}
+
+	//false when the file is missing, corrupted or was built from other inputs
+	bool load(const std::string &filename, uint64_t key) {
+		MappedFile file;
+		if (!file.open(filename) || file.size() < sizeof(VolumeCacheHeader))
+		{
+			return false;
+		}
+		VolumeCacheHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+		if (header.magic != VVOX_MAGIC || header.version != VVOX_VERSION || header.key != key)
+		{
+			return false;
+		}
+		size_t nb_blocks = size_t(header.nb_labels) + 3 * size_t(header.nb_surfaces);
+		if (file.size() < sizeof(VolumeCacheHeader) + nb_blocks*sizeof(VolumeCacheBlock))
+		{
+			return false;
+		}
+		std::vector<VolumeCacheBlock> blocks(nb_blocks);
+		if (nb_blocks > 0)
+		{
+			memcpy(&blocks[0], file.data() + sizeof(VolumeCacheHeader), nb_blocks*sizeof(VolumeCacheBlock));
+		}
+		for (size_t i = 0; i < nb_blocks; i++)
+		{
+			//written so that it cannot wrap around
+			if (blocks[i].offset > file.size() || blocks[i].bytes > file.size() - blocks[i].offset)
+			{
+				return false;
+			}
+			if (i < header.nb_labels && !label_block_ok(blocks[i]))
+			{
+				return false;
+			}
+		}
+		for (size_t i = header.nb_labels; i < nb_blocks; i += 3)
+		{
+			if (!surface_blocks_ok(&blocks[i]))
+			{
+				return false;
+			}
+		}
+
+		width = header.width;
+		height = header.height;
+		slice = header.slice;
+		min_x = header.min_x;
+		min_y = header.min_y;
+		labels.assign(header.nb_labels, OccupancyGrid());
+		surfaces.assign(header.nb_surfaces, IndexedMesh());
+		for (size_t i = 0; i < nb_blocks; i++)
+		{
+			const VolumeCacheBlock &b = blocks[i];
+			const char *src = file.data() + b.offset;
+			if (i < header.nb_labels)
+			{
+				labels[i].resize(b.dim[0], b.dim[1], b.dim[2]);
+				memcpy(labels[i].data(), src, size_t(b.bytes));
+			}
+			else
+			{
+				IndexedMesh &m = surfaces[(i - header.nb_labels) / 3];
+				switch (b.type)
+				{
+				case VVOX_POSITIONS: read_array(src, b.bytes, m.positions); break;
+				case VVOX_NORMALS: read_array(src, b.bytes, m.normals); break;
+				case VVOX_INDICES: read_array(src, b.bytes, m.indices); break;
+				default: return false;
+				}
+				//the blocks come in that order, so the mesh is complete
+				if (b.type == VVOX_INDICES && !indices_ok(m))
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+private:
+	//the grid size of a label block matches its bytes, checked before
+	//anything is allocated from it
+	static bool label_block_ok(const VolumeCacheBlock &b) {
+		if (b.type != VVOX_LABEL_BITS || b.dim[0] < 0 || b.dim[1] < 0 || b.dim[2] < 0 ||
+			b.bytes % sizeof(uint64_t) != 0)
+		{
+			return false;
+		}
+		const uint64_t words = b.bytes / sizeof(uint64_t);
+		const uint64_t row = (uint64_t(b.dim[0]) + 63) / 64, ny = uint64_t(b.dim[1]), nz = uint64_t(b.dim[2]);
+		if (row == 0 || ny == 0 || nz == 0)
+		{
+			return words == 0;
+		}
+		//row*ny*nz == words without overflowing
+		return words % nz == 0 && (words / nz) % ny == 0 && (words / nz) / ny == row;
+	}
+
+	//the positions, normals and indices blocks of a surface, in that order,
+	//with a normal per vertex and whole triangles
+	static bool surface_blocks_ok(const VolumeCacheBlock b[3]) {
+		return b[0].type == VVOX_POSITIONS && b[1].type == VVOX_NORMALS && b[2].type == VVOX_INDICES &&
+			b[0].bytes % (3 * sizeof(float)) == 0 && b[1].bytes == b[0].bytes &&
+			b[2].bytes % (3 * sizeof(uint32_t)) == 0;
+	}
+
+	//every triangle refers to vertices of the mesh
+	static bool indices_ok(const IndexedMesh &m) {
+		const size_t nv = m.nb_vertices();
+		for (size_t i = 0; i < m.indices.size(); i++)
+		{
+			if (m.indices[i] >= nv)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static VolumeCacheBlock make_block(uint32_t type, size_t bytes) {
+		VolumeCacheBlock b;
+		memset(&b, 0, sizeof(b));
+		b.type = type;
+		b.bytes = bytes;
+		return b;
+	}
+
+	template <class T>
+	static void read_array(const char *src, uint64_t bytes, std::vector<T> &v) {
+		v.resize(size_t(bytes / sizeof(T)));
+		if (!v.empty())
+		{
+			memcpy(&v[0], src, v.size()*sizeof(T));
+		}
+	}
+};
+
+#endif
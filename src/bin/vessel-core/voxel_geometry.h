@@ -0,0 +1,124 @@
+#pragma once
+#ifndef _VOXEL_GEOMETRY_
+#define _VOXEL_GEOMETRY_
+
+#include "occupancy_grid.h"
+#include "voxel_spacing.h"
+
+//cube corners (cube_corner_offset numbering) in the vertex order of a GLUP hexahedron
+static const int hexahedron_corner_order[8] = { 0,3,1,2,4,7,5,6 };
+
+//World coordinates of voxels, derived on demand from the lattice position
+//instead of being stored with every voxel. The volume of nb_slices slices
+//is centered on the origin and image_width_size is its half width, pixels
+//and slices are sized as the spacing says relative to the pixel width.
+//Same arithmetic as the former per-voxel center/corners_pts fields,
+//floats included. A strided geometry places coarse voxels, each covering
+//stride x stride pixels of a slice.
+class VoxelGeometry
+{
+public:
+	VoxelGeometry() : width_(0), height_(0), nb_slices_(0), stride_(1), image_wid(0), image_hei(0),
+		image_sli(0), voxel_size_x(0), voxel_size_y(0), voxel_size_z(0) {}
+
+	VoxelGeometry(int width, int height, int nb_slices, double image_width_size, const VoxelSpacing &spacing) {
+		width_ = width;
+		height_ = height;
+		nb_slices_ = nb_slices;
+		stride_ = 1;
+		const double scale_y = spacing.y / spacing.x, scale_z = spacing.z / spacing.x;
+		image_wid = image_width_size;
+		image_hei = image_width_size / width*height*scale_y;
+		image_sli = image_width_size / width*nb_slices*scale_z;
+		voxel_size_x = 2.0*image_width_size / width;
+		voxel_size_y = voxel_size_x*scale_y;
+		voxel_size_z = voxel_size_x*scale_z;
+	}
+
+	//square pixels, slices scale_voxel times thicker
+	VoxelGeometry(int width, int height, int nb_slices, double image_width_size, double scale_voxel) :
+		VoxelGeometry(width, height, nb_slices, image_width_size, VoxelSpacing(1.0, 1.0, scale_voxel)) {}
+
+	//half the size of the volume along each axis
+	void half_size(double &w, double &h, double &s) const {
+		w = image_wid;
+		h = image_hei;
+		s = image_sli;
+	}
+
+	//size of one (strided) voxel along each axis
+	void voxel_size(double size[3]) const {
+		size[0] = voxel_size_x*stride_;
+		size[1] = voxel_size_y*stride_;
+		size[2] = voxel_size_z;
+	}
+
+	//the same volume with voxel (x, y, z) covering pixels [x*stride, (x+1)*stride)
+	VoxelGeometry strided(int stride) const {
+		VoxelGeometry g = *this;
+		g.stride_ = std::max(stride, 1);
+		return g;
+	}
+
+	void center(int x, int y, int z, double c[3]) const {
+		//pixel position of the center, x itself when not strided
+		const double fx = double(x)*stride_ + (stride_ - 1) / 2.0;
+		const double fy = double(y)*stride_ + (stride_ - 1) / 2.0;
+		c[0] = float(fx) / float(width_ - 1)*(2.0*image_wid - voxel_size_x)
+			- image_wid + voxel_size_x / 2.0;
+		c[1] = float(fy) / float(height_ - 1)*(2.0*image_hei - voxel_size_y)
+			- image_hei + voxel_size_y / 2.0;
+		c[2] = float(z) / float(nb_slices_ - 1)*(2.0*image_sli - voxel_size_z)
+			- image_sli + voxel_size_z / 2.0;
+	}
+
+	//cube corner k of the voxel, see cube_corner_offset
+	void corner(int x, int y, int z, int k, double p[3]) const {
+		double c[3];
+		center(x, y, z, c);
+		corner_from_center(c, k, p);
+	}
+
+	//lattice corner (x, y, z) moved by d voxels along each axis
+	void lattice_point(int x, int y, int z, const double d[3], double p[3]) const {
+		corner(x, y, z, 0, p);
+		p[0] += d[0] * voxel_size_x*stride_;
+		p[1] += d[1] * voxel_size_y*stride_;
+		p[2] += d[2] * voxel_size_z;
+	}
+
+	//the 8 corners in hexahedron order, for glupBegin(GLUP_HEXAHEDRA)
+	void hexahedron(int x, int y, int z, float pts[24]) const {
+		double c[3], p[3];
+		center(x, y, z, c);
+		for (int k = 0; k < 8; k++)
+		{
+			corner_from_center(c, hexahedron_corner_order[k], p);
+			pts[3 * k] = float(p[0]);
+			pts[3 * k + 1] = float(p[1]);
+			pts[3 * k + 2] = float(p[2]);
+		}
+	}
+
+	void corner_from_center(const double c[3], int k, double p[3]) const {
+		const int *o = cube_corner_offset[k];
+		const double sx = voxel_size_x*stride_, sy = voxel_size_y*stride_;
+		p[0] = o[0] ? c[0] + sx / 2 : c[0] - sx / 2;
+		p[1] = o[1] ? c[1] + sy / 2 : c[1] - sy / 2;
+		p[2] = o[2] ? c[2] + voxel_size_z / 2 : c[2] - voxel_size_z / 2;
+	}
+
+private:
+	int width_;
+	int height_;
+	int nb_slices_;
+	int stride_;
+	double image_wid;
+	double image_hei;
+	double image_sli;
+	double voxel_size_x;
+	double voxel_size_y;
+	double voxel_size_z;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+#ifndef _VOXEL_GFX_
+#define _VOXEL_GFX_
+
+#include <vector>
+
+#include <geogram_gfx/basic/GL.h>
+
+#include "voxel_geometry.h"
+
+//Immediate mode drawing of voxels, the geometry is generated while
+//drawing so the voxel lists only need to hold lattice positions.
+
+//one point per voxel center
+template <class Voxel>
+inline void draw_voxel_points(const std::vector<Voxel> &voxels, const VoxelGeometry &geometry)
+{
+	glupBegin(GLUP_POINTS);
+	for (int i = 0; i < voxels.size(); i++)
+	{
+		double c[3];
+		geometry.center(voxels[i].x, voxels[i].y, voxels[i].z, c);
+		glupVertex3f(float(c[0]), float(c[1]), float(c[2]));
+	}
+	glupEnd();
+}
+
+//one hexahedron per voxel
+template <class Voxel>
+inline void draw_voxel_hexahedra(const std::vector<Voxel> &voxels, const VoxelGeometry &geometry)
+{
+	glupBegin(GLUP_HEXAHEDRA);
+	for (int i = 0; i < voxels.size(); i++)
+	{
+		float pts[24];
+		geometry.hexahedron(voxels[i].x, voxels[i].y, voxels[i].z, pts);
+		for (int k = 0; k < 8; k++)
+		{
+			glupVertex3fv(pts + 3 * k);
+		}
+	}
+	glupEnd();
+}
+
+#endif
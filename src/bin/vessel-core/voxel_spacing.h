@@ -0,0 +1,69 @@
+#pragma once
+#ifndef _VOXEL_SPACING_
+#define _VOXEL_SPACING_
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+
+//sidecar of a mask directory giving its voxel spacing
+#define VOXEL_SPACING_FILE "spacing.txt"
+
+//Size of a voxel along x, y and z, in any unit: only the ratios matter,
+//the volume is scaled to the fixed half width of the viewers. A stack
+//carries its own, read from the spacing.txt next to its masks ("0.65
+//0.65 3.5", as the scanner reports them), so its slice thickness is no
+//longer compiled in.
+struct VoxelSpacing
+{
+	double x = 1.0;
+	double y = 1.0;
+	double z = 1.0;
+
+	VoxelSpacing() {}
+	VoxelSpacing(double x_, double y_, double z_) : x(x_), y(y_), z(z_) {}
+
+	bool valid() const { return x > 0 && y > 0 && z > 0; }
+
+	//"x y z", commas allowed; false and unchanged unless three positive sizes
+	bool parse(const std::string &text) {
+		std::string s = text;
+		std::replace(s.begin(), s.end(), ',', ' ');
+		std::istringstream in(s);
+		VoxelSpacing v;
+		if (!(in >> v.x >> v.y >> v.z) || !v.valid())
+		{
+			return false;
+		}
+		*this = v;
+		return true;
+	}
+
+	//dir/spacing.txt, false and unchanged when missing or unreadable
+	bool read(const std::string &dir) {
+		std::string file = dir;
+		if (!file.empty() && file.back() != '/' && file.back() != '\\')
+		{
+			file += '/';
+		}
+		std::ifstream in((file + VOXEL_SPACING_FILE).c_str());
+		std::string line;
+		return in && std::getline(in, line) && parse(line);
+	}
+
+	//slices to insert between two masks so that slices are about as thick
+	//as pixels are wide, at most max_slices
+	int slices_between(int max_slices) const {
+		const int n = int(std::floor(z / x + 0.5)) - 1;
+		return std::min(std::max(n, 0), max_slices);
+	}
+
+	//the spacing once n slices are inserted between two masks
+	VoxelSpacing refined(int n) const {
+		return VoxelSpacing(x, y, z / (std::max(n, 0) + 1));
+	}
+};
+
+#endif
@@ -0,0 +1,294 @@
+#pragma once
+#ifndef _WINDOW_CACHE_
+#define _WINDOW_CACHE_
+
+#include <vector>
+#include <list>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+#include "indexed_mesh.h"
+
+//windows on each side of the requested one that are meshed ahead
+#define WINDOW_CACHE_PREFETCH 1
+
+//surfaces of one window, one mesh per label
+struct WindowSurfaces
+{
+	std::vector<IndexedMesh> labels;
+	int stride = 1;//of a coarse preview, 1 at full resolution
+
+	size_t memory_bytes() const {
+		size_t n = 0;
+		for (int l = 0; l < labels.size(); l++)
+		{
+			n += labels[l].memory_bytes();
+		}
+		return n;
+	}
+};
+
+//Meshes windows on demand on one background thread and keeps the most
+//recently used ones within a memory budget. get() never waits for the
+//mesher: a window that is not ready is queued first, its neighbours
+//behind it, and get() returns NULL until it is done. The mesher is only
+//called from the worker thread, so it needs no locking of its own.
+//A window asked for before it is ready is meshed coarse to fine: at
+//preview_stride, then at half of it and so on down to full resolution,
+//each level replacing the previous one in the cache as it is done, so the
+//first frame is up long before the full surfaces. Prefetched windows are
+//meshed at full resolution only.
+class WindowCache
+{
+public:
+	//mesher(window, stride, surfaces)
+	typedef std::function<void(int, int, WindowSurfaces&)> Mesher;
+
+	WindowCache(int nb_windows, size_t max_bytes, Mesher mesher, int preview_stride = 1) : mesher_(mesher),
+		max_bytes_(max_bytes), bytes_(0), preview_stride_(std::max(preview_stride, 1)), meshing_(-1), stop_(false) {
+		windows_.resize(std::max(nb_windows, 0));
+		queued_.assign(windows_.size(), false);
+		preview_.assign(windows_.size(), false);
+		worker_ = std::thread(&WindowCache::run, this);
+	}
+
+	//waits for the window being meshed, the rest of the queue is dropped
+	~WindowCache() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_one();
+		worker_.join();
+	}
+
+	int nb_windows() const { return int(windows_.size()); }
+
+	//surfaces of window i when ready, NULL while it is meshed; they may be
+	//a preview (stride > 1) that a finer level replaces later
+	std::shared_ptr<const WindowSurfaces> get(int i) {
+		if (i < 0 || i >= nb_windows())
+		{
+			return std::shared_ptr<const WindowSurfaces>();
+		}
+		std::shared_ptr<const WindowSurfaces> surfaces;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			surfaces = windows_[i];
+			if (surfaces)
+			{
+				touch(i);
+			}
+			else if (i != meshing_)
+			{
+				preview_[i] = true;
+			}
+			//neighbours first so that window i ends up at the front
+			for (int d = WINDOW_CACHE_PREFETCH; d >= 1; d--)
+			{
+				request(i + d, !surfaces);
+				request(i - d, !surfaces);
+			}
+			request(i, true);
+		}
+		wake_.notify_one();
+		return surfaces;
+	}
+
+	size_t memory_bytes() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return bytes_;
+	}
+
+private:
+	//queues window i if it is neither ready nor meshed nor queued, urgent ones go first
+	void request(int i, bool urgent) {
+		if (i < 0 || i >= nb_windows() || windows_[i] || i == meshing_)
+		{
+			return;
+		}
+		if (queued_[i])
+		{
+			if (!urgent)
+			{
+				return;
+			}
+			queue_.erase(std::find(queue_.begin(), queue_.end(), i));
+		}
+		if (urgent)
+		{
+			queue_.push_front(i);
+		}
+		else
+		{
+			queue_.push_back(i);
+		}
+		queued_[i] = true;
+	}
+
+	//moves window i to the front of the recently used list
+	void touch(int i) {
+		lru_.remove(i);
+		lru_.push_front(i);
+	}
+
+	//drops least recently used windows until under budget, the last one stays
+	void evict() {
+		while (bytes_ > max_bytes_ && lru_.size() > 1)
+		{
+			int i = lru_.back();
+			lru_.pop_back();
+			bytes_ -= windows_[i]->memory_bytes();
+			windows_[i].reset();
+		}
+	}
+
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			wake_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+			if (stop_)
+			{
+				return;
+			}
+			int i = queue_.front();
+			queue_.pop_front();
+			queued_[i] = false;
+			meshing_ = i;
+			int stride = preview_[i] ? preview_stride_ : 1;
+			preview_[i] = false;
+
+			while (true)
+			{
+				lock.unlock();
+				std::shared_ptr<WindowSurfaces> surfaces(new WindowSurfaces);
+				surfaces->stride = stride;
+				mesher_(i, stride, *surfaces);
+				lock.lock();
+
+				store(i, surfaces);
+				if (stride <= 1 || stop_)
+				{
+					break;
+				}
+				stride /= 2;
+			}
+			meshing_ = -1;
+		}
+	}
+
+	//puts the surfaces of window i in the cache, in place of a coarser level
+	void store(int i, const std::shared_ptr<const WindowSurfaces> &surfaces) {
+		if (windows_[i])
+		{
+			bytes_ -= windows_[i]->memory_bytes();
+		}
+		windows_[i] = surfaces;
+		bytes_ += surfaces->memory_bytes();
+		touch(i);
+		evict();
+	}
+
+	Mesher mesher_;
+	size_t max_bytes_;
+	size_t bytes_;
+	int preview_stride_;
+	int meshing_;//window the worker is on, -1 when idle
+	bool stop_;
+	std::vector<std::shared_ptr<const WindowSurfaces>> windows_;//NULL when not cached
+	std::vector<bool> queued_;
+	std::vector<bool> preview_;//asked for before it was ready, meshed coarse first
+	std::deque<int> queue_;
+	std::list<int> lru_;//most recent first
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::thread worker_;
+};
+
+//Meshes slabs of slices [z0, z1) on one background thread for a range
+//the user drags. Only the latest request is kept, the ones made while a
+//slab is meshed replace each other, so the result trails the slider by at
+//most one slab and never builds up a backlog.
+class SlabMesher
+{
+public:
+	typedef std::function<void(int, int, WindowSurfaces&)> Mesher;
+
+	SlabMesher(Mesher mesher) : mesher_(mesher), z0_(0), z1_(0), pending_(false),
+		done_z0_(0), done_z1_(0), stop_(false) {
+		worker_ = std::thread(&SlabMesher::run, this);
+	}
+
+	//waits for the slab being meshed
+	~SlabMesher() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_one();
+		worker_.join();
+	}
+
+	//replaces any request not started yet
+	void request(int z0, int z1) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			z0_ = z0;
+			z1_ = z1;
+			pending_ = true;
+		}
+		wake_.notify_one();
+	}
+
+	//the last slab meshed and its range, NULL before the first one
+	std::shared_ptr<const WindowSurfaces> latest(int &z0, int &z1) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		z0 = done_z0_;
+		z1 = done_z1_;
+		return done_;
+	}
+
+private:
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			wake_.wait(lock, [this] { return stop_ || pending_; });
+			if (stop_)
+			{
+				return;
+			}
+			int z0 = z0_, z1 = z1_;
+			pending_ = false;
+
+			lock.unlock();
+			std::shared_ptr<WindowSurfaces> surfaces(new WindowSurfaces);
+			mesher_(z0, z1, *surfaces);
+			lock.lock();
+
+			done_ = surfaces;
+			done_z0_ = z0;
+			done_z1_ = z1;
+		}
+	}
+
+	Mesher mesher_;
+	int z0_;//latest request
+	int z1_;
+	bool pending_;
+	std::shared_ptr<const WindowSurfaces> done_;
+	int done_z0_;
+	int done_z1_;
+	bool stop_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::thread worker_;
+};
+
+#endif
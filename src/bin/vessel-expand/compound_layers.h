@@ -1,395 +1,398 @@
 #pragma once
 
 #include "vessel_mesh.h"
+#include "mask_loader.h"
+#include "mask_dilation.h"
+#include "stack_dims.h"
+#include "mask_stack.h"
+#include "slab_stream.h"
 
 class CompoundLayers
 {
 public:
 	CompoundLayers(int expand_) {
 		expand_level = expand_;
-		load_allimages();
+		std::vector<QString> veinmask_files = list_mask_files("vessel/vein/");
+		std::vector<QString> arterymask_files = list_mask_files("vessel/artery/");
+		std::vector<QString> micromask_files = list_mask_files("vessel/micro/");
+		dims.spacing = VoxelSpacing(1.0, 1.0, SCALEVOXEL);
+		dims.spacing.read("vessel/");
+		uint64_t key = cache_key(veinmask_files, arterymask_files, micromask_files);
+		std::string cache_file = std::string(VOLUME_CACHE_FILE);
+		if (load_cache(cache_file, key))
+		{
+			std::cout << "load volume cache done!!!" << std::endl;
+			return;
+		}
+		load_allimages(veinmask_files, arterymask_files, micromask_files);
 
-		if (BComboSlice)
+		//the last window is the whole volume, every window is cut out of it
+		int nb_windows = BComboSlice ? NCOMOBO + 1 : 1;
+		std::vector<int> cuts;
+		for (int i = 0; i < nb_windows; i++)
 		{
-			vein_smooth_faces.resize(NCOMOBO + 1);
-			artery_smooth_faces.resize(NCOMOBO + 1);
-			micro_smooth_faces.resize(NCOMOBO + 1);
-#pragma omp parallel for
-			for (int i = 0; i < NCOMOBO + 1; i++)
-			{
-				int Nslice = SLICE_INTERNAL;
-				if (i == NCOMOBO)
-				{
-					Nslice = slice;
-				}
-				std::vector<float> smooth_faces;
-				Vessel veinV(Nslice, vein_voxels[i], smooth_faces);
-				vein_smooth_faces[i] = (smooth_faces);
-				smooth_faces.clear();
-				Vessel arteryV(Nslice, artery_voxels[i], smooth_faces);
-				artery_smooth_faces[i] = (smooth_faces);
-				smooth_faces.clear();
-				Vessel microV(Nslice, micro_voxels[i], smooth_faces);
-				micro_smooth_faces[i] = (smooth_faces);
-				std::cout << "ComboSlices: " << i << " Done!" << std::endl;
-			}
+			int z_from, z_to;
+			window_range(i, z_from, z_to);
+			cuts.push_back(z_from);
+			cuts.push_back(z_to);
 		}
-		else
+		Vessel stack(dims, vein_voxels.back(), artery_voxels.back(), micro_voxels.back(), cuts);
+		vein_surfaces.resize(nb_windows);
+		artery_surfaces.resize(nb_windows);
+		micro_surfaces.resize(nb_windows);
+		//windows, the labels of a window and the slabs of a label are all
+		//tasks of one pool, so the whole stack window does not run alone
+		task_pool().run([&] {
+			task_parallel_for(0, GEO::index_t(nb_windows), [&](GEO::index_t i) {
+				int z_from, z_to;
+				window_range(int(i), z_from, z_to);
+				stack.window_surfaces(z_from, z_to, window_slices(int(i)),
+					vein_surfaces[i], artery_surfaces[i], micro_surfaces[i]);
+				std::cout << "ComboSlices: " << i << " Done!" << std::endl;
+			});
+		});
+
+		if (!save_cache(cache_file, key))
 		{
-			int Nslice = slice;
-			std::vector<float> smooth_faces;
-			Vessel veinV(Nslice, vein_voxels[0], smooth_faces);
-			vein_smooth_faces.push_back(smooth_faces);
-			smooth_faces.clear();
-			Vessel arteryV(Nslice, artery_voxels[0], smooth_faces);
-			artery_smooth_faces.push_back(smooth_faces);
-			smooth_faces.clear();
-			Vessel microV(Nslice, micro_voxels[0], smooth_faces);
-			micro_smooth_faces.push_back(smooth_faces);
-			std::cout << "ComboSlices: Done!" << std::endl;
+			std::cout << "wrong: cannot write " << cache_file << std::endl;
 		}
 	}
 
 	~CompoundLayers() {}
 
-	std::vector<std::vector<PixelVessel>> get_vein()
+	//Out-of-core mode for stacks whose voxels do not fit in memory: the
+	//surface of each label of the whole stack goes to <prefix><label><extension>,
+	//slab_slices slices at a time, and no more than a slab is ever held.
+	//A first pass decodes the masks for the crop box only, the second one
+	//decodes, expands and meshes them slab by slab.
+	static bool stream_surfaces(int expand_, int slab_slices, const std::string &prefix,
+		const std::string &extension) {
+		MaskStack masks;
+		if (!masks.open("vessel/", { "vein/", "artery/", "micro/" }, VoxelSpacing(1.0, 1.0, SCALEVOXEL)))
+		{
+			std::cout << "wrong: no masks under vessel/\n";
+			return false;
+		}
+		masks.crop();
+		const StackDims &dims = masks.dims;
+		const int nb_slices = masks.nb_slices;
+
+		const bool expand = masks.files[VEIN].size() == masks.files[ARTERY].size();
+		if (!expand)
+		{
+			std::cout << "wrong: inequivalent size for vein-artery\n";
+		}
+		SlabStream::SliceSource source = [&](int z, std::vector<SliceMask> &slice) {
+			masks.read_slice(z, slice);
+			if (expand && masks.has_mask(VEIN, z) && masks.has_mask(ARTERY, z))
+			{
+				SliceMask vein_added, artery_added;
+				expand_labels(slice[VEIN], slice[ARTERY], slice[MICRO], expand_, vein_added, artery_added);
+				merge_mask(vein_added, slice[VEIN]);
+				merge_mask(artery_added, slice[ARTERY]);
+			}
+		};
+
+		const char *names[3];
+		names[VEIN] = "vein";
+		names[ARTERY] = "artery";
+		names[MICRO] = "micro";
+		MeshStreamWriter writers[3];
+		std::vector<MeshStreamWriter*> outputs;
+		for (int l = 0; l < 3; l++)
+		{
+			if (!writers[l].open(prefix + names[l] + extension))
+			{
+				std::cout << "wrong: cannot write " << prefix + names[l] + extension << std::endl;
+				return false;
+			}
+			outputs.push_back(&writers[l]);
+		}
+
+		SlabStream stream(dims, nb_slices, 3, vessel_label_priority(), Vessel::voxel_geometry(dims, dims.slice));
+		task_pool().run([&] {
+			stream.write(source, slab_slices, outputs, [](int z0, int z1) {
+				std::cout << "Slabs: " << z0 << "-" << z1 << " Done!" << std::endl;
+			});
+		});
+		bool ok = true;
+		for (int l = 0; l < 3; l++)
+		{
+			ok = writers[l].close() && ok;
+		}
+		return ok;
+	}
+
+	const std::vector<std::vector<PixelVessel>>& get_vein() const
 	{
 		return vein_voxels;
 	}
 
-	std::vector<std::vector<PixelVessel>> get_artery()
+	const std::vector<std::vector<PixelVessel>>& get_artery() const
 	{
 		return artery_voxels;
 	}
 
-	std::vector<std::vector<PixelVessel>> get_micro()
+	const std::vector<std::vector<PixelVessel>>& get_micro() const
 	{
 		return micro_voxels;
 	}
 
-	std::vector<std::vector<float>> get_vein_smooth_faces()
+	//centers and corners of the voxels of window i, for the point and hexahedron modes
+	VoxelGeometry window_geometry(int i) const
 	{
-		return vein_smooth_faces;
+		return Vessel::voxel_geometry(dims, window_slices(i));
 	}
 
-	std::vector<std::vector<float>> get_artery_smooth_faces()
+	const StackDims& get_dims() const
 	{
-		return artery_smooth_faces;
+		return dims;
 	}
 
-	std::vector<std::vector<float>> get_micro_smooth_faces()
+	const std::vector<IndexedMesh>& get_vein_surfaces() const
 	{
-		return micro_smooth_faces;
+		return vein_surfaces;
+	}
+
+	const std::vector<IndexedMesh>& get_artery_surfaces() const
+	{
+		return artery_surfaces;
+	}
+
+	const std::vector<IndexedMesh>& get_micro_surfaces() const
+	{
+		return micro_surfaces;
+	}
+
+	void load_allimages(const std::vector<QString> &veinmask_files,
+		const std::vector<QString> &arterymask_files,
+		const std::vector<QString> &micromask_files);
+
+	void build_windows(const std::vector<std::vector<PixelVessel>> &vein_all,
+		const std::vector<std::vector<PixelVessel>> &artery_all,
+		const std::vector<std::vector<PixelVessel>> &micro_all);
+
+	//grows vein and artery into micro pixels, expand_level rings of 8-connected
+	//neighbours with vein first in each ring, and appends what they gained
+	void preprocess_vessel(const SliceMask &vein_mask, const SliceMask &artery_mask,
+		const SliceMask &micro_mask, int z, std::vector<PixelVessel> &vein_slice,
+		std::vector<PixelVessel> &artery_slice) {
+		SliceMask vein_added, artery_added;
+		expand_labels(vein_mask, artery_mask, micro_mask, expand_level, vein_added, artery_added);
+		append_voxels(vein_added, z, vein_slice);
+		append_voxels(artery_added, z, artery_slice);
 	}
 
-	void load_allimages();
+private:
+	//everything the cached volume and surfaces depend on
+	uint64_t cache_key(const std::vector<QString> &veinmask_files,
+		const std::vector<QString> &arterymask_files,
+		const std::vector<QString> &micromask_files) {
+		CacheKey key;
+		add_mask_files_key(key, veinmask_files);
+		add_mask_files_key(key, arterymask_files);
+		add_mask_files_key(key, micromask_files);
+		key.add(expand_level);
+		key.add(int(BComboSlice));
+		key.add(int(SLICE_INTERNAL));
+		key.add(int(NCOMOBO));
+		key.add(double(IMAGEWIDTHSIZE));
+		key.add(dims.spacing.x);
+		key.add(dims.spacing.y);
+		key.add(dims.spacing.z);
+		key.add(int(MERGE_FACES));
+		key.add(int(SMOOTH_SURFACES));
+		key.add(int(TAUBIN_ITERATIONS));
+		return key.value();
+	}
 
-	void preprocess_vessel(std::vector<PixelVessel> &vein_slice,
-	std::vector<PixelVessel> &artery_slice,std::vector<PixelVessel> &micro_slice) {
+	int window_slices(int i) const {
+		return (BComboSlice && i != NCOMOBO) ? SLICE_INTERNAL : dims.slice;
+	}
 
-		std::map<int, ExpandVessel> map_vessel_voxels;
-		for (auto it = micro_slice.begin(); it != micro_slice.end(); it++)
+	//slices [z_from, z_to) of window i, clipped to the stack
+	void window_range(int i, int &z_from, int &z_to) const {
+		if (!BComboSlice || i == NCOMOBO)
 		{
-			ExpandVessel ev; ev.index_ = it->index_;
-			ev.vessel_type = MICRO; ev.x = it->x; ev.y = it->y; ev.z = it->z;
-			map_vessel_voxels[it->index_] = ev;
+			z_from = 0;
+			z_to = stack_size;
+			return;
 		}
-		for (auto it = vein_slice.begin();it != vein_slice.end();it++)
+		if (i == NCOMOBO - 1)
 		{
-			ExpandVessel ev; ev.index_ = it->index_;
-			ev.vessel_type = VEIN; ev.x = it->x; ev.y = it->y; ev.z = it->z;
-			map_vessel_voxels[it->index_] = ev;
+			z_from = (NCOMOBO == 6) ? 27 : 37;
+			z_to = 48;
 		}
-		for (auto it = artery_slice.begin(); it != artery_slice.end(); it++)
+		else
 		{
-			ExpandVessel ev; ev.index_ = it->index_;
-			ev.vessel_type = ARTERY; ev.x = it->x; ev.y = it->y; ev.z = it->z;
-			map_vessel_voxels[it->index_] = ev;
-		}	
-
-		std::vector<PixelVessel> vein_temp = vein_slice;
-		std::vector<PixelVessel> arte_temp = artery_slice;
-		for (int i = 0;i<expand_level;i++)
-		{			
-			expand_cuslice(vein_temp,map_vessel_voxels,VEIN);
-			for (auto it = vein_temp.begin();it != vein_temp.end();it++)
-			{
-				vein_slice.push_back(*it);
-			}
-			expand_cuslice(arte_temp, map_vessel_voxels, ARTERY);
-			for (auto it = arte_temp.begin(); it != arte_temp.end(); it++)
-			{
-				artery_slice.push_back(*it);
-			}
+			int internal_ = (NCOMOBO == 6) ? 20 : 10, break_ = (NCOMOBO == 6) ? 5 : 2;
+			z_from = i * break_;
+			z_to = i * break_ + internal_ + 1;
 		}
+		z_from = std::min(z_from, stack_size);
+		z_to = std::min(z_to, stack_size);
 	}
 
-	void expand_cuslice(std::vector<PixelVessel> &vessel_slice,
-		std::map<int, ExpandVessel> &map_vessel_voxels,int type_) {
-
-		int z_id = vessel_slice.begin()->z;
-		std::set<std::pair<int,int>> new_added;
-		for (auto it = vessel_slice.begin(); it != vessel_slice.end(); it++)
-		{		
-			int plusx = it->index_ + height;
-			auto res = map_vessel_voxels.find(plusx);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{			
-				new_added.insert(std::pair<int,int>(it->x + 1, it->y));
-				res->second.vessel_type = type_;
-			}
-			int plus_x = it->index_ - height;
-			res = map_vessel_voxels.find(plus_x);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x - 1, it->y));
-				res->second.vessel_type = type_;
-			}
-			int plusy = it->index_ + 1;
-			res = map_vessel_voxels.find(plusy);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x, it->y+1));
-				res->second.vessel_type = type_;
-			}
-			int plus_y = it->index_ - 1;
-			res = map_vessel_voxels.find(plus_y);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x, it->y - 1));
-				res->second.vessel_type = type_;
-			}
-			int plusxy = it->index_ + height + 1;
-			res = map_vessel_voxels.find(plusxy);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x+1, it->y + 1));
-				res->second.vessel_type = type_;
-			}
-			int plusx_y = it->index_ + height - 1;
-			res = map_vessel_voxels.find(plusx_y);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x + 1, it->y - 1));
-				res->second.vessel_type = type_;
-			}
-			int plus_xy = it->index_ - height + 1;
-			res = map_vessel_voxels.find(plus_xy);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x - 1, it->y + 1));
-				res->second.vessel_type = type_;
-			}
-			int plus_x_y = it->index_ - height - 1;
-			res = map_vessel_voxels.find(plus_x_y);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x - 1, it->y - 1));
-				res->second.vessel_type = type_;
-			}			
+	//restores the cropped labels and the surfaces of every window
+	bool load_cache(const std::string &file, uint64_t key) {
+		VolumeCache cache;
+		int nb_windows = BComboSlice ? NCOMOBO + 1 : 1;
+		if (!cache.load(file, key) || cache.labels.size() != 3 ||
+			cache.surfaces.size() != size_t(3 * nb_windows))
+		{
+			return false;
 		}
-	
-		vessel_slice.clear();
-		for (auto it = new_added.begin();it != new_added.end();it++)
+		dims.width = cache.width;
+		dims.height = cache.height;
+		dims.slice = cache.slice;
+		dims.min_x = cache.min_x;
+		dims.min_y = cache.min_y;
+		stack_size = cache.labels[0].size_z();
+
+		std::vector<std::vector<PixelVessel>> vein_all, artery_all, micro_all;
+		grid_to_slices(cache.labels[0], vein_all);
+		grid_to_slices(cache.labels[1], artery_all);
+		grid_to_slices(cache.labels[2], micro_all);
+		build_windows(vein_all, artery_all, micro_all);
+
+		vein_surfaces.resize(nb_windows);
+		artery_surfaces.resize(nb_windows);
+		micro_surfaces.resize(nb_windows);
+		for (int i = 0; i < nb_windows; i++)
 		{
-			PixelVessel newp; newp.x = it->first; newp.y = it->second;
-			newp.z = z_id;
-			newp.index_ = newp.x*height + newp.y + newp.z*width*height;
-			vessel_slice.push_back(newp);
+			vein_surfaces[i].swap(cache.surfaces[3 * i]);
+			artery_surfaces[i].swap(cache.surfaces[3 * i + 1]);
+			micro_surfaces[i].swap(cache.surfaces[3 * i + 2]);
 		}
+		return true;
+	}
+
+	//the last window is the whole cropped volume
+	bool save_cache(const std::string &file, uint64_t key) {
+		if (vein_voxels.empty())
+		{
+			return false;
+		}
+		VolumeCache cache;
+		cache.width = dims.width;
+		cache.height = dims.height;
+		cache.slice = dims.slice;
+		cache.min_x = dims.min_x;
+		cache.min_y = dims.min_y;
+		cache.labels.resize(3);
+		voxels_to_grid(vein_voxels.back(), cache.labels[0]);
+		voxels_to_grid(artery_voxels.back(), cache.labels[1]);
+		voxels_to_grid(micro_voxels.back(), cache.labels[2]);
+		for (int i = 0; i < vein_surfaces.size(); i++)
+		{
+			cache.surfaces.push_back(vein_surfaces[i]);
+			cache.surfaces.push_back(artery_surfaces[i]);
+			cache.surfaces.push_back(micro_surfaces[i]);
+		}
+		return cache.save(file, key);
+	}
+
+	void voxels_to_grid(const std::vector<PixelVessel> &voxels, OccupancyGrid &grid) {
+		grid.resize(dims.width, dims.height, stack_size);
+		for (int i = 0; i < voxels.size(); i++)
+		{
+			grid.set(voxels[i].x, voxels[i].y, voxels[i].z);
+		}
+	}
+
+	void grid_to_slices(const OccupancyGrid &grid, std::vector<std::vector<PixelVessel>> &slices) {
+		slices.assign(grid.size_z(), std::vector<PixelVessel>());
+		grid.for_each_voxel([&](int x, int y, int z) {
+			PixelVessel v; v.x = x; v.y = y; v.z = z;
+			v.index_ = dims.voxel_index(x, y, z);
+			slices[z].push_back(v);
+		});
+	}
+
+	void crop_voxels(std::vector<PixelVessel> &voxels, int min_x, int min_y) {
+		for (int i = 0; i < voxels.size(); i++)
+		{
+			voxels[i].x -= min_x;
+			voxels[i].y -= min_y;
+			voxels[i].index_ = dims.voxel_index(voxels[i].x, voxels[i].y, voxels[i].z);
+		}
+	}
+
+	//foreground pixels of a decoded mask, indexed with the full image size
+	void append_voxels(const SliceMask &mask, int z, std::vector<PixelVessel> &voxels) {
+		voxels.reserve(voxels.size() + mask.count());
+		mask.for_each_pixel([&](int x, int y) {
+			PixelVessel v; v.x = x; v.y = y; v.z = z;
+			v.index_ = x * mask.height + y + z * mask.width * mask.height;
+			voxels.push_back(v);
+		});
 	}
 
-private:
 	int expand_level;
+	StackDims dims;//set once the load is done
+	int stack_size = 0;//slices of the mask stack
 
 	std::vector<std::vector<PixelVessel>> vein_voxels;
 	std::vector<std::vector<PixelVessel>> artery_voxels;
 	std::vector<std::vector<PixelVessel>> micro_voxels;
 
-	std::vector<std::vector<float>> vein_smooth_faces;
-	std::vector<std::vector<float>> artery_smooth_faces;
-	std::vector<std::vector<float>> micro_smooth_faces;
+	std::vector<IndexedMesh> vein_surfaces;
+	std::vector<IndexedMesh> artery_surfaces;
+	std::vector<IndexedMesh> micro_surfaces;
 };
 
-void CompoundLayers::load_allimages()
+void CompoundLayers::load_allimages(const std::vector<QString> &veinmask_files,
+	const std::vector<QString> &arterymask_files,
+	const std::vector<QString> &micromask_files)
 {
 	int file_size_ = 0;
-	//VEIN
-	std::vector<std::string> veinmaskfile;
-	std::vector<std::pair<QString, int>>	veinmask_files;
-	getFiles("vessel/vein/*.png", veinmaskfile);
-	for (int i = 0; i < veinmaskfile.size(); i++)
-	{
-		QString filename_ = QString::fromStdString(veinmaskfile[i]);
-		int index = filename_.split("/").last().split(".").at(0).split("_").last().toInt();
-		QString fullname("vessel/vein/");
-		fullname.append(filename_);
-		veinmask_files.push_back(std::pair<QString, int>(fullname, index));
-	}
-	sort(veinmask_files.begin(), veinmask_files.end(), sort_qstringpair_secondgreater);
-
-	//artery
-	std::vector<std::string> arterymaskfile;
-	std::vector<std::pair<QString, int>>	arterymask_files;
-	getFiles("vessel/artery/*.png", arterymaskfile);
-	for (int i = 0; i < arterymaskfile.size(); i++)
-	{
-		QString filename_ = QString::fromStdString(arterymaskfile[i]);
-		int index = filename_.split("/").last().split(".").at(0).split("_").last().toInt();
-		QString fullname("vessel/artery/");
-		fullname.append(filename_);
-		arterymask_files.push_back(std::pair<QString, int>(fullname, index));
-	}
-	sort(arterymask_files.begin(), arterymask_files.end(), sort_qstringpair_secondgreater);
-
-	//micro
-	std::vector<std::string> micromaskfile;
-	std::vector<std::pair<QString, int>>	micromask_files;
-	getFiles("vessel/micro/*.png", micromaskfile);
-	for (int i = 0; i < micromaskfile.size(); i++)
-	{
-		QString filename_ = QString::fromStdString(micromaskfile[i]);
-		int index = filename_.split("/").last().split(".").at(0).split("_").last().toInt();
-		QString fullname("vessel/micro/");
-		fullname.append(filename_);
-		micromask_files.push_back(std::pair<QString, int>(fullname, index));
-	}
-	sort(micromask_files.begin(), micromask_files.end(), sort_qstringpair_secondgreater);
 
-	//size
-	if (veinmask_files.size()>0)
-	{
-		QImage im_;
-		im_.load(veinmask_files[0].first);
-		width = im_.width();
-		height = im_.height();
-		slice = veinmask_files.size();
-	}
+	//the slice workers only read the files, what they find goes to their
+	//own slice and is reduced once they are done
+	StackDims load;
+	load.spacing = dims.spacing;
+	load.add_mask_files(veinmask_files);
 
 	file_size_ = arterymask_files.size() > 0 ? arterymask_files.size() : file_size_;
 	file_size_ = micromask_files.size() > 0 ? micromask_files.size() : file_size_;
-	file_size_ = veinmaskfile.size() > 0 ? veinmaskfile.size() : file_size_;
+	file_size_ = veinmask_files.size() > 0 ? veinmask_files.size() : file_size_;
 
-	int min_x = 10000, max_x = 0, min_y = 10000, max_y = 0;
+	//one worker per slice decodes the three masks of that slice and
+	//pre-processes them, voxels keep image coordinates until the crop
 	std::vector<std::vector<PixelVessel>> vein_all(file_size_), artery_all(file_size_), micro_all(file_size_);
-#pragma omp parallel for
+	std::vector<PixelBox> slice_box(file_size_);
+#pragma omp parallel for schedule(dynamic)
 	for (int i = 0; i < file_size_; i++)
 	{
 		std::vector<PixelVessel> vein_now, artery_now, micro_now;
+		SliceMask vein_mask, artery_mask, micro_mask;
 		//vein
-		QImage im_;
-		im_.load(veinmask_files[i].first);
-		width = im_.width();
-		height = im_.height();
-		int check_value;
-		if (qGray(im_.pixel(0, 0)) == 0)
-		{
-			check_value = 0;
-		}
-		else
-		{
-			check_value = 255;
-		}
-		for (int wid = 0; wid < im_.width(); wid++)
+		if (i < veinmask_files.size())
 		{
-			for (int hei = 0; hei < im_.height(); hei++)
-			{
-				int gray_ = qGray(im_.pixel(wid, im_.height() - 1 - hei));
-				if (gray_ != check_value)
-				{
-					min_x = wid < min_x ? wid : min_x;
-					min_y = hei < min_y ? hei : min_y;
-					max_x = wid > max_x ? wid : max_x;
-					max_y = hei > max_y ? hei : max_y;
-
-					PixelVessel v; v.x = wid; v.y = hei; v.z = i;
-					int index = wid*im_.height() + hei + i*im_.width()*im_.height();
-					v.index_ = index;
-					vein_now.push_back(v);
-				}
-			}
+			decode_mask_slice(veinmask_files[i], vein_mask);
+			append_voxels(vein_mask, i, vein_now);
+			slice_box[i].merge(vein_mask.box);
 		}
 		//artery
-		QImage im_a;
-		im_a.load(arterymask_files[i].first);
-		int check_valuea;
-		if (qGray(im_a.pixel(0, 0)) == 0)
-		{
-			check_valuea = 0;
-		}
-		else
+		if (i < arterymask_files.size())
 		{
-			check_valuea = 255;
+			decode_mask_slice(arterymask_files[i], artery_mask);
+			append_voxels(artery_mask, i, artery_now);
+			slice_box[i].merge(artery_mask.box);
 		}
-		for (int wid = 0; wid < im_a.width(); wid++)
-		{
-			for (int hei = 0; hei < im_a.height(); hei++)
-			{
-				int gray_ = qGray(im_a.pixel(wid, im_a.height() - 1 - hei));
-				if (gray_ != check_valuea)
-				{
-					min_x = wid < min_x ? wid : min_x;
-					min_y = hei < min_y ? hei : min_y;
-					max_x = wid > max_x ? wid : max_x;
-					max_y = hei > max_y ? hei : max_y;
-
-					PixelVessel v; v.x = wid; v.y = hei; v.z = i;
-					int index = wid*im_a.height() + hei + i*im_a.width()*im_a.height();
-					v.index_ = index;
-					artery_now.push_back(v);
-				}
-			}
-		}
-
 		//micro
-		QImage im_m;
-		im_m.load(micromask_files[i].first);
-		int check_valuem;
-		if (qGray(im_m.pixel(0, 0)) == 0)
-		{
-			check_valuem = 0;
-		}
-		else
-		{
-			check_valuem = 255;
-		}
-		for (int wid = 0; wid < im_m.width(); wid++)
+		if (i < micromask_files.size())
 		{
-			for (int hei = 0; hei < im_m.height(); hei++)
-			{
-				int gray_ = qGray(im_m.pixel(wid, im_m.height() - 1 - hei));
-				if (gray_ != check_valuem)
-				{
-					min_x = wid < min_x ? wid : min_x;
-					min_y = hei < min_y ? hei : min_y;
-					max_x = wid > max_x ? wid : max_x;
-					max_y = hei > max_y ? hei : max_y;
-
-					PixelVessel v; v.x = wid; v.y = hei; v.z = i;
-					int index = wid*im_m.height() + hei + i*im_m.width()*im_m.height();
-					v.index_ = index;
-					micro_now.push_back(v);
-				}
-			}
+			decode_mask_slice(micromask_files[i], micro_mask);
+			append_voxels(micro_mask, i, micro_now);
+			slice_box[i].merge(micro_mask.box);
 		}
 
 		//pre-process vessel
-		std::vector<PixelVessel> vein_temp, artery_temp, micro_temp;
-		vein_temp = vein_now;
-		artery_temp = artery_now;
-		micro_temp = micro_now;
 		if (arterymask_files.size() == micromask_files.size() &&
 			veinmask_files.size() == micromask_files.size())
 		{
-			preprocess_vessel(vein_temp, artery_now, micro_now);
-			for (auto it = vein_temp.begin(); it != vein_temp.end(); it++)
-			{
-				vein_now.push_back(*it);
-			}
-			for (auto it = artery_temp.begin(); it != artery_temp.end(); it++)
-			{
-				artery_now.push_back(*it);
-			}
+			preprocess_vessel(vein_mask, artery_mask, micro_mask, i, vein_now, artery_now);
 		}
 		else
 		{
@@ -399,114 +402,40 @@ void CompoundLayers::load_allimages()
 		artery_all[i] = artery_now;
 		micro_all[i] = micro_now;
 	}
-	width = max_x - min_x + 1;
-	height = max_y - min_y + 1;
 
-	std::vector<PixelVessel> vein_whole, artery_whole, micro_whole;
-	for (int k = 0; k<vein_all.size(); k++)
+	load.crop_to(slice_box);
+	dims = load;
+	for (int k = 0; k < file_size_; k++)
 	{
-		for (int i = 0; i < vein_all[k].size(); i++)
-		{
-			PixelVessel newp = vein_all[k][i];
-			newp.x -= min_x;
-			newp.y -= min_y;
-			newp.index_ = newp.x*height + newp.y + newp.z*width*height;
-			vein_all[k][i] = newp;
-			vein_whole.push_back(newp);
-		}
-		for (int i = 0; i < artery_all[k].size(); i++)
-		{
-			PixelVessel newp = artery_all[k][i];
-			newp.x -= min_x;
-			newp.y -= min_y;
-			newp.index_ = newp.x*height + newp.y + newp.z*width*height;
-			artery_all[k][i] = newp;
-			artery_whole.push_back(newp);
-		}
-		for (int i = 0; i < micro_all[k].size(); i++)
-		{
-			PixelVessel newp = micro_all[k][i];
-			newp.x -= min_x;
-			newp.y -= min_y;
-			newp.index_ = newp.x*height + newp.y + newp.z*width*height;
-			micro_all[k][i] = newp;
-			micro_whole.push_back(newp);
-		}	
+		crop_voxels(vein_all[k], dims.min_x, dims.min_y);
+		crop_voxels(artery_all[k], dims.min_x, dims.min_y);
+		crop_voxels(micro_all[k], dims.min_x, dims.min_y);
 	}
+	stack_size = file_size_;
+	build_windows(vein_all, artery_all, micro_all);
+
+	std::cout << "load images done!!!" << std::endl;
+}
 
-	if (BComboSlice)
+//combo windows plus the whole volume as the last one, slices already cropped
+void CompoundLayers::build_windows(const std::vector<std::vector<PixelVessel>> &vein_all,
+	const std::vector<std::vector<PixelVessel>> &artery_all,
+	const std::vector<std::vector<PixelVessel>> &micro_all)
+{
+	int nb_windows = BComboSlice ? NCOMOBO + 1 : 1;
+	vein_voxels.assign(nb_windows, std::vector<PixelVessel>());
+	artery_voxels.assign(nb_windows, std::vector<PixelVessel>());
+	micro_voxels.assign(nb_windows, std::vector<PixelVessel>());
+	for (int i = 0; i < nb_windows; i++)
 	{
-		vein_voxels.resize(NCOMOBO + 1);
-		artery_voxels.resize(NCOMOBO + 1);
-		micro_voxels.resize(NCOMOBO + 1);
-		for (int i = 0; i < NCOMOBO; i++)
+		int z_from, z_to;
+		window_range(i, z_from, z_to);
+		for (int k = z_from; k < z_to; k++)
 		{
-			if (i == NCOMOBO - 1)
-			{
-				int from_, to_;
-				if (NCOMOBO == 6)
-				{
-					from_ = 27; to_ = 48;
-				}
-				else
-				{
-					from_ = 37; to_ = 48;
-				}
-				for (int k = from_; k < to_; k++)
-				{
-					for (auto it = vein_all[k].begin(); it != vein_all[k].end(); it++)
-					{
-						vein_voxels[i].push_back(*it);
-					}
-					for (auto it = artery_all[k].begin(); it != artery_all[k].end(); it++)
-					{
-						artery_voxels[i].push_back(*it);
-					}
-					for (auto it = micro_all[k].begin(); it != micro_all[k].end(); it++)
-					{
-						micro_voxels[i].push_back(*it);
-					}
-				}
-			}
-			else
-			{
-				int internal_, break_;
-				if (NCOMOBO == 6)
-				{
-					internal_ = 20; break_ = 5;
-				}
-				else
-				{
-					internal_ = 10; break_ = 2;
-				}
-				for (int k = i * break_; k <= i * break_ + internal_; k++)
-				{
-					for (auto it = vein_all[k].begin(); it != vein_all[k].end(); it++)
-					{
-						vein_voxels[i].push_back(*it);
-					}
-					for (auto it = artery_all[k].begin(); it != artery_all[k].end(); it++)
-					{
-						artery_voxels[i].push_back(*it);
-					}
-					for (auto it = micro_all[k].begin(); it != micro_all[k].end(); it++)
-					{
-						micro_voxels[i].push_back(*it);
-					}
-				}
-			}
+			vein_voxels[i].insert(vein_voxels[i].end(), vein_all[k].begin(), vein_all[k].end());
+			artery_voxels[i].insert(artery_voxels[i].end(), artery_all[k].begin(), artery_all[k].end());
+			micro_voxels[i].insert(micro_voxels[i].end(), micro_all[k].begin(), micro_all[k].end());
 		}
-		vein_voxels[NCOMOBO] = vein_whole;
-		artery_voxels[NCOMOBO] = artery_whole;
-		micro_voxels[NCOMOBO] = micro_whole;
 	}
-	else
-	{
-		vein_voxels.push_back(vein_whole);
-		artery_voxels.push_back(artery_whole);
-		micro_voxels.push_back(micro_whole);
-	}
-
-	std::cout << "load images done!!!" << std::endl;
 }
 
@@ -31,10 +31,9 @@
 #include <CGAL/Polygon_mesh_processing/remesh.h>
 #include <CGAL/Polygon_mesh_processing/border.h>
 #include <CGAL/boost/graph/selection.h>
-#include <CGAL/Polygon_mesh_processing/compute_normal.h>
 
 #define IMAGEWIDTHSIZE 0.5
-#define SCALEVOXEL 5.5
+#define SCALEVOXEL 5.5//slice thickness in pixels when the masks have no spacing.txt
 #define M_PI 3.1415926
 
 #define EXPANDLEVEL 3
@@ -44,10 +43,13 @@
 #define NCOMOBO 19//6 or 19
 
 #define SAVE_FILES 0
-
-int width = 0;
-int height = 0;
-int slice = 0;
+#define MERGE_FACES 1//coplanar faces merged into rectangles, far fewer triangles
+#define SMOOTH_SURFACES 0//vertices placed on a surface net (see surface_nets.h), faces then not merged
+#define TAUBIN_ITERATIONS 0//Taubin smoothing passes (see mesh_smoothing.h), faces then not merged
+#define VOLUME_CACHE_FILE "vessel/volume.vvox"
+#define STREAM_SLAB_SLICES 32//slices per slab of the out-of-core mode
+#define STREAM_FILE_PREFIX "vessel/stack_"//surfaces of the out-of-core mode
+#define STREAM_FILE_EXTENSION ".ply"//.ply, .stl, .geogram or .obj
 
 typedef CGAL::Exact_predicates_inexact_constructions_kernel K;
 typedef K::Point_2                                          Point_2;
@@ -174,15 +176,7 @@ enum VesselType
 	VEIN, ARTERY, MICRO
 };
 
-struct ExpandVessel 
-{
-	int vessel_type; //VesselType
-	int index_;
-	int x;
-	int y;
-	int z;
-};
-
+//hot data only: centers and corners come from VoxelGeometry when needed
 struct PixelVessel
 {
 	int x;//width
@@ -190,16 +184,4 @@ struct PixelVessel
 	int z;//slice
 
 	int index_;
-
-	double center[3] = { 0,0,0 };
-	bool xfacet = 1;//normal x plane;
-	bool x_facet = 1;//normal -xplane;
-	bool yfacet = 1;//normal y plane;
-	bool y_facet = 1;//normal -y plane;
-	bool zfacet = 1;//normal z plane;
-	bool z_facet = 1;//normal -z plane;
-	bool bvisited = false;
-
-	int corners[8];//-x-y-z:1; x-y-z:2; xyz:7; 
-	float corners_pts[24];//-x-y-z:1; x-y-z:2; xyz:7; 
 };
\ No newline at end of file
@@ -46,6 +46,8 @@
 #include <geogram_gfx/gui/simple_application.h>
 #include <geogram_gfx/GLUP/GLUP_private.h>
 #include "compound_layers.h"
+#include "surface_gfx.h"
+#include "voxel_gfx.h"
 
 namespace {
 
@@ -66,32 +68,17 @@ namespace {
 
 			layers = new CompoundLayers(EXPANDLEVEL);
 
-			all_vein_voxels = layers->get_vein();
-			all_artery_voxels = layers->get_artery();
-			all_micro_voxels = layers->get_micro();
-			
-			std::vector<std::vector<float>> vein_fs = layers->get_vein_smooth_faces();
-			std::vector<std::vector<float>> arte_fs = layers->get_artery_smooth_faces();
-			std::vector<std::vector<float>> mico_fs = layers->get_micro_smooth_faces();
-
-			vein_faces = new float*[vein_fs.size()];
-			artery_faces = new float*[arte_fs.size()];
-			micro_faces = new float*[mico_fs.size()];
-			for (int k = 0;k<vein_fs.size();k++)
+			all_vein_voxels = &layers->get_vein();
+			all_artery_voxels = &layers->get_artery();
+			all_micro_voxels = &layers->get_micro();
+			window_geometries.resize(all_vein_voxels->size());
+			for (int k = 0; k < window_geometries.size(); k++)
 			{
-				vein_faces_size.push_back(vein_fs[k].size());
-				vein_faces[k] = new float[vein_faces_size[k]];
-				std::copy(vein_fs[k].begin(), vein_fs[k].end(), vein_faces[k]);		
-
-				artery_faces_size.push_back(arte_fs[k].size());
-				artery_faces[k] = new float[artery_faces_size[k]];
-				std::copy(arte_fs[k].begin(), arte_fs[k].end(), artery_faces[k]);
-
-				micro_faces_size.push_back(mico_fs[k].size());
-				micro_faces[k] = new float[micro_faces_size[k]];
-				std::copy(mico_fs[k].begin(), mico_fs[k].end(), micro_faces[k]);
+				window_geometries[k] = layers->window_geometry(k);
 			}
 			
+			set_surfaces();
+			
 			mesh_ = false;
 			point_size_ = 10.0f;
 			shrink_ = 0.0f;
@@ -111,9 +98,8 @@ namespace {
 			micro_color_ = vec4f(0.8f, 0.62f, 0.13f, 1.0f);
 			micro_backcolor_ = vec4f(0.963f, 0.581f, 0.704f, 1.0f);
 
-			image_wid = IMAGEWIDTHSIZE;
-			image_hei = IMAGEWIDTHSIZE / width*height;
-			image_sli = IMAGEWIDTHSIZE / width*slice*SCALEVOXEL;
+			const StackDims &dims = layers->get_dims();
+			Vessel::voxel_geometry(dims, dims.slice).half_size(image_wid, image_hei, image_sli);
 
 			// Define the 3d region that we want to display
 			// (xmin, ymin, zmin, xmax, ymax, zmax)
@@ -125,21 +111,6 @@ namespace {
 		}
 
 		~DemoGlupApplication() {
-			if (vein_faces)
-			{
-				delete vein_faces;
-				vein_faces = NULL;
-			}
-			if (artery_faces)
-			{
-				delete artery_faces;
-				artery_faces = NULL;
-			}
-			if (micro_faces)
-			{
-				delete micro_faces;
-				micro_faces = NULL;
-			}
 			if (layers)
 			{
 				delete layers;
@@ -151,9 +122,42 @@ namespace {
 		 * \copydoc SimpleApplication::GL_terminate()
 		 */
 		void GL_terminate() override {
+			release_surfaces();
 			SimpleApplication::GL_terminate();
 		}
 
+		//one SurfaceGfx per combo window, drawing the meshes of layers in
+		//place, buffers are uploaded on first draw
+		void set_surfaces()
+		{
+			release_surfaces();
+			const std::vector<IndexedMesh> &vein_surfaces = layers->get_vein_surfaces();
+			const std::vector<IndexedMesh> &artery_surfaces = layers->get_artery_surfaces();
+			const std::vector<IndexedMesh> &micro_surfaces = layers->get_micro_surfaces();
+			vein_gfx.resize(vein_surfaces.size());
+			artery_gfx.resize(artery_surfaces.size());
+			micro_gfx.resize(micro_surfaces.size());
+			for (int k = 0; k < vein_surfaces.size(); k++)
+			{
+				vein_gfx[k].set_mesh(&vein_surfaces[k]);
+				artery_gfx[k].set_mesh(&artery_surfaces[k]);
+				micro_gfx[k].set_mesh(&micro_surfaces[k]);
+			}
+		}
+
+		void release_surfaces()
+		{
+			for (int k = 0; k < vein_gfx.size(); k++)
+			{
+				vein_gfx[k].GL_terminate();
+				artery_gfx[k].GL_terminate();
+				micro_gfx[k].GL_terminate();
+			}
+			vein_gfx.clear();
+			artery_gfx.clear();
+			micro_gfx.clear();
+		}
+
 		/**
 		 * \brief Displays and handles the GUI for object properties.
 		 * \details Overloads Application::draw_object_properties().
@@ -347,38 +351,17 @@ namespace {
 				if (do_draw_vein)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, vein_colors);
-					glupBegin(GLUP_POINTS);
-					for (int i = 0; i < all_vein_voxels[current_comboslice].size(); i++)
-					{
-						glupVertex3f(all_vein_voxels[current_comboslice][i].center[0],
-							all_vein_voxels[current_comboslice][i].center[1],
-							all_vein_voxels[current_comboslice][i].center[2]);
-					}
-					glupEnd();
+					draw_voxel_points((*all_vein_voxels)[current_comboslice], window_geometries[current_comboslice]);
 				}
 				if (do_draw_artery)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, artery_colors);
-					glupBegin(GLUP_POINTS);
-					for (int i = 0; i <  all_artery_voxels[current_comboslice].size(); i++)
-					{
-						glupVertex3f(all_artery_voxels[current_comboslice][i].center[0],
-							all_artery_voxels[current_comboslice][i].center[1],
-							all_artery_voxels[current_comboslice][i].center[2]);
-					}
-					glupEnd();
+					draw_voxel_points((*all_artery_voxels)[current_comboslice], window_geometries[current_comboslice]);
 				}
 				if (do_draw_micro)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, micro_colors);
-					glupBegin(GLUP_POINTS);
-					for (int i = 0; i <  all_micro_voxels[current_comboslice].size(); i++)
-					{
-						glupVertex3f(all_micro_voxels[current_comboslice][i].center[0],
-							all_micro_voxels[current_comboslice][i].center[1],
-							all_micro_voxels[current_comboslice][i].center[2]);
-					}
-					glupEnd();
+					draw_voxel_points((*all_micro_voxels)[current_comboslice], window_geometries[current_comboslice]);
 				}
 			} break;
 
@@ -388,37 +371,17 @@ namespace {
 				float specular_backup = glupGetSpecular();
 				glupSetSpecular(0.4f);
 
-				if (do_draw_vein)
+				if (do_draw_vein && current_comboslice < vein_gfx.size())
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, vein_colors);
-					glupBegin(GLUP_TRIANGLES);
-					for (int i = 0; i < vein_faces_size[current_comboslice];)
-					{
-						glupNormal3d(vein_faces[current_comboslice][i],
-							vein_faces[current_comboslice][i + 1], vein_faces[current_comboslice][i + 2]);
-						i += 3;
-						glupVertex3d(vein_faces[current_comboslice][i],
-							vein_faces[current_comboslice][i + 1], vein_faces[current_comboslice][i + 2]);
-						i += 3;
-					}
-					glupEnd();
+					vein_gfx[current_comboslice].draw();
 				}
-				if (do_draw_artery)
+				if (do_draw_artery && current_comboslice < artery_gfx.size())
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, artery_colors);
-					glupBegin(GLUP_TRIANGLES);
-					for (int i = 0; i < artery_faces_size[current_comboslice];)
-					{
-						glupNormal3d(artery_faces[current_comboslice][i],
-							artery_faces[current_comboslice][i+1], artery_faces[current_comboslice][i+2]);
-						i += 3;
-						glupVertex3d(artery_faces[current_comboslice][i],
-							artery_faces[current_comboslice][i+1], artery_faces[current_comboslice][i+2]);
-						i += 3;
-					}
-					glupEnd();
+					artery_gfx[current_comboslice].draw();
 				}
-				if (do_draw_micro)
+				if (do_draw_micro && current_comboslice < micro_gfx.size())
 				{
 					if (balpha)
 					{
@@ -428,17 +391,7 @@ namespace {
 					
 					glupSetColor4fv(GLUP_FRONT_COLOR, micro_colors);
 					glupSetColor4fv(GLUP_BACK_COLOR, micro_backcolors);
-					glupBegin(GLUP_TRIANGLES);
-					for (int i = 0; i < micro_faces_size[current_comboslice];)
-					{
-						glupNormal3d(micro_faces[current_comboslice][i],
-							micro_faces[current_comboslice][i + 1], micro_faces[current_comboslice][i + 2]);
-						i += 3;
-						glupVertex3d(micro_faces[current_comboslice][i],
-							micro_faces[current_comboslice][i + 1], micro_faces[current_comboslice][i + 2]);
-						i += 3;
-					}
-					glupEnd();
+					micro_gfx[current_comboslice].draw();
 
 					glupDisable(GLUP_ALPHA_DISCARD);
 				}
@@ -451,46 +404,19 @@ namespace {
 				if (do_draw_vein)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, vein_colors);
-					glupBegin(GLUP_HEXAHEDRA);
-					for (int i = 0; i < all_vein_voxels[current_comboslice].size(); i++)
-					{
-						PixelVessel p = all_vein_voxels[current_comboslice][i];
-						for (int k = 0; k < 8; k++)
-						{
-							glupVertex3f(p.corners_pts[k * 3], p.corners_pts[k * 3 + 1], p.corners_pts[k * 3 + 2]);
-						}
-					}
-					glupEnd();
+					draw_voxel_hexahedra((*all_vein_voxels)[current_comboslice], window_geometries[current_comboslice]);
 				}
 				if (do_draw_artery)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, artery_colors);
-					glupBegin(GLUP_HEXAHEDRA);
-					for (int i = 0; i < all_artery_voxels[current_comboslice].size(); i++)
-					{
-						PixelVessel p = all_artery_voxels[current_comboslice][i];
-						for (int k = 0; k < 8; k++)
-						{
-							glupVertex3f(p.corners_pts[k * 3], p.corners_pts[k * 3 + 1], p.corners_pts[k * 3 + 2]);
-						}
-					}
-					glupEnd();
+					draw_voxel_hexahedra((*all_artery_voxels)[current_comboslice], window_geometries[current_comboslice]);
 				}
 
 				glupSetCellsShrink(shrink_);
 				if (do_draw_micro)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, micro_colors);
-					glupBegin(GLUP_HEXAHEDRA);
-					for (int i = 0; i < all_micro_voxels[current_comboslice].size(); i++)
-					{
-						PixelVessel p = all_micro_voxels[current_comboslice][i];
-						for (int k = 0; k < 8; k++)
-						{
-							glupVertex3f(p.corners_pts[k * 3], p.corners_pts[k * 3 + 1], p.corners_pts[k * 3 + 2]);
-						}
-					}
-					glupEnd();
+					draw_voxel_hexahedra((*all_micro_voxels)[current_comboslice], window_geometries[current_comboslice]);
 				}
 				glupSetCellsShrink(0.0);
 				
@@ -552,21 +478,29 @@ namespace {
 
 		CompoundLayers *layers;
 
-		std::vector<std::vector<PixelVessel>> all_vein_voxels;
-		std::vector<std::vector<PixelVessel>> all_artery_voxels;
-		std::vector<std::vector<PixelVessel>> all_micro_voxels;
+		//owned by layers
+		const std::vector<std::vector<PixelVessel>> *all_vein_voxels;
+		const std::vector<std::vector<PixelVessel>> *all_artery_voxels;
+		const std::vector<std::vector<PixelVessel>> *all_micro_voxels;
+		std::vector<VoxelGeometry> window_geometries;
 
-		float**			vein_faces;
-		vector<int>		vein_faces_size;
-		float**			artery_faces;
-		vector<int>		artery_faces_size;
-		float**			micro_faces;
-		vector<int>		micro_faces_size;
+		std::vector<SurfaceGfx> vein_gfx;
+		std::vector<SurfaceGfx> artery_gfx;
+		std::vector<SurfaceGfx> micro_gfx;
 	};
       
 }
 
 int main(int argc, char** argv) {
+    //--stream: the surfaces of the whole stack are written slab by slab
+    //without loading it, for stacks too big to hold in memory
+    if (argc > 1 && std::string(argv[1]) == "--stream") {
+        GEO::initialize();
+        bool ok = CompoundLayers::stream_surfaces(EXPANDLEVEL, STREAM_SLAB_SLICES, STREAM_FILE_PREFIX,
+            STREAM_FILE_EXTENSION);
+        GEO::terminate();
+        return ok ? 0 : 1;
+    }
     DemoGlupApplication app;
     app.start(argc, argv);
     return 0;
@@ -1,299 +1,391 @@
 #pragma once
 
+#include <atomic>
+
+#include <geogram/basic/logger.h>
+
 #include "vessel_mesh.h"
+#include "mask_loader.h"
+#include "mask_dilation.h"
+#include "stack_dims.h"
+#include "mesh_stream.h"
 
-std::pair<int, int> min_pos;
+//How the files of a stack are split into combo windows
+struct ComboLayout
+{
+	int total_slices = 0;//micro masks
+	int va_from = 0;//slices with vein and artery masks
+	int va_to = 0;
+	int slice_internal = 0;//slices per combo window
+	int nb_combo = 0;//combo windows before the whole stack
+};
+
+//layout of the masks under path, false when vein and artery do not match
+inline bool combo_layout(const std::string &path_, ComboLayout &layout)
+{
+	//the files CompoundLayers loads
+	const std::vector<QString> micromaskfile = list_mask_files(path_ + "micro/");
+	const std::vector<QString> veinmaskfile = list_mask_files(path_ + "vein/");
+	const std::vector<QString> artmaskfile = list_mask_files(path_ + "artery/");
+
+	if (veinmaskfile.size() != artmaskfile.size())
+	{
+		GEO::Logger::err("I/O") << "Size of vein must be same with artery!!" << std::endl;
+		return false;
+	}
+	layout = ComboLayout();
+	const int total = int(micromaskfile.size());
+	layout.total_slices = total;
+	layout.va_from = 0;
+	layout.va_to = total - 1;
+	if (veinmaskfile.size() != micromaskfile.size() && !veinmaskfile.empty())
+	{
+		layout.va_from = (int(micromaskfile.size()) - int(veinmaskfile.size())) / 2;
+		layout.va_to = layout.va_from + int(veinmaskfile.size()) - 1;
+	}
+
+	if (total == 96)
+	{
+		layout.slice_internal = 24;
+	}
+	else if (total == 56)
+	{
+		layout.slice_internal = 14;
+	}
+	else if (total == 48)
+	{
+		layout.slice_internal = 12;
+	}
+	else if (total < 20)
+	{
+		layout.slice_internal = total;
+	}
+	else if (total < 35)
+	{
+		layout.slice_internal = total / 2;
+	}
+	else
+		layout.slice_internal = total / 4;
+
+	for (int t = 0; t < total - layout.slice_internal;)
+	{
+		layout.nb_combo++;
+		t += layout.slice_internal / 2;
+	}
+	if (total > layout.slice_internal)
+		layout.nb_combo++;
+	return true;
+}
 
 class CompoundLayers
 {
 public:
-	CompoundLayers(int expand_,std::string pathin) {
+	//progress, when given, counts the load_steps() done so far
+	CompoundLayers(int expand_, std::string pathin, const ComboLayout &layout_,
+		std::atomic<int> *progress_ = NULL) {
 		expand_level = expand_;
 		inpath = pathin;
-		load_allimages();	
-
-		if (BComboSlice)
+		layout = layout_;
+		progress = progress_;
+		std::vector<QString> veinmask_files = list_mask_files(inpath + "vein/");
+		std::vector<QString> arterymask_files = list_mask_files(inpath + "artery/");
+		std::vector<QString> micromask_files = list_mask_files(inpath + "micro/");
+		dims.spacing = VoxelSpacing(1.0, 1.0, SCALEVOXEL);
+		dims.spacing.read(inpath);
+		uint64_t key = cache_key(veinmask_files, arterymask_files, micromask_files);
+		std::string cache_file = inpath + "volume.vvox";
+		if (load_cache(cache_file, key))
+		{
+			std::cout << "load volume cache done!!!" << std::endl;
+			step(layout.total_slices);
+		}
+		else
 		{
-			vein_smooth_faces.resize(NCOMOBO + 1);
-			artery_smooth_faces.resize(NCOMOBO + 1);
-			micro_smooth_faces.resize(NCOMOBO + 1);
-#pragma omp parallel for
-			for (int i = 0; i < NCOMOBO + 1; i++)
+			load_allimages(veinmask_files, arterymask_files, micromask_files);
+			if (!save_cache(cache_file, key))
 			{
-				//if ((i+1) % 2 == 0 && i != NCOMOBO)//half visible
-				//	continue;
-				int Nslice = SLICE_INTERNAL;
-				if (i == NCOMOBO)
-				{
-					Nslice = slice;
-				}
-				std::vector<float> smooth_faces;
-				Vessel veinV(Nslice, vein_voxels[i], smooth_faces);
-				vein_smooth_faces[i] = (smooth_faces);
-				smooth_faces.clear();
-				Vessel arteryV(Nslice, artery_voxels[i], smooth_faces);
-				artery_smooth_faces[i] = (smooth_faces);
-				smooth_faces.clear();
-				Vessel microV(Nslice, micro_voxels[i], smooth_faces);
-				micro_smooth_faces[i] = (smooth_faces);
-				std::cout << "ComboSlices: " << i << " Done!" << std::endl;
+				std::cout << "wrong: cannot write " << cache_file << std::endl;
 			}
 		}
-		else
+
+		//surfaces are meshed on demand, see window_surfaces() and
+		//slab_surfaces(); cut at every slice so that any slab can be assembled
+		std::vector<int> cuts;
+		for (int z = 0; z <= stack_size; z++)
 		{
-			int Nslice = slice;
-			std::vector<float> smooth_faces;
-			Vessel veinV(Nslice, vein_voxels[0], smooth_faces);
-			vein_smooth_faces.push_back(smooth_faces);
-			smooth_faces.clear();
-			Vessel arteryV(Nslice, artery_voxels[0], smooth_faces);
-			artery_smooth_faces.push_back(smooth_faces);
-			smooth_faces.clear();
-			Vessel microV(Nslice, micro_voxels[0], smooth_faces);
-			micro_smooth_faces.push_back(smooth_faces);
-			std::cout << "ComboSlices: Done!" << std::endl;
+			cuts.push_back(z);
 		}
+		//the last window is the whole volume, every window is cut out of it
+		stack = new Vessel(dims, vein_voxels.back(), artery_voxels.back(), micro_voxels.back(), cuts);
+		step(1);
 	}
 
-	~CompoundLayers() {}
+	//a step per slice and one for the volume
+	static int load_steps(const ComboLayout &layout_) {
+		return layout_.total_slices + 1;
+	}
+
+	~CompoundLayers() {
+		delete stack;
+	}
+
+	int nb_windows() const {
+		return BComboSlice ? layout.nb_combo + 1 : 1;
+	}
 
-	std::vector<std::vector<PixelVessel>> get_vein()
+	int nb_slices() const {
+		return stack_size;
+	}
+
+	//meshes window i, safe to call while slab_surfaces() runs on another
+	//thread; stride > 1 for a coarse preview, see Vessel::preview_surfaces()
+	void window_surfaces(int i, int stride, IndexedMesh &vein_surface, IndexedMesh &artery_surface,
+		IndexedMesh &micro_surface) {
+		int z_from, z_to;
+		window_range(i, z_from, z_to);
+		if (stride > 1)
+		{
+			stack->preview_surfaces(stride, z_from, z_to, window_slices(i), vein_surface, artery_surface, micro_surface);
+			return;
+		}
+		stack->window_surfaces(z_from, z_to, window_slices(i), vein_surface, artery_surface, micro_surface);
+	}
+
+	//surfaces of the whole stack to <path><label><extension>, one file per
+	//label written side by side, format by extension (see MeshStreamWriter)
+	bool save_surfaces(const std::string &extension) {
+		IndexedMesh surfaces[3];
+		const char *names[3];
+		names[VEIN] = "vein";
+		names[ARTERY] = "artery";
+		names[MICRO] = "micro";
+		bool saved[3] = { false, false, false };
+		task_pool().run([&] {
+			slab_surfaces(0, stack_size, surfaces[VEIN], surfaces[ARTERY], surfaces[MICRO]);
+			task_parallel_for(0, 3, [&](GEO::index_t l) {
+				saved[l] = MeshStreamWriter::write(surfaces[l], inpath + names[l] + extension);
+			});
+		});
+		for (int l = 0; l < 3; l++)
+		{
+			if (!saved[l])
+			{
+				std::cout << "wrong: cannot write " << inpath + names[l] + extension << std::endl;
+			}
+		}
+		return saved[0] && saved[1] && saved[2];
+	}
+
+	//meshes slices [z_from, z_to) of the stack where they are in the whole volume
+	void slab_surfaces(int z_from, int z_to, IndexedMesh &vein_surface, IndexedMesh &artery_surface,
+		IndexedMesh &micro_surface) {
+		z_from = std::max(z_from, 0);
+		z_to = std::min(z_to, stack_size);
+		stack->window_surfaces(z_from, z_to, dims.slice, vein_surface, artery_surface, micro_surface);
+	}
+
+	const std::vector<std::vector<PixelVessel>>& get_vein() const
 	{
 		return vein_voxels;
 	}
 
-	std::vector<std::vector<PixelVessel>> get_artery()
+	const std::vector<std::vector<PixelVessel>>& get_artery() const
 	{
 		return artery_voxels;
 	}
 
-	std::vector<std::vector<PixelVessel>> get_micro()
+	const std::vector<std::vector<PixelVessel>>& get_micro() const
 	{
 		return micro_voxels;
 	}
 
-	std::vector<std::vector<float>> get_vein_smooth_faces()
+	//centers and corners of the voxels of window i, for the point and hexahedron modes
+	VoxelGeometry window_geometry(int i) const
 	{
-		return vein_smooth_faces;
+		return Vessel::voxel_geometry(dims, window_slices(i));
 	}
 
-	std::vector<std::vector<float>> get_artery_smooth_faces()
+	const StackDims& get_dims() const
 	{
-		return artery_smooth_faces;
+		return dims;
 	}
 
-	std::vector<std::vector<float>> get_micro_smooth_faces()
+	const ComboLayout& get_layout() const
 	{
-		return micro_smooth_faces;
+		return layout;
+	}
+
+	void load_allimages(const std::vector<QString> &veinmask_files,
+		const std::vector<QString> &arterymask_files,
+		const std::vector<QString> &micromask_files);
+
+	void build_windows(const std::vector<std::vector<PixelVessel>> &vein_all,
+		const std::vector<std::vector<PixelVessel>> &artery_all,
+		const std::vector<std::vector<PixelVessel>> &micro_all);
+
+	//grows vein and artery into micro pixels, expand_level rings of 8-connected
+	//neighbours with vein first in each ring, and appends what they gained
+	void preprocess_vessel(const SliceMask &vein_mask, const SliceMask &artery_mask,
+		const SliceMask &micro_mask, int z, std::vector<PixelVessel> &vein_slice,
+		std::vector<PixelVessel> &artery_slice) {
+		SliceMask vein_added, artery_added;
+		expand_labels(vein_mask, artery_mask, micro_mask, expand_level, vein_added, artery_added);
+		append_voxels(vein_added, z, vein_slice);
+		append_voxels(artery_added, z, artery_slice);
 	}
 
-	void load_allimages();
+private:
+	//everything the cached volume and surfaces depend on
+	uint64_t cache_key(const std::vector<QString> &veinmask_files,
+		const std::vector<QString> &arterymask_files,
+		const std::vector<QString> &micromask_files) {
+		CacheKey key;
+		add_mask_files_key(key, veinmask_files);
+		add_mask_files_key(key, arterymask_files);
+		add_mask_files_key(key, micromask_files);
+		key.add(expand_level);
+		key.add(int(BComboSlice));
+		key.add(layout.slice_internal);
+		key.add(layout.nb_combo);
+		key.add(layout.va_from);
+		key.add(layout.va_to);
+		key.add(double(IMAGEWIDTHSIZE));
+		key.add(dims.spacing.x);
+		key.add(dims.spacing.y);
+		key.add(dims.spacing.z);
+		key.add(int(MERGE_FACES));
+		key.add(int(SMOOTH_SURFACES));
+		key.add(int(TAUBIN_ITERATIONS));
+		return key.value();
+	}
 
-	void preprocess_vessel(std::vector<PixelVessel> &vein_slice,
-	std::vector<PixelVessel> &artery_slice,std::vector<PixelVessel> &micro_slice) {
+	int window_slices(int i) const {
+		return (BComboSlice && i != layout.nb_combo) ? layout.slice_internal : dims.slice;
+	}
 
-		std::map<int, ExpandVessel> map_vessel_voxels;
-		for (auto it = micro_slice.begin(); it != micro_slice.end(); it++)
+	//slices [z_from, z_to) of window i, clipped to the stack
+	void window_range(int i, int &z_from, int &z_to) const {
+		if (!BComboSlice || i == layout.nb_combo)
 		{
-			ExpandVessel ev; ev.index_ = it->index_;
-			ev.vessel_type = MICRO; ev.x = it->x; ev.y = it->y; ev.z = it->z;
-			map_vessel_voxels[it->index_] = ev;
+			z_from = 0;
+			z_to = stack_size;
+			return;
 		}
-		for (auto it = vein_slice.begin();it != vein_slice.end();it++)
+		z_from = std::min(i * (layout.slice_internal / 2), stack_size);
+		z_to = std::min(i * (layout.slice_internal / 2) + layout.slice_internal, stack_size);
+	}
+
+	//restores the cropped labels, surfaces are not cached as windows are meshed on demand
+	bool load_cache(const std::string &file, uint64_t key) {
+		VolumeCache cache;
+		if (!cache.load(file, key) || cache.labels.size() != 3 || !cache.surfaces.empty())
 		{
-			ExpandVessel ev; ev.index_ = it->index_;
-			ev.vessel_type = VEIN; ev.x = it->x; ev.y = it->y; ev.z = it->z;
-			map_vessel_voxels[it->index_] = ev;
+			return false;
 		}
-		for (auto it = artery_slice.begin(); it != artery_slice.end(); it++)
+		dims.width = cache.width;
+		dims.height = cache.height;
+		dims.slice = cache.slice;
+		dims.min_x = cache.min_x;
+		dims.min_y = cache.min_y;
+		stack_size = cache.labels[0].size_z();
+
+		std::vector<std::vector<PixelVessel>> vein_all, artery_all, micro_all;
+		grid_to_slices(cache.labels[0], vein_all);
+		grid_to_slices(cache.labels[1], artery_all);
+		grid_to_slices(cache.labels[2], micro_all);
+		build_windows(vein_all, artery_all, micro_all);
+
+		return true;
+	}
+
+	//the last window is the whole cropped volume
+	bool save_cache(const std::string &file, uint64_t key) {
+		if (vein_voxels.empty())
 		{
-			ExpandVessel ev; ev.index_ = it->index_;
-			ev.vessel_type = ARTERY; ev.x = it->x; ev.y = it->y; ev.z = it->z;
-			map_vessel_voxels[it->index_] = ev;
-		}	
-
-		std::vector<PixelVessel> vein_temp = vein_slice;
-		std::vector<PixelVessel> arte_temp = artery_slice;
-		for (int i = 0;i<expand_level;i++)
-		{			
-			expand_cuslice(vein_temp,map_vessel_voxels,VEIN);
-			for (auto it = vein_temp.begin();it != vein_temp.end();it++)
-			{
-				vein_slice.push_back(*it);
-			}
-			expand_cuslice(arte_temp, map_vessel_voxels, ARTERY);
-			for (auto it = arte_temp.begin(); it != arte_temp.end(); it++)
-			{
-				artery_slice.push_back(*it);
-			}
+			return false;
 		}
+		VolumeCache cache;
+		cache.width = dims.width;
+		cache.height = dims.height;
+		cache.slice = dims.slice;
+		cache.min_x = dims.min_x;
+		cache.min_y = dims.min_y;
+		cache.labels.resize(3);
+		voxels_to_grid(vein_voxels.back(), cache.labels[0]);
+		voxels_to_grid(artery_voxels.back(), cache.labels[1]);
+		voxels_to_grid(micro_voxels.back(), cache.labels[2]);
+		return cache.save(file, key);
 	}
 
-	void expand_cuslice(std::vector<PixelVessel> &vessel_slice,
-		std::map<int, ExpandVessel> &map_vessel_voxels,int type_) {
-
-		if (vessel_slice.empty())
+	void voxels_to_grid(const std::vector<PixelVessel> &voxels, OccupancyGrid &grid) {
+		grid.resize(dims.width, dims.height, stack_size);
+		for (int i = 0; i < voxels.size(); i++)
 		{
-			return;
+			grid.set(voxels[i].x, voxels[i].y, voxels[i].z);
 		}
+	}
 
-		int z_id = vessel_slice.begin()->z;
-		std::set<std::pair<int,int>> new_added;
-		for (auto it = vessel_slice.begin(); it != vessel_slice.end(); it++)
-		{		
-			int plusx = it->index_ + height;
-			auto res = map_vessel_voxels.find(plusx);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{			
-				new_added.insert(std::pair<int,int>(it->x + 1, it->y));
-				res->second.vessel_type = type_;
-			}
-			int plus_x = it->index_ - height;
-			res = map_vessel_voxels.find(plus_x);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x - 1, it->y));
-				res->second.vessel_type = type_;
-			}
-			int plusy = it->index_ + 1;
-			res = map_vessel_voxels.find(plusy);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x, it->y+1));
-				res->second.vessel_type = type_;
-			}
-			int plus_y = it->index_ - 1;
-			res = map_vessel_voxels.find(plus_y);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x, it->y - 1));
-				res->second.vessel_type = type_;
-			}
-			int plusxy = it->index_ + height + 1;
-			res = map_vessel_voxels.find(plusxy);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x+1, it->y + 1));
-				res->second.vessel_type = type_;
-			}
-			int plusx_y = it->index_ + height - 1;
-			res = map_vessel_voxels.find(plusx_y);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x + 1, it->y - 1));
-				res->second.vessel_type = type_;
-			}
-			int plus_xy = it->index_ - height + 1;
-			res = map_vessel_voxels.find(plus_xy);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x - 1, it->y + 1));
-				res->second.vessel_type = type_;
-			}
-			int plus_x_y = it->index_ - height - 1;
-			res = map_vessel_voxels.find(plus_x_y);
-			if (res != map_vessel_voxels.end() && res->second.vessel_type == MICRO)
-			{
-				new_added.insert(std::pair<int, int>(it->x - 1, it->y - 1));
-				res->second.vessel_type = type_;
-			}			
+	void grid_to_slices(const OccupancyGrid &grid, std::vector<std::vector<PixelVessel>> &slices) {
+		slices.assign(grid.size_z(), std::vector<PixelVessel>());
+		grid.for_each_voxel([&](int x, int y, int z) {
+			PixelVessel v; v.x = x; v.y = y; v.z = z;
+			v.index_ = dims.voxel_index(x, y, z);
+			slices[z].push_back(v);
+		});
+	}
+
+	void crop_voxels(std::vector<PixelVessel> &voxels, int min_x, int min_y) {
+		for (int i = 0; i < voxels.size(); i++)
+		{
+			voxels[i].x -= min_x;
+			voxels[i].y -= min_y;
+			voxels[i].index_ = dims.voxel_index(voxels[i].x, voxels[i].y, voxels[i].z);
 		}
-	
-		vessel_slice.clear();
-		for (auto it = new_added.begin();it != new_added.end();it++)
+	}
+
+	//foreground pixels of a decoded mask, indexed with the full image size
+	void append_voxels(const SliceMask &mask, int z, std::vector<PixelVessel> &voxels) {
+		voxels.reserve(voxels.size() + mask.count());
+		mask.for_each_pixel([&](int x, int y) {
+			PixelVessel v; v.x = x; v.y = y; v.z = z;
+			v.index_ = x * mask.height + y + z * mask.width * mask.height;
+			voxels.push_back(v);
+		});
+	}
+
+	void step(int n) {
+		if (progress != NULL)
 		{
-			PixelVessel newp; newp.x = it->first; newp.y = it->second;
-			newp.z = z_id;
-			newp.index_ = newp.x*height + newp.y + newp.z*width*height;
-			vessel_slice.push_back(newp);
+			*progress += n;
 		}
 	}
 
-private:
 	int expand_level;
+	ComboLayout layout;
+	std::atomic<int> *progress = NULL;
+	StackDims dims;//set once the load is done
+	int stack_size = 0;//slices of the mask stack
 	std::string inpath;
 	std::vector<std::vector<PixelVessel>> vein_voxels;
 	std::vector<std::vector<PixelVessel>> artery_voxels;
 	std::vector<std::vector<PixelVessel>> micro_voxels;
 
-	std::vector<std::vector<float>> vein_smooth_faces;
-	std::vector<std::vector<float>> artery_smooth_faces;
-	std::vector<std::vector<float>> micro_smooth_faces;
+	Vessel *stack = NULL;
 };
 
-void CompoundLayers::load_allimages()
+void CompoundLayers::load_allimages(const std::vector<QString> &veinmask_files,
+	const std::vector<QString> &arterymask_files,
+	const std::vector<QString> &micromask_files)
 {
 	int file_size_ = 0;
-	//VEIN
-	std::vector<std::string> veinmaskfile;
-	std::vector<std::pair<QString, int>>	veinmask_files;
-	getFiles(inpath + "vein/*.png", veinmaskfile);
-	for (int i = 0; i < veinmaskfile.size(); i++)
-	{
-		QString filename_ = QString::fromStdString(veinmaskfile[i]);
-		int index = filename_.split("/").last().split(".").at(0).split("_").last().toInt();
-		QString fullname = QString::fromStdString(inpath);
-		fullname.append("vein/");
-		fullname.append(filename_);
-		veinmask_files.push_back(std::pair<QString, int>(fullname, index));
-	}
-	sort(veinmask_files.begin(), veinmask_files.end(), sort_qstringpair_secondgreater);
-
-	//artery
-	std::vector<std::string> arterymaskfile;
-	std::vector<std::pair<QString, int>>	arterymask_files;
-	getFiles(inpath + "artery/*.png", arterymaskfile);
-	for (int i = 0; i < arterymaskfile.size(); i++)
-	{
-		QString filename_ = QString::fromStdString(arterymaskfile[i]);
-		int index = filename_.split("/").last().split(".").at(0).split("_").last().toInt();
-		QString fullname = QString::fromStdString(inpath);
-		fullname.append("artery/");
-		fullname.append(filename_);
-		arterymask_files.push_back(std::pair<QString, int>(fullname, index));
-	}
-	sort(arterymask_files.begin(), arterymask_files.end(), sort_qstringpair_secondgreater);
-
-	//micro
-	std::vector<std::string> micromaskfile;
-	std::vector<std::pair<QString, int>>	micromask_files;
-	getFiles(inpath + "micro/*.png", micromaskfile);
-	for (int i = 0; i < micromaskfile.size(); i++)
-	{
-		QString filename_ = QString::fromStdString(micromaskfile[i]);
-		int index = filename_.split("/").last().split(".").at(0).split("_").last().toInt();
-		QString fullname = QString::fromStdString(inpath);
-		fullname.append("micro/");
-		fullname.append(filename_);
-		micromask_files.push_back(std::pair<QString, int>(fullname, index));
-	}
-	sort(micromask_files.begin(), micromask_files.end(), sort_qstringpair_secondgreater);
 
-	//size
-	if (veinmask_files.size() > 0)
-	{
-		QImage im_;
-		im_.load(veinmask_files[0].first);
-		width = std::max(width, im_.width());
-		height = std::max(height, im_.height());
-		slice = std::max(slice, int(veinmask_files.size()));
-	}
-	if (arterymask_files.size() > 0)
-	{
-		QImage im_;
-		im_.load(arterymask_files[0].first);
-		width = std::max(width, im_.width());
-		height = std::max(height, im_.height());
-		slice = std::max(slice, int(arterymask_files.size()));
-	}
-	if (micromask_files.size() > 0)
-	{
-		QImage im_;
-		im_.load(micromask_files[0].first);
-		width = std::max(width, im_.width());
-		height = std::max(height, im_.height());
-		slice = std::max(slice, int(micromask_files.size()));
-	}
+	//the slice workers only read the files, what they find goes to their
+	//own slice and is reduced once they are done
+	StackDims load;
+	load.spacing = dims.spacing;
+	load.add_mask_files(veinmask_files);
+	load.add_mask_files(arterymask_files);
+	load.add_mask_files(micromask_files);
 
 	file_size_ = arterymask_files.size() > 0 ? arterymask_files.size() : file_size_;
 	file_size_ = micromask_files.size() > file_size_ ? micromask_files.size() : file_size_;
@@ -304,136 +396,46 @@ void CompoundLayers::load_allimages()
 		std::cout << "wrong size: artery != vein" << std::endl;
 	}
 
-	int min_x = 10000, max_x = 0, min_y = 10000, max_y = 0;
+	//one worker per slice decodes the three masks of that slice and
+	//pre-processes them, voxels keep image coordinates until the crop
 	std::vector<std::vector<PixelVessel>> vein_all(file_size_), artery_all(file_size_), micro_all(file_size_);
-#pragma omp parallel for
+	std::vector<PixelBox> slice_box(file_size_);
+#pragma omp parallel for schedule(dynamic)
 	for (int i = 0; i < file_size_; i++)
 	{
 		std::vector<PixelVessel> vein_now, artery_now, micro_now;
+		SliceMask vein_mask, artery_mask, micro_mask;
 
 		if (file_size_ > veinmask_files.size() &&
-			i >= VA_FROM && i <= VA_TO ||
+			i >= layout.va_from && i <= layout.va_to ||
 			file_size_ == veinmask_files.size())
 		{
 			//vein
 			if (!veinmask_files.empty()) {
-				QImage im_;
-				im_.load(veinmask_files[i - VA_FROM].first);
-				width = im_.width();
-				height = im_.height();
-				int check_value;
-				if (qGray(im_.pixel(0, 0)) == 0)
-				{
-					check_value = 0;
-				}
-				else
-				{
-					check_value = 255;
-				}
-				for (int wid = 0; wid < im_.width(); wid++)
-				{
-					for (int hei = 0; hei < im_.height(); hei++)
-					{
-						int gray_ = qGray(im_.pixel(wid, im_.height() - 1 - hei));
-						if (gray_ != check_value)
-						{
-							min_x = wid < min_x ? wid : min_x;
-							min_y = hei < min_y ? hei : min_y;
-							max_x = wid > max_x ? wid : max_x;
-							max_y = hei > max_y ? hei : max_y;
-
-							PixelVessel v; v.x = wid; v.y = hei; v.z = i;
-							int index = wid * im_.height() + hei + i * im_.width() * im_.height();
-							v.index_ = index;
-							vein_now.push_back(v);
-						}
-					}
-				}
+				decode_mask_slice(veinmask_files[i - layout.va_from], vein_mask);
+				append_voxels(vein_mask, i, vein_now);
+				slice_box[i].merge(vein_mask.box);
 			}
 			//artery
 			if (!arterymask_files.empty()) {
-				QImage im_a;
-				im_a.load(arterymask_files[i - VA_FROM].first);
-				int check_valuea;
-				if (qGray(im_a.pixel(0, 0)) == 0)
-				{
-					check_valuea = 0;
-				}
-				else
-				{
-					check_valuea = 255;
-				}
-				for (int wid = 0; wid < im_a.width(); wid++)
-				{
-					for (int hei = 0; hei < im_a.height(); hei++)
-					{
-						int gray_ = qGray(im_a.pixel(wid, im_a.height() - 1 - hei));
-						if (gray_ != check_valuea)
-						{
-							min_x = wid < min_x ? wid : min_x;
-							min_y = hei < min_y ? hei : min_y;
-							max_x = wid > max_x ? wid : max_x;
-							max_y = hei > max_y ? hei : max_y;
-
-							PixelVessel v; v.x = wid; v.y = hei; v.z = i;
-							int index = wid * im_a.height() + hei + i * im_a.width() * im_a.height();
-							v.index_ = index;
-							artery_now.push_back(v);
-						}
-					}
-				}
+				decode_mask_slice(arterymask_files[i - layout.va_from], artery_mask);
+				append_voxels(artery_mask, i, artery_now);
+				slice_box[i].merge(artery_mask.box);
 			}
 		}
 
 		//micro
-		QImage im_m;
-		im_m.load(micromask_files[i].first);
-		int check_valuem;
-		if (qGray(im_m.pixel(0, 0)) == 0)
-		{
-			check_valuem = 0;
-		}
-		else
-		{
-			check_valuem = 255;
-		}
-		for (int wid = 0; wid < im_m.width(); wid++)
-		{
-			for (int hei = 0; hei < im_m.height(); hei++)
-			{
-				int gray_ = qGray(im_m.pixel(wid, im_m.height() - 1 - hei));
-				if (gray_ != check_valuem)
-				{
-					min_x = wid < min_x ? wid : min_x;
-					min_y = hei < min_y ? hei : min_y;
-					max_x = wid > max_x ? wid : max_x;
-					max_y = hei > max_y ? hei : max_y;
-
-					PixelVessel v; v.x = wid; v.y = hei; v.z = i;
-					int index = wid * im_m.height() + hei + i * im_m.width() * im_m.height();
-					v.index_ = index;
-					micro_now.push_back(v);
-				}
-			}
+		if (i < micromask_files.size()) {
+			decode_mask_slice(micromask_files[i], micro_mask);
+			append_voxels(micro_mask, i, micro_now);
+			slice_box[i].merge(micro_mask.box);
 		}
 
 		//pre-process vessel
-		std::vector<PixelVessel> vein_temp, artery_temp, micro_temp;
-		vein_temp = vein_now;
-		artery_temp = artery_now;
-		micro_temp = micro_now;
 		if (!veinmask_files.empty()) {
 			if (arterymask_files.size() == veinmask_files.size())
 			{
-				preprocess_vessel(vein_temp, artery_now, micro_now);
-				for (auto it = vein_temp.begin(); it != vein_temp.end(); it++)
-				{
-					vein_now.push_back(*it);
-				}
-				for (auto it = artery_temp.begin(); it != artery_temp.end(); it++)
-				{
-					artery_now.push_back(*it);
-				}
+				preprocess_vessel(vein_mask, artery_mask, micro_mask, i, vein_now, artery_now);
 			}
 			else
 			{
@@ -443,93 +445,41 @@ void CompoundLayers::load_allimages()
 		vein_all[i] = vein_now;
 		artery_all[i] = artery_now;
 		micro_all[i] = micro_now;
+		step(1);
 	}
-	width = max_x - min_x + 1;
-	height = max_y - min_y + 1;
 
-	min_pos = std::pair<int, int>(min_x, min_y);
-
-	std::vector<PixelVessel> vein_whole, artery_whole, micro_whole;
-	for (int k = 0; k < vein_all.size(); k++)
+	load.crop_to(slice_box);
+	dims = load;
+	for (int k = 0; k < file_size_; k++)
 	{
-		for (int i = 0; i < vein_all[k].size(); i++)
-		{
-			PixelVessel newp = vein_all[k][i];
-			newp.x -= min_x;
-			newp.y -= min_y;
-			newp.index_ = newp.x * height + newp.y + newp.z * width * height;
-			vein_all[k][i] = newp;
-			vein_whole.push_back(newp);
-		}
-	}
-	for (int k = 0; k < artery_all.size(); k++)
-	{
-		for (int i = 0; i < artery_all[k].size(); i++)
-		{
-			PixelVessel newp = artery_all[k][i];
-			newp.x -= min_x;
-			newp.y -= min_y;
-			newp.index_ = newp.x * height + newp.y + newp.z * width * height;
-			artery_all[k][i] = newp;
-			artery_whole.push_back(newp);
-		}
-	}
-	for (int k = 0; k < micro_all.size(); k++)
-	{
-		for (int i = 0; i < micro_all[k].size(); i++)
-		{
-			PixelVessel newp = micro_all[k][i];
-			newp.x -= min_x;
-			newp.y -= min_y;
-			newp.index_ = newp.x * height + newp.y + newp.z * width * height;
-			micro_all[k][i] = newp;
-			micro_whole.push_back(newp);
-		}
+		crop_voxels(vein_all[k], dims.min_x, dims.min_y);
+		crop_voxels(artery_all[k], dims.min_x, dims.min_y);
+		crop_voxels(micro_all[k], dims.min_x, dims.min_y);
 	}
+	stack_size = file_size_;
+	build_windows(vein_all, artery_all, micro_all);
+
+	std::cout << "load images done!!!" << std::endl;
+}
 
-	if (BComboSlice)
+//combo windows plus the whole volume as the last one, slices already cropped
+void CompoundLayers::build_windows(const std::vector<std::vector<PixelVessel>> &vein_all,
+	const std::vector<std::vector<PixelVessel>> &artery_all,
+	const std::vector<std::vector<PixelVessel>> &micro_all)
+{
+	vein_voxels.assign(nb_windows(), std::vector<PixelVessel>());
+	artery_voxels.assign(nb_windows(), std::vector<PixelVessel>());
+	micro_voxels.assign(nb_windows(), std::vector<PixelVessel>());
+	for (int i = 0; i < nb_windows(); i++)
 	{
-		vein_voxels.resize(NCOMOBO + 1);
-		artery_voxels.resize(NCOMOBO + 1);
-		micro_voxels.resize(NCOMOBO + 1);
-		for (int i = 0; i < NCOMOBO; i++)
+		int z_from, z_to;
+		window_range(i, z_from, z_to);
+		for (int k = z_from; k < z_to; k++)
 		{
-			{
-				int internal_ = SLICE_INTERNAL, break_ = SLICE_INTERNAL / 2;
-				for (int k = i * break_; k < i * break_ + internal_; k++)
-				{
-					if (k < vein_all.size()) {
-						for (auto it = vein_all[k].begin(); it != vein_all[k].end(); it++)
-						{
-							vein_voxels[i].push_back(*it);
-						}
-					}
-					if (k < artery_all.size()) {
-						for (auto it = artery_all[k].begin(); it != artery_all[k].end(); it++)
-						{
-							artery_voxels[i].push_back(*it);
-						}
-					}
-					if (k < micro_all.size()) {
-						for (auto it = micro_all[k].begin(); it != micro_all[k].end(); it++)
-						{
-							micro_voxels[i].push_back(*it);
-						}
-					}
-				}
-			}
+			vein_voxels[i].insert(vein_voxels[i].end(), vein_all[k].begin(), vein_all[k].end());
+			artery_voxels[i].insert(artery_voxels[i].end(), artery_all[k].begin(), artery_all[k].end());
+			micro_voxels[i].insert(micro_voxels[i].end(), micro_all[k].begin(), micro_all[k].end());
 		}
-		vein_voxels[NCOMOBO] = vein_whole;
-		artery_voxels[NCOMOBO] = artery_whole;
-		micro_voxels[NCOMOBO] = micro_whole;
-	}
-	else
-	{
-		vein_voxels.push_back(vein_whole);
-		artery_voxels.push_back(artery_whole);
-		micro_voxels.push_back(micro_whole);
 	}
-
-	std::cout << "load images done!!!" << std::endl;
 }
 
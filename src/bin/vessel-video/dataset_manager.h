@@ -0,0 +1,115 @@
+#pragma once
+#ifndef _DATASET_MANAGER_
+#define _DATASET_MANAGER_
+
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "compound_layers.h"
+
+//one mask directory, loaded on its own thread and then kept resident
+struct Dataset
+{
+	std::string path;
+	ComboLayout layout;
+	std::unique_ptr<CompoundLayers> layers;//only read once ready
+	std::atomic<int> done_steps;
+	int nb_steps = 0;
+	std::atomic<bool> ready;
+	bool save = false;//surfaces written next to the masks before it is ready
+	std::thread loader;
+
+	Dataset() : done_steps(0), ready(false) {}
+};
+
+//Loads mask directories in the background, one thread each, and keeps
+//every loaded one. A loader only writes its own Dataset and the viewer
+//only reads it once ready() is set, so nothing is shared while it runs;
+//the viewer keeps drawing the dataset it has until the new one is ready.
+class DatasetManager
+{
+public:
+	//waits for the loads still running
+	~DatasetManager() {
+		for (int i = 0; i < datasets_.size(); i++)
+		{
+			if (datasets_[i]->loader.joinable())
+			{
+				datasets_[i]->loader.join();
+			}
+		}
+	}
+
+	//starts loading path and returns its index, the one already there
+	//when path was loaded before, -1 when its masks do not match; save
+	//writes the surfaces of the whole stack once loaded
+	int load(const std::string &path, bool save = false) {
+		for (int i = 0; i < datasets_.size(); i++)
+		{
+			if (datasets_[i]->path == path)
+			{
+				return i;
+			}
+		}
+		std::unique_ptr<Dataset> d(new Dataset);
+		if (!combo_layout(path, d->layout))
+		{
+			return -1;
+		}
+		d->path = path;
+		d->save = save;
+		d->nb_steps = CompoundLayers::load_steps(d->layout) + (save ? 1 : 0);
+		Dataset *p = d.get();
+		p->loader = std::thread([p] {
+			p->layers.reset(new CompoundLayers(EXPANDLEVEL, p->path, p->layout, &p->done_steps));
+			if (p->save)
+			{
+				p->layers->save_surfaces(SAVE_FILE_EXTENSION);
+				p->done_steps++;
+			}
+			p->ready = true;
+		});
+		datasets_.push_back(std::move(d));
+		return int(datasets_.size()) - 1;
+	}
+
+	int nb_datasets() const { return int(datasets_.size()); }
+
+	const Dataset& dataset(int i) const { return *datasets_[i]; }
+
+	//joins the loaders that are done, true when a dataset became ready
+	bool poll() {
+		bool any = false;
+		for (int i = 0; i < datasets_.size(); i++)
+		{
+			if (datasets_[i]->ready && datasets_[i]->loader.joinable())
+			{
+				datasets_[i]->loader.join();
+				any = true;
+			}
+		}
+		return any;
+	}
+
+	//steps of the loads still running, done and in total
+	void progress(int &done, int &total) const {
+		done = 0;
+		total = 0;
+		for (int i = 0; i < datasets_.size(); i++)
+		{
+			if (datasets_[i]->loader.joinable())
+			{
+				done += std::min(int(datasets_[i]->done_steps), datasets_[i]->nb_steps);
+				total += datasets_[i]->nb_steps;
+			}
+		}
+	}
+
+private:
+	std::vector<std::unique_ptr<Dataset>> datasets_;
+};
+
+#endif
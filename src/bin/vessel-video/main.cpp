@@ -45,7 +45,12 @@
 
 #include <geogram_gfx/gui/simple_application.h>
 #include <geogram_gfx/GLUP/GLUP_private.h>
+#include <geogram/basic/progress.h>
 #include "compound_layers.h"
+#include "dataset_manager.h"
+#include "surface_gfx.h"
+#include "voxel_gfx.h"
+#include "window_cache.h"
 
 namespace {
 
@@ -76,9 +81,18 @@ namespace {
 			directory_model = String::join_strings(out_, "/");
 
 			layers = NULL;
-			vein_faces = NULL;
-			artery_faces = NULL;
-			micro_faces = NULL;
+			all_vein_voxels = NULL;
+			all_artery_voxels = NULL;
+			all_micro_voxels = NULL;
+			shown_dataset = -1;
+			wanted_dataset = -1;
+			load_progress = NULL;
+			window_cache = NULL;
+			slab_mesher = NULL;
+			shown_window = -1;
+			slab_mode = false;
+			slab_from = 1;
+			slab_to = 1;
 
 			mesh_ = false;
 			point_size_ = 10.0f;
@@ -108,120 +122,221 @@ namespace {
 		}
 
 		~DemoGlupApplication() {
-			if (vein_faces)
-			{
-				delete vein_faces;
-				vein_faces = NULL;
-			}
-			if (artery_faces)
-			{
-				delete artery_faces;
-				artery_faces = NULL;
-			}
-			if (micro_faces)
-			{
-				delete micro_faces;
-				micro_faces = NULL;
-			}
-			if (layers)
-			{
-				delete layers;
-				layers = NULL;
-			}
+			//the workers mesh from layers, stop them first
+			delete window_cache;
+			window_cache = NULL;
+			delete slab_mesher;
+			slab_mesher = NULL;
+			delete load_progress;
+			load_progress = NULL;
 		}
 
 		/**
 		 * \copydoc SimpleApplication::GL_terminate()
 		 */
 		void GL_terminate() override {
+			release_surfaces();
 			SimpleApplication::GL_terminate();
 		}
 
-		void load_vessel(int load_type, std::string path_)
+		//windows are meshed on demand by a background thread, see WindowCache,
+		//and the free range of slices by another one, see SlabMesher; both
+		//hand the meshing to the task pool
+		void set_surfaces()
 		{
-			std::vector<std::string> micromaskfile;
-			getFiles(path_ + "micro/*.png", micromaskfile);
-			std::vector<std::string> veinmaskfile;
-			getFiles(path_ + "vein/*.png", veinmaskfile);
-			std::vector<std::string> artmaskfile;
-			getFiles(path_ + "artery/*.png", artmaskfile);
-
-			if (veinmaskfile.size() != artmaskfile.size())
+			release_surfaces();
+			CompoundLayers *layers_ = layers;
+			window_cache = new WindowCache(layers->nb_windows(), WINDOW_CACHE_BYTES,
+				[layers_](int i, int stride, WindowSurfaces &surfaces) {
+				surfaces.labels.resize(3);
+				task_pool().run([&] {
+					layers_->window_surfaces(i, stride, surfaces.labels[VEIN], surfaces.labels[ARTERY],
+						surfaces.labels[MICRO]);
+				});
+				if (stride == 1)
+				{
+					std::cout << "ComboSlices: " << i << " Done!" << std::endl;
+				}
+			}, WINDOW_PREVIEW_STRIDE);
+			slab_mesher = new SlabMesher([layers_](int z0, int z1, WindowSurfaces &surfaces) {
+				surfaces.labels.resize(3);
+				task_pool().run([&] {
+					layers_->slab_surfaces(z0, z1, surfaces.labels[VEIN], surfaces.labels[ARTERY],
+						surfaces.labels[MICRO]);
+				});
+			});
+			slab_from = 1;
+			slab_to = layers->nb_slices();
+			if (slab_mode)
+			{
+				request_slab();
+			}
+		}
+
+		void release_surfaces()
+		{
+			vein_gfx.GL_terminate();
+			artery_gfx.GL_terminate();
+			micro_gfx.GL_terminate();
+			vein_gfx.set_mesh(NULL);
+			artery_gfx.set_mesh(NULL);
+			micro_gfx.set_mesh(NULL);
+			shown_surfaces.reset();
+			shown_window = -1;
+			delete window_cache;
+			window_cache = NULL;
+			delete slab_mesher;
+			slab_mesher = NULL;
+		}
+
+		//shows the surfaces of current_comboslice once they are meshed, the
+		//previous window stays on screen meanwhile; coarse previews are
+		//shown until the full resolution replaces them
+		void update_shown_window()
+		{
+			if (slab_mode)
+			{
+				update_shown_slab();
+				return;
+			}
+			if (window_cache == NULL ||
+				(shown_window == current_comboslice && shown_surfaces->stride == 1))
 			{
-				GEO::Logger::err("I/O") << "Size of vein must be same with artery!!" << std::endl;
 				return;
 			}
-			Total_sclice = micromaskfile.size();
-			VA_FROM = 0;
-			VA_TO = Total_sclice - 1;
-			if (veinmaskfile.size() != micromaskfile.size() && !veinmaskfile.empty())
+			std::shared_ptr<const WindowSurfaces> surfaces = window_cache->get(current_comboslice);
+			if (surfaces && surfaces != shown_surfaces)
+			{
+				show_surfaces(surfaces);
+				shown_window = current_comboslice;
+			}
+			if (!surfaces || surfaces->stride > 1)
 			{
-				VA_FROM = (micromaskfile.size() - veinmaskfile.size()) / 2;
-				VA_TO = VA_FROM + veinmaskfile.size() - 1;
+				update();//keep redrawing until the worker is done
 			}
+		}
 
-			if (Total_sclice == 96)
+		//shows the latest slab meshed, the one of the current range may still
+		//be on its way
+		void update_shown_slab()
+		{
+			if (slab_mesher == NULL)
 			{
-				SLICE_INTERNAL = 24;
+				return;
 			}
-			else if (Total_sclice == 56)
+			int z0, z1;
+			std::shared_ptr<const WindowSurfaces> surfaces = slab_mesher->latest(z0, z1);
+			if (surfaces && surfaces != shown_surfaces)
 			{
-				SLICE_INTERNAL = 14;
+				show_surfaces(surfaces);
+				shown_window = -1;
 			}
-			else if (Total_sclice == 48)
+			if (z0 != slab_from - 1 || z1 != slab_to)
 			{
-				SLICE_INTERNAL = 12;
+				update();
 			}
-			else if (Total_sclice < 20)
+		}
+
+		void show_surfaces(const std::shared_ptr<const WindowSurfaces> &surfaces)
+		{
+			shown_surfaces = surfaces;
+			vein_gfx.set_mesh(&surfaces->labels[VEIN]);
+			artery_gfx.set_mesh(&surfaces->labels[ARTERY]);
+			micro_gfx.set_mesh(&surfaces->labels[MICRO]);
+			if (btest)
 			{
-				SLICE_INTERNAL = Total_sclice;
+				match_labels(surfaces->labels[MICRO]);
 			}
-			else if (Total_sclice < 35)
+		}
+
+		//meshes slices [slab_from, slab_to] (1-based) and picks their voxels out of the whole stack
+		void request_slab()
+		{
+			if (slab_mesher == NULL || all_vein_voxels == NULL || all_vein_voxels->empty())
 			{
-				SLICE_INTERNAL = Total_sclice / 2;
+				return;
 			}
-			else
-				SLICE_INTERNAL = Total_sclice / 4;
+			slab_mesher->request(slab_from - 1, slab_to);
+			slab_voxels(all_vein_voxels->back(), slab_vein_voxels);
+			slab_voxels(all_artery_voxels->back(), slab_artery_voxels);
+			slab_voxels(all_micro_voxels->back(), slab_micro_voxels);
+		}
 
-			for (int t = 0; t < Total_sclice - SLICE_INTERNAL;)
+		void slab_voxels(const std::vector<PixelVessel> &stack_voxels, std::vector<PixelVessel> &voxels)
+		{
+			voxels.clear();
+			for (int i = 0; i < stack_voxels.size(); i++)
 			{
-				NCOMOBO++;
-				t += SLICE_INTERNAL / 2;
+				if (stack_voxels[i].z >= slab_from - 1 && stack_voxels[i].z < slab_to)
+				{
+					voxels.push_back(stack_voxels[i]);
+				}
 			}
-			if (Total_sclice > SLICE_INTERNAL)
-				NCOMOBO++;
+		}
 
-			layers = new CompoundLayers(EXPANDLEVEL, path_);
-			all_vein_voxels = layers->get_vein();
-			all_artery_voxels = layers->get_artery();
-			all_micro_voxels = layers->get_micro();
+		//voxels of one label in the window or the slab shown
+		const std::vector<PixelVessel>& shown_voxels(const std::vector<std::vector<PixelVessel>> &windows,
+			const std::vector<PixelVessel> &slab) const
+		{
+			return slab_mode ? slab : windows[current_comboslice];
+		}
 
-			std::vector<std::vector<float>> vein_fs = layers->get_vein_smooth_faces();
-			std::vector<std::vector<float>> arte_fs = layers->get_artery_smooth_faces();
-			std::vector<std::vector<float>> mico_fs = layers->get_micro_smooth_faces();
+		//the slab is placed in the whole stack, the last window
+		const VoxelGeometry& shown_geometry() const
+		{
+			return slab_mode ? window_geometries.back() : window_geometries[current_comboslice];
+		}
 
-			vein_faces = new float* [vein_fs.size()];
-			artery_faces = new float* [arte_fs.size()];
-			micro_faces = new float* [mico_fs.size()];
-			for (int k = 0; k < vein_fs.size(); k++)
+		//micro vertices near a label pixel of the btest image are drawn white
+		void match_labels(const IndexedMesh &micro_surface)
+		{
+			double voxel_size = 2.0 * IMAGEWIDTHSIZE / layers->get_dims().width;
+			bchangecolor.assign(micro_surface.nb_vertices(), false);
+#pragma omp parallel for
+			for (int i = 0; i < micro_surface.nb_vertices(); i++)
 			{
-				vein_faces_size.push_back(vein_fs[k].size());
-				vein_faces[k] = new float[vein_faces_size[k]];
-				std::copy(vein_fs[k].begin(), vein_fs[k].end(), vein_faces[k]);
-
-				artery_faces_size.push_back(arte_fs[k].size());
-				artery_faces[k] = new float[artery_faces_size[k]];
-				std::copy(arte_fs[k].begin(), arte_fs[k].end(), artery_faces[k]);
+				double x = micro_surface.position(i)[0];
+				double y = micro_surface.position(i)[1];
+				Point_2 pt(x, y);
+				bool bc = false;
+				for (int t = 0; t < mylabels.size(); t++)
+				{
+					const Point_2 &pc = mylabels[t];
+					if (sqrt((pt - pc).squared_length()) < voxel_size)
+					{
+						bc = true;
+						break;
+					}
+				}
+				if (bc) {
+					bchangecolor[i] = true;
+				}
+			}
+			std::cout << "match done.\n";
+		}
 
-				micro_faces_size.push_back(mico_fs[k].size());
-				micro_faces[k] = new float[micro_faces_size[k]];
-				std::copy(mico_fs[k].begin(), mico_fs[k].end(), micro_faces[k]);
+		//draws dataset i from now on, it must be ready
+		void show_dataset(int i)
+		{
+			layers = datasets.dataset(i).layers.get();
+			shown_dataset = i;
+			nb_combo = layers->get_layout().nb_combo;
+			current_comboslice = std::min(current_comboslice, nb_combo);
+			all_vein_voxels = &layers->get_vein();
+			all_artery_voxels = &layers->get_artery();
+			all_micro_voxels = &layers->get_micro();
+			window_geometries.resize(all_vein_voxels->size());
+			for (int k = 0; k < window_geometries.size(); k++)
+			{
+				window_geometries[k] = layers->window_geometry(k);
 			}
 
-			image_wid = IMAGEWIDTHSIZE;
-			image_hei = IMAGEWIDTHSIZE / width * height;
-			image_sli = IMAGEWIDTHSIZE / width * slice * SCALEVOXEL;
+			set_surfaces();
 
+			const StackDims &dims = layers->get_dims();
+			Vessel::voxel_geometry(dims, dims.slice).half_size(image_wid, image_hei, image_sli);
+
+			mylabels.clear();
 			if (btest) {
 				//my test
 				QImage im_;
@@ -235,7 +350,7 @@ namespace {
 				{
 					check_value = 255;
 				}
-				double voxel_size = 2.0 * IMAGEWIDTHSIZE / width;
+				const VoxelGeometry stack_geometry = Vessel::voxel_geometry(dims, dims.slice);
 				for (int wid = 0; wid < im_.width(); wid++)
 				{
 					for (int hei = 0; hei < im_.height(); hei++)
@@ -243,40 +358,12 @@ namespace {
 						int gray_ = qGray(im_.pixel(wid, im_.height() - 1 - hei));
 						if (gray_ != check_value)
 						{
-							PixelVessel v; v.x = wid - min_pos.first; v.y = hei - min_pos.second; v.z = 0;
-							double cen_x = float(v.x) / float(width - 1) * (2.0 * image_wid - voxel_size)
-								- image_wid + voxel_size / 2.0;
-							double cen_y = float(v.y) / float(height - 1) * (2.0 * image_hei - voxel_size)
-								- image_hei + voxel_size / 2.0;
-							v.center[0] = cen_x;
-							v.center[1] = cen_y;
-							mylabels.push_back(v);
+							double c[3];
+							stack_geometry.center(wid - dims.min_x, hei - dims.min_y, 0, c);
+							mylabels.push_back(Point_2(c[0], c[1]));
 						}
 					}
 				}
-				bchangecolor.resize(micro_faces_size[current_comboslice] / 6, false);
-#pragma omp parallel for
-				for (int i = 0; i < micro_faces_size[current_comboslice] / 6; i++)
-				{
-					double x = micro_faces[current_comboslice][6 * i + 3];
-					double y = micro_faces[current_comboslice][6 * i + 4];
-					Point_2 pt(x, y);
-					bool bc = false;
-					for (int t = 0; t < mylabels.size(); t++)
-					{
-						Point_2 pc(mylabels[t].center[0], mylabels[t].center[1]);
-						if (sqrt((pt - pc).squared_length()) < voxel_size)
-						{
-							bc = true;
-							break;
-						}
-					}
-					if (bc) {
-						bchangecolor[i] = true;
-						//std::cout << "1-";
-					}
-				}
-				std::cout << "match done.\n";
 			}
 
 			set_region_of_interest(-image_wid, -image_hei, -image_sli, image_wid, image_hei, image_sli);
@@ -308,9 +395,46 @@ namespace {
 			std::string inpath(input_configure_path);
 			if (load_type != -1 && inpath != "")
 			{
-				load_vessel(load_type, inpath);
+				int i = datasets.load(inpath, load_type == 1);
+				if (i >= 0)
+				{
+					wanted_dataset = i;
+				}
 				load_type = -1;
 			}
+			poll_datasets();
+		}
+
+		//reports the loads still running and swaps in the wanted dataset
+		//once it is ready, the shown one stays on screen until then
+		void poll_datasets()
+		{
+			datasets.poll();
+			int done, total;
+			datasets.progress(done, total);
+			if (total > 0)
+			{
+				if (load_progress == NULL)
+				{
+					load_progress = new ProgressTask("Load", index_t(total));
+				}
+				else if (load_progress->max_steps() != index_t(total))
+				{
+					load_progress->reset(index_t(total));
+				}
+				load_progress->progress(index_t(done));
+				update();//keep polling while loaders run
+			}
+			else if (load_progress != NULL)
+			{
+				delete load_progress;
+				load_progress = NULL;
+			}
+			if (wanted_dataset >= 0 && wanted_dataset != shown_dataset &&
+				datasets.dataset(wanted_dataset).ready)
+			{
+				show_dataset(wanted_dataset);
+			}
 		}
 
 		/**
@@ -327,18 +451,49 @@ namespace {
 			}
 			ImGui::Separator();*/
 
-			if (BComboSlice)
+			for (int i = 0; i < datasets.nb_datasets(); i++)
+			{
+				const Dataset &d = datasets.dataset(i);
+				if (d.ready)
+				{
+					ImGui::RadioButton(d.path.c_str(), &wanted_dataset, i);
+				}
+				else
+				{
+					ImGui::Text("%s (%d%%)", d.path.c_str(), 100 * int(d.done_steps) / std::max(d.nb_steps, 1));
+				}
+			}
+			if (datasets.nb_datasets() > 0)
 			{
+				ImGui::Separator();
+			}
+
+			if (layers != NULL)
+			{
+				if (ImGui::Checkbox("Range", &slab_mode) && slab_mode)
+				{
+					request_slab();
+				}
+				if (slab_mode && ImGui::DragIntRange2("Slices", &slab_from, &slab_to, 0.25f, 1,
+					layers->nb_slices(), "From: %d", "To: %d"))
+				{
+					request_slab();
+				}
+			}
+
+			if (BComboSlice && !slab_mode && layers != NULL)
+			{
+				const ComboLayout &layout = layers->get_layout();
 				int from_, to_;
-				ImGui::SliderInt("", &current_comboslice, 0, NCOMOBO, "");
-				if (current_comboslice == NCOMOBO) {
+				ImGui::SliderInt("", &current_comboslice, 0, nb_combo, "");
+				if (current_comboslice == nb_combo) {
 					from_ = 1;
-					to_ = Total_sclice;
+					to_ = layout.total_slices;
 				}
 				else
 				{
-					from_ = current_comboslice * (SLICE_INTERNAL / 2) + 1;
-					to_ = from_ + SLICE_INTERNAL - 1;
+					from_ = current_comboslice * (layout.slice_internal / 2) + 1;
+					to_ = from_ + layout.slice_internal - 1;
 				}
 
 				std::string slice_range = "Slice: " + std::to_string(from_) + " to " + std::to_string(to_);
@@ -419,6 +574,8 @@ namespace {
 		 */
 		void draw_scene() override {
 
+			update_shown_window();
+
 			//glupSetSpecular(0.4f);
 
 			// GLUP can have different colors for frontfacing and
@@ -469,41 +626,20 @@ namespace {
 
 			case 0: {
 				glupSetPointSize(point_size_);
-				if (do_draw_vein && !all_vein_voxels.empty())
+				if (do_draw_vein && all_vein_voxels != NULL && !all_vein_voxels->empty())
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, vein_colors);
-					glupBegin(GLUP_POINTS);
-					for (int i = 0; i < all_vein_voxels[current_comboslice].size(); i++)
-					{
-						glupVertex3f(all_vein_voxels[current_comboslice][i].center[0],
-							all_vein_voxels[current_comboslice][i].center[1],
-							all_vein_voxels[current_comboslice][i].center[2]);
-					}
-					glupEnd();
+					draw_voxel_points(shown_voxels(*all_vein_voxels, slab_vein_voxels), shown_geometry());
 				}
-				if (do_draw_artery && !all_artery_voxels.empty())
+				if (do_draw_artery && all_artery_voxels != NULL && !all_artery_voxels->empty())
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, artery_colors);
-					glupBegin(GLUP_POINTS);
-					for (int i = 0; i < all_artery_voxels[current_comboslice].size(); i++)
-					{
-						glupVertex3f(all_artery_voxels[current_comboslice][i].center[0],
-							all_artery_voxels[current_comboslice][i].center[1],
-							all_artery_voxels[current_comboslice][i].center[2]);
-					}
-					glupEnd();
+					draw_voxel_points(shown_voxels(*all_artery_voxels, slab_artery_voxels), shown_geometry());
 				}
-				if (do_draw_micro && !all_micro_voxels.empty())
+				if (do_draw_micro && all_micro_voxels != NULL && !all_micro_voxels->empty())
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, micro_colors);
-					glupBegin(GLUP_POINTS);
-					for (int i = 0; i < all_micro_voxels[current_comboslice].size(); i++)
-					{
-						glupVertex3f(all_micro_voxels[current_comboslice][i].center[0],
-							all_micro_voxels[current_comboslice][i].center[1],
-							all_micro_voxels[current_comboslice][i].center[2]);
-					}
-					glupEnd();
+					draw_voxel_points(shown_voxels(*all_micro_voxels, slab_micro_voxels), shown_geometry());
 				}
 			} break;
 
@@ -513,37 +649,17 @@ namespace {
 				float specular_backup = glupGetSpecular();
 				glupSetSpecular(0.4f);
 
-				if (do_draw_vein && !vein_faces_size.empty())
+				if (do_draw_vein)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, vein_colors);
-					glupBegin(GLUP_TRIANGLES);
-					for (int i = 0; i < vein_faces_size[current_comboslice];)
-					{
-						glupNormal3d(vein_faces[current_comboslice][i],
-							vein_faces[current_comboslice][i + 1], vein_faces[current_comboslice][i + 2]);
-						i += 3;
-						glupVertex3d(vein_faces[current_comboslice][i],
-							vein_faces[current_comboslice][i + 1], vein_faces[current_comboslice][i + 2]);
-						i += 3;
-					}
-					glupEnd();
+					vein_gfx.draw();
 				}
-				if (do_draw_artery && !artery_faces_size.empty())
+				if (do_draw_artery)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, artery_colors);
-					glupBegin(GLUP_TRIANGLES);
-					for (int i = 0; i < artery_faces_size[current_comboslice];)
-					{
-						glupNormal3d(artery_faces[current_comboslice][i],
-							artery_faces[current_comboslice][i + 1], artery_faces[current_comboslice][i + 2]);
-						i += 3;
-						glupVertex3d(artery_faces[current_comboslice][i],
-							artery_faces[current_comboslice][i + 1], artery_faces[current_comboslice][i + 2]);
-						i += 3;
-					}
-					glupEnd();
+					artery_gfx.draw();
 				}
-				if (do_draw_micro && !micro_faces_size.empty())
+				if (do_draw_micro)
 				{
 					if (balpha)
 					{
@@ -553,27 +669,22 @@ namespace {
 
 					glupSetColor4fv(GLUP_FRONT_COLOR, micro_colors);
 					glupSetColor4fv(GLUP_BACK_COLOR, micro_backcolors);
-					glupBegin(GLUP_TRIANGLES);
-					for (int i = 0; i < micro_faces_size[current_comboslice]/6;i++)
-					{						
-						glupNormal3d(micro_faces[current_comboslice][6*i],
-							micro_faces[current_comboslice][6*i + 1], micro_faces[current_comboslice][6*i + 2]);
-						if (btest) {
-							if (bchangecolor[i])
+					if (btest) {
+						micro_gfx.draw_immediate([&](uint32_t v) {
+							if (v < bchangecolor.size() && bchangecolor[v])
 							{
 								glupColor3f(1, 1, 1);
 							}
 							else
 							{
-								glupColor3fv(
-									micro_colors
-								);
+								glupColor3fv(micro_colors);
 							}
-						}
-						glupVertex3d(micro_faces[current_comboslice][6*i+3],
-							micro_faces[current_comboslice][6*i + 4], micro_faces[current_comboslice][6*i + 5]);
+						});
+					}
+					else
+					{
+						micro_gfx.draw();
 					}
-					glupEnd();
 
 					glupDisable(GLUP_ALPHA_DISCARD);
 				}
@@ -583,49 +694,22 @@ namespace {
 
 			case 2: {
 
-				if (do_draw_vein && !all_vein_voxels.empty())
+				if (do_draw_vein && all_vein_voxels != NULL && !all_vein_voxels->empty())
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, vein_colors);
-					glupBegin(GLUP_HEXAHEDRA);
-					for (int i = 0; i < all_vein_voxels[current_comboslice].size(); i++)
-					{
-						PixelVessel p = all_vein_voxels[current_comboslice][i];
-						for (int k = 0; k < 8; k++)
-						{
-							glupVertex3f(p.corners_pts[k * 3], p.corners_pts[k * 3 + 1], p.corners_pts[k * 3 + 2]);
-						}
-					}
-					glupEnd();
+					draw_voxel_hexahedra(shown_voxels(*all_vein_voxels, slab_vein_voxels), shown_geometry());
 				}
-				if (do_draw_artery && !all_artery_voxels.empty())
+				if (do_draw_artery && all_artery_voxels != NULL && !all_artery_voxels->empty())
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, artery_colors);
-					glupBegin(GLUP_HEXAHEDRA);
-					for (int i = 0; i < all_artery_voxels[current_comboslice].size(); i++)
-					{
-						PixelVessel p = all_artery_voxels[current_comboslice][i];
-						for (int k = 0; k < 8; k++)
-						{
-							glupVertex3f(p.corners_pts[k * 3], p.corners_pts[k * 3 + 1], p.corners_pts[k * 3 + 2]);
-						}
-					}
-					glupEnd();
+					draw_voxel_hexahedra(shown_voxels(*all_artery_voxels, slab_artery_voxels), shown_geometry());
 				}
 
 				glupSetCellsShrink(shrink_);
-				if (do_draw_micro && !all_micro_voxels.empty())
+				if (do_draw_micro && all_micro_voxels != NULL && !all_micro_voxels->empty())
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, micro_colors);
-					glupBegin(GLUP_HEXAHEDRA);
-					for (int i = 0; i < all_micro_voxels[current_comboslice].size(); i++)
-					{
-						PixelVessel p = all_micro_voxels[current_comboslice][i];
-						for (int k = 0; k < 8; k++)
-						{
-							glupVertex3f(p.corners_pts[k * 3], p.corners_pts[k * 3 + 1], p.corners_pts[k * 3 + 2]);
-						}
-					}
-					glupEnd();
+					draw_voxel_hexahedra(shown_voxels(*all_micro_voxels, slab_micro_voxels), shown_geometry());
 				}
 				glupSetCellsShrink(0.0);
 
@@ -683,24 +767,38 @@ namespace {
 
 		//int expand_level;
 		static int current_comboslice;
+		static int nb_combo;//combo windows of the shown dataset
 
 		double image_wid, image_hei, image_sli;
 
-		CompoundLayers *layers;
+		DatasetManager datasets;
+		int shown_dataset;//-1 before the first one is ready
+		int wanted_dataset;//the one to show once it is ready
+		ProgressTask *load_progress;//while loaders run
+		CompoundLayers *layers;//of the shown dataset, owned by datasets
 
-		std::vector<std::vector<PixelVessel>> all_vein_voxels;
-		std::vector<std::vector<PixelVessel>> all_artery_voxels;
-		std::vector<std::vector<PixelVessel>> all_micro_voxels;
+		//owned by layers, NULL before the first dataset is shown
+		const std::vector<std::vector<PixelVessel>> *all_vein_voxels;
+		const std::vector<std::vector<PixelVessel>> *all_artery_voxels;
+		const std::vector<std::vector<PixelVessel>> *all_micro_voxels;
+		std::vector<VoxelGeometry> window_geometries;
 
-		std::vector<PixelVessel> mylabels;
+		std::vector<Point_2> mylabels;//label pixel centers of the btest image
 		std::vector<bool> bchangecolor;
 
-		float**			vein_faces;
-		vector<int>		vein_faces_size;
-		float**			artery_faces;
-		vector<int>		artery_faces_size;
-		float**			micro_faces;
-		vector<int>		micro_faces_size;
+		WindowCache *window_cache;
+		SlabMesher *slab_mesher;
+		bool slab_mode;//a free range of slices instead of the combo windows
+		int slab_from;//1-based, inclusive
+		int slab_to;
+		std::vector<PixelVessel> slab_vein_voxels;
+		std::vector<PixelVessel> slab_artery_voxels;
+		std::vector<PixelVessel> slab_micro_voxels;
+		std::shared_ptr<const WindowSurfaces> shown_surfaces;//drawn by the SurfaceGfx
+		int shown_window;
+		SurfaceGfx vein_gfx;
+		SurfaceGfx artery_gfx;
+		SurfaceGfx micro_gfx;
 
 		char input_configure_path[geo_imgui_string_length] = "";
 		std::string directory_model;
@@ -710,6 +808,7 @@ namespace {
 }
 
 int DemoGlupApplication::current_comboslice = 0;
+int DemoGlupApplication::nb_combo = 0;
 
 void DemoGlupApplication::decrement_comboId_callback()
 {
@@ -718,7 +817,7 @@ void DemoGlupApplication::decrement_comboId_callback()
 
 void DemoGlupApplication::increment_comboId_callback()
 {
-	current_comboslice = std::min(current_comboslice + 1, NCOMOBO);
+	current_comboslice = std::min(current_comboslice + 1, nb_combo);
 }
 
 int main(int argc, char** argv) {
@@ -33,14 +33,26 @@
 #include <CGAL/Polygon_mesh_processing/remesh.h>
 #include <CGAL/Polygon_mesh_processing/border.h>
 #include <CGAL/boost/graph/selection.h>
-#include <CGAL/Polygon_mesh_processing/compute_normal.h>
+
+#include "occupancy_grid.h"
+#include "mask_loader.h"
+#include "indexed_mesh.h"
+#include "vertex_normals.h"
+#include "brick_volume.h"
+#include "voxel_geometry.h"
+#include "label_surface.h"
+#include "mesh_smoothing.h"
+#include "mesh_stream.h"
 
 #define IMAGEWIDTHSIZE 0.5
-#define SCALEVOXEL 2.0
-#define SCALEMICRO 4.0
+#define SCALEVOXEL 2.0//slice thickness in pixels when the masks have no spacing.txt
 #define M_PI 3.1415926
 
 #define  SAVE_FILES 0
+#define MERGE_FACES 1//coplanar faces merged into rectangles, far fewer triangles
+#define SMOOTH_SURFACES 0//vertices placed on a surface net (see surface_nets.h), faces then not merged
+#define TAUBIN_ITERATIONS 0//Taubin smoothing passes (see mesh_smoothing.h), faces then not merged
+#define VOLUME_CACHE_FILE "vessel/vessel.vvox"
 
 int width = 0;
 int height = 0;
@@ -166,6 +178,7 @@ bool sort_qstringpair_secondgreater(std::pair<QString, int> p1, std::pair<QStrin
 	return p1.second < p2.second;
 }
 
+//hot data only: centers and corners come from VoxelGeometry when needed
 struct PixelVessel
 {
 	int x;//width
@@ -173,18 +186,6 @@ struct PixelVessel
 	int z;//slice
 
 	int index_;
-
-	double center[3] = {0,0,0};
-	bool xfacet = 1;//normal x plane;
-	bool x_facet = 1;//normal -xplane;
-	bool yfacet = 1;//normal y plane;
-	bool y_facet = 1;//normal -y plane;
-	bool zfacet = 1;//normal z plane;
-	bool z_facet = 1;//normal -z plane;
-	bool bvisited = false;
-
-	int corners[8];//-x-y-z:1; x-y-z:2; xyz:7; 
-	float corners_pts[24];//-x-y-z:1; x-y-z:2; xyz:7; 
 };
 
 class Vessel
@@ -195,216 +196,99 @@ public:
 
 	void exec()
 	{
-		load_allimages();
-		compute_pos_corners();
-		compute_surface(mapvein_voxels,vein_faces);
-		compute_surface(mapartery_voxels,artery_faces);
-		compute_surface(mapmicro_voxels, micro_faces);
-
-		std::cout << "pre-compute done!!!" << std::endl;
-		convert_save(veincorners_pts,vein_faces,"vessel/vein.obj");
-		convert_save(arterycorners_pts, artery_faces,"vessel/artery.obj");
-		convert_save(microcorners_pts, micro_faces, "vessel/micro.obj");
-
-		compute_normal(veincorners_pts, vein_faces,vein_normals,vein_smooth_faces);
-		compute_normal(arterycorners_pts, artery_faces, artery_normals,artery_smooth_faces);
-		compute_normal(microcorners_pts, micro_faces, micro_normals, micro_smooth_faces);
-		//subdivision(veincorners_pts, vein_faces);
-		//remesh(veincorners_pts, vein_faces);
-		//save(veincorners_pts, vein_faces, "vessel/smooth_vein.obj");
-		//subdivision(arterycorners_pts, artery_faces);
-		//remesh(arterycorners_pts, artery_faces);
-		//save(arterycorners_pts, artery_faces, "vessel/smooth_artery.obj");
+		std::vector<QString> veinmask_files = list_mask_files("vessel/vein/");
+		std::vector<QString> arterymask_files = list_mask_files("vessel/artery/");
+		std::vector<QString> micromask_files = list_mask_files("vessel/micro/");
+		spacing = VoxelSpacing(1.0, 1.0, SCALEVOXEL);
+		spacing.read("vessel/");
+
+		//everything the cached volume and surfaces depend on
+		CacheKey key;
+		add_mask_files_key(key, veinmask_files);
+		add_mask_files_key(key, arterymask_files);
+		add_mask_files_key(key, micromask_files);
+		key.add(double(IMAGEWIDTHSIZE));
+		key.add(spacing.x);
+		key.add(spacing.y);
+		key.add(spacing.z);
+		key.add(int(MERGE_FACES));
+		key.add(int(SMOOTH_SURFACES));
+		key.add(int(TAUBIN_ITERATIONS));
+
+		if (load_cache(VOLUME_CACHE_FILE, key.value()))
+		{
+			std::cout << "load volume cache done!!!" << std::endl;
+			return;
+		}
+
+		load_allimages(veinmask_files, arterymask_files, micromask_files);
+		compute_surfaces();
+
+		if (!save_cache(VOLUME_CACHE_FILE, key.value()))
+		{
+			std::cout << "wrong: cannot write " << VOLUME_CACHE_FILE << std::endl;
+		}
 	}
-	std::vector<PixelVessel> get_vein()
+	const std::vector<PixelVessel>& get_vein() const
 	{
 		return vein_voxels;
 	}
 
-	std::vector<PixelVessel> get_artery()
+	const std::vector<PixelVessel>& get_artery() const
 	{
 		return artery_voxels;
 	}
 
-	std::vector<PixelVessel> get_micro()
+	const std::vector<PixelVessel>& get_micro() const
 	{
 		return micro_voxels;
 	}
 
-	std::vector<float> get_vein_smooth_faces()
+	const IndexedMesh& get_vein_surface() const
 	{
-		return vein_smooth_faces;
+		return vein_surface;
 	}
 
-	std::vector<float> get_artery_smooth_faces()
+	const IndexedMesh& get_artery_surface() const
 	{
-		return artery_smooth_faces;
+		return artery_surface;
 	}
 
-	std::vector<float> get_micro_smooth_faces()
+	const IndexedMesh& get_micro_surface() const
 	{
-		return micro_smooth_faces;
+		return micro_surface;
 	}
 
-private:
-
-	void load_allimages()
+	//centers and corners of the voxels, for the point and hexahedron modes
+	VoxelGeometry voxel_geometry() const
 	{
-		int file_size_ = 0;
-		//VEIN
-		std::vector<std::string> veinmaskfile;
-		std::vector<std::pair<QString, int>>	veinmask_files;
-		getFiles("vessel/vein/*.png", veinmaskfile);
-		for (int i = 0; i < veinmaskfile.size(); i++)
-		{
-			QString filename_ = QString::fromStdString(veinmaskfile[i]);
-			int index = filename_.split("/").last().split(".").at(0).split("_").last().toInt();
-			QString fullname("vessel/vein/");
-			fullname.append(filename_);
-			veinmask_files.push_back(std::pair<QString, int>(fullname, index));
-		}
-		sort(veinmask_files.begin(), veinmask_files.end(), sort_qstringpair_secondgreater);
-
-		//artery
-		std::vector<std::string> arterymaskfile;
-		std::vector<std::pair<QString, int>>	arterymask_files;
-		getFiles("vessel/artery/*.png", arterymaskfile);
-		for (int i = 0; i < arterymaskfile.size(); i++)
-		{
-			QString filename_ = QString::fromStdString(arterymaskfile[i]);
-			int index = filename_.split("/").last().split(".").at(0).split("_").last().toInt();
-			QString fullname("vessel/artery/");
-			fullname.append(filename_);
-			arterymask_files.push_back(std::pair<QString, int>(fullname, index));
-		}
-		sort(arterymask_files.begin(), arterymask_files.end(), sort_qstringpair_secondgreater);
+		return VoxelGeometry(width, height, slice, IMAGEWIDTHSIZE, spacing);
+	}
 
-		//micro
-		std::vector<std::string> micromaskfile;
-		std::vector<std::pair<QString, int>>	micromask_files;
-		getFiles("vessel/micro/*.png", micromaskfile);
-		for (int i = 0; i < micromaskfile.size(); i++)
-		{
-			QString filename_ = QString::fromStdString(micromaskfile[i]);
-			int index = filename_.split("/").last().split(".").at(0).split("_").last().toInt();
-			QString fullname("vessel/micro/");
-			fullname.append(filename_);
-			micromask_files.push_back(std::pair<QString, int>(fullname, index));
-		}
-		sort(micromask_files.begin(), micromask_files.end(), sort_qstringpair_secondgreater);
+private:
 
+	void load_allimages(const std::vector<QString> &veinmask_files,
+		const std::vector<QString> &arterymask_files,
+		const std::vector<QString> &micromask_files)
+	{
 		//size
-		if (veinmask_files.size()>0)
+		if (veinmask_files.size() > 0)
 		{
-			QImage im_;
-			im_.load(veinmask_files[0].first);
-			width = im_.width();
-			height = im_.height();
+			read_mask_size(veinmask_files[0], width, height);
 			slice = veinmask_files.size();
 		}
 
-		file_size_ = arterymask_files.size() > 0 ? arterymask_files.size() : file_size_;
-		file_size_ = micromask_files.size() > 0 ? micromask_files.size() : file_size_;
-		file_size_ = veinmaskfile.size() > 0 ? veinmaskfile.size() : file_size_;
-
-		int min_x = 10000, max_x = 0, min_y = 10000, max_y = 0;
-		for (int i = 0; i < file_size_; i++)
+		PixelBox box;
+		load_label(veinmask_files, vein_voxels, box);
+		load_label(arterymask_files, artery_voxels, box);
+		load_label(micromask_files, micro_voxels, box);
+		if (box.empty())
 		{
-			//vein
-			QImage im_;
-			im_.load(veinmask_files[i].first);
-			int check_value;
-			if (qGray(im_.pixel(0, 0)) == 0)
-			{
-				check_value = 0;
-			}
-			else
-			{
-				check_value = 255;
-			}
-			for (int wid = 0; wid < im_.width(); wid++)
-			{
-				for (int hei = 0; hei < im_.height(); hei++)
-				{
-					int gray_ = qGray(im_.pixel(wid, im_.height() - 1 - hei));
-					if (gray_ != check_value)
-					{
-						min_x = wid < min_x ? wid : min_x;
-						min_y = hei < min_y ? hei : min_y;
-						max_x = wid > max_x ? wid : max_x;
-						max_y = hei > max_y ? hei : max_y;
-
-						PixelVessel v; v.x = wid; v.y = hei; v.z = i; 
-						vein_voxels.push_back(v);
-					}
-				}
-			}
-			//artery
-			QImage im_a;
-			im_a.load(arterymask_files[i].first);
-			int check_valuea;
-			if (qGray(im_a.pixel(0, 0)) == 0)
-			{
-				check_valuea = 0;
-			}
-			else
-			{
-				check_valuea = 255;
-			}
-			for (int wid = 0; wid < im_a.width(); wid++)
-			{
-				for (int hei = 0; hei < im_a.height(); hei++)
-				{
-					int gray_ = qGray(im_a.pixel(wid, im_a.height() - 1 - hei));
-					if (gray_ != check_valuea)
-					{
-						min_x = wid < min_x ? wid : min_x;
-						min_y = hei < min_y ? hei : min_y;
-						max_x = wid > max_x ? wid : max_x;
-						max_y = hei > max_y ? hei : max_y;
-
-						PixelVessel v; v.x = wid; v.y = hei; v.z = i; 
-						int index = wid*im_a.height() + hei + i*im_a.width()*im_a.height();
-						v.index_ = index;
-						artery_voxels.push_back(v);
-					}
-				}
-			}
-
-			//micro
-			QImage im_m;
-			im_m.load(micromask_files[i].first);
-			int check_valuem;
-			if (qGray(im_m.pixel(0, 0)) == 0)
-			{
-				check_valuem = 0;
-			}
-			else
-			{
-				check_valuem = 255;
-			}
-			for (int wid = 0; wid < im_m.width(); wid++)
-			{
-				for (int hei = 0; hei < im_m.height(); hei++)
-				{
-					int gray_ = qGray(im_m.pixel(wid, im_m.height() - 1 - hei));
-					if (gray_ != check_valuem)
-					{
-						min_x = wid < min_x ? wid : min_x;
-						min_y = hei < min_y ? hei : min_y;
-						max_x = wid > max_x ? wid : max_x;
-						max_y = hei > max_y ? hei : max_y;
-
-						PixelVessel v; v.x = wid; v.y = hei; v.z = i;
-						int index = wid*im_m.height() + hei + i*im_m.width()*im_m.height();
-						v.index_ = index;
-						micro_voxels.push_back(v);
-					}
-				}
-			}
+			box.add(0, 0);
 		}
-		width = max_x - min_x + 1;
-		height = max_y - min_y + 1;
+		int min_x = box.min_x, min_y = box.min_y;
+		width = box.width();
+		height = box.height();
 
 		for (int i = 0; i < vein_voxels.size(); i++)
 		{
@@ -427,382 +311,116 @@ private:
 			micro_voxels[i].index_ = micro_voxels[i].x*height +
 				micro_voxels[i].y + micro_voxels[i].z*width*height;
 		}
+
+		//labels 0,1,2: vein, artery, micro
+		label_bricks.resize(width, height, slice, 3);
+		label_bricks.insert_voxels(0, vein_voxels);
+		label_bricks.insert_voxels(1, artery_voxels);
+		label_bricks.insert_voxels(2, micro_voxels);
 		std::cout << "load images done!!!" << std::endl;
 	}
 
-	void compute_pos_corners() {
-		double image_wid = IMAGEWIDTHSIZE;
-		double image_hei = IMAGEWIDTHSIZE / width*height;
-		double image_sli = IMAGEWIDTHSIZE / width*slice*SCALEVOXEL;
-
-		double voxel_size_x = 2.0*IMAGEWIDTHSIZE / width;
-		double voxel_size_y = voxel_size_x;
-		double voxel_size_z = voxel_size_x*SCALEVOXEL;
-
-		for (int i = 0; i < vein_voxels.size(); i++)
-		{
-			PixelVessel p = vein_voxels[i];
-			double cen_x = float(p.x) / float(width - 1)*(2.0*image_wid - voxel_size_x)
-				- image_wid + voxel_size_x / 2.0;
-			double cen_y = float(p.y) / float(height - 1)*(2.0*image_hei - voxel_size_y)
-				- image_hei + voxel_size_y / 2.0;
-			double cen_z = float(p.z) / float(slice - 1)*(2.0*image_sli - voxel_size_z)
-				- image_sli + voxel_size_z / 2.0;
-			vein_voxels[i].center[0] = cen_x;
-			vein_voxels[i].center[1] = cen_y;
-			vein_voxels[i].center[2] = cen_z;
-
-			std::vector<std::vector<double>> ps = { 
-				{ cen_x - voxel_size_x / 2,cen_y - voxel_size_y / 2,cen_z - voxel_size_z / 2 },
-				{ cen_x + voxel_size_x / 2,cen_y - voxel_size_y / 2,cen_z - voxel_size_z / 2 },
-				{ cen_x + voxel_size_x / 2,cen_y + voxel_size_y / 2,cen_z - voxel_size_z / 2 },
-				{ cen_x - voxel_size_x / 2,cen_y + voxel_size_y / 2,cen_z - voxel_size_z / 2 },
-				{ cen_x - voxel_size_x / 2,cen_y - voxel_size_y / 2,cen_z + voxel_size_z / 2 },
-				{ cen_x + voxel_size_x / 2,cen_y - voxel_size_y / 2,cen_z + voxel_size_z / 2 },
-				{ cen_x + voxel_size_x / 2,cen_y + voxel_size_y / 2,cen_z + voxel_size_z / 2 },
-				{ cen_x - voxel_size_x / 2,cen_y + voxel_size_y / 2,cen_z + voxel_size_z / 2 } };
-
-			vein_voxels[i].corners[0] = vein_voxels[i].x*(height + 1) + vein_voxels[i].y +
-				vein_voxels[i].z*(width + 1)*(height + 1);
-			vein_voxels[i].corners[1] = (vein_voxels[i].x + 1)*(height + 1) + vein_voxels[i].y +
-				vein_voxels[i].z*(width + 1)*(height + 1);
-			vein_voxels[i].corners[2] = (vein_voxels[i].x + 1)*(height + 1) + (vein_voxels[i].y + 1) +
-				vein_voxels[i].z*(width + 1)*(height + 1);
-			vein_voxels[i].corners[3] = (vein_voxels[i].x + 0)*(height + 1) + (vein_voxels[i].y + 1) +
-				vein_voxels[i].z*(width + 1)*(height + 1);
-			vein_voxels[i].corners[4] = vein_voxels[i].x*(height + 1) + vein_voxels[i].y +
-				(vein_voxels[i].z + 1)*(width + 1)*(height + 1);
-			vein_voxels[i].corners[5] = (vein_voxels[i].x + 1)*(height + 1) + vein_voxels[i].y +
-				(vein_voxels[i].z + 1)*(width + 1)*(height + 1);
-			vein_voxels[i].corners[6] = (vein_voxels[i].x + 1)*(height + 1) + (vein_voxels[i].y + 1) +
-				(vein_voxels[i].z + 1)*(width + 1)*(height + 1);
-			vein_voxels[i].corners[7] = (vein_voxels[i].x + 0)*(height + 1) + (vein_voxels[i].y + 1) +
-				(vein_voxels[i].z + 1)*(width + 1)*(height + 1);
-
-			for (int k = 0;k<8;k++)
-			{
-				veincorners_pts[vein_voxels[i].corners[k]] = Point_3(ps[k][0], ps[k][1], ps[k][2]);
-			}
-			vein_voxels[i].corners_pts[0] = ps[0][0]; vein_voxels[i].corners_pts[1] = ps[0][1]; vein_voxels[i].corners_pts[2] = ps[0][2];
-			vein_voxels[i].corners_pts[3] = ps[3][0]; vein_voxels[i].corners_pts[4] = ps[3][1]; vein_voxels[i].corners_pts[5] = ps[3][2];
-			vein_voxels[i].corners_pts[6] = ps[1][0]; vein_voxels[i].corners_pts[7] = ps[1][1]; vein_voxels[i].corners_pts[8] = ps[1][2];
-			vein_voxels[i].corners_pts[9] = ps[2][0]; vein_voxels[i].corners_pts[10] = ps[2][1]; vein_voxels[i].corners_pts[11] = ps[2][2];
-			vein_voxels[i].corners_pts[12] = ps[4][0]; vein_voxels[i].corners_pts[13] = ps[4][1]; vein_voxels[i].corners_pts[14] = ps[4][2];
-			vein_voxels[i].corners_pts[15] = ps[7][0]; vein_voxels[i].corners_pts[16] = ps[7][1]; vein_voxels[i].corners_pts[17] = ps[7][2];
-			vein_voxels[i].corners_pts[18] = ps[5][0]; vein_voxels[i].corners_pts[19] = ps[5][1]; vein_voxels[i].corners_pts[20] = ps[5][2];
-			vein_voxels[i].corners_pts[21] = ps[6][0]; vein_voxels[i].corners_pts[22] = ps[6][1]; vein_voxels[i].corners_pts[23] = ps[6][2];
-		
-			mapvein_voxels[vein_voxels[i].index_] = vein_voxels[i];
+	//decodes one label stack on the thread pool, voxels keep image coordinates
+	void load_label(const std::vector<QString> &files, std::vector<PixelVessel> &voxels, PixelBox &box)
+	{
+		std::vector<std::vector<PixelVessel>> slice_voxels(files.size());
+		std::vector<PixelBox> slice_box(files.size());
+		for_each_mask_slice(files, [&](int i, SliceMask &mask) {
+			slice_voxels[i].reserve(mask.count());
+			mask.for_each_pixel([&](int x, int y) {
+				PixelVessel v; v.x = x; v.y = y; v.z = i;
+				slice_voxels[i].push_back(v);
+			});
+			slice_box[i] = mask.box;
+		});
+		for (int i = 0; i < files.size(); i++)
+		{
+			box.merge(slice_box[i]);
+			voxels.insert(voxels.end(), slice_voxels[i].begin(), slice_voxels[i].end());
 		}
+	}
 
-		for (int i = 0; i < artery_voxels.size(); i++)
-		{
-			PixelVessel p = artery_voxels[i];
-			double cen_x = float(p.x) / float(width - 1)*(2.0*image_wid - voxel_size_x)
-				- image_wid + voxel_size_x / 2.0;
-			double cen_y = float(p.y) / float(height - 1)*(2.0*image_hei - voxel_size_y)
-				- image_hei + voxel_size_y / 2.0;
-			double cen_z = float(p.z) / float(slice - 1)*(2.0*image_sli - voxel_size_z)
-				- image_sli + voxel_size_z / 2.0;
-			artery_voxels[i].center[0] = cen_x;
-			artery_voxels[i].center[1] = cen_y;
-			artery_voxels[i].center[2] = cen_z;
-
-			std::vector<std::vector<double>> ps = { 
-				{ cen_x - voxel_size_x / 2,cen_y - voxel_size_y / 2,cen_z - voxel_size_z / 2 },
-				{ cen_x + voxel_size_x / 2,cen_y - voxel_size_y / 2,cen_z - voxel_size_z / 2 },
-				{ cen_x + voxel_size_x / 2,cen_y + voxel_size_y / 2,cen_z - voxel_size_z / 2 },
-				{ cen_x - voxel_size_x / 2,cen_y + voxel_size_y / 2,cen_z - voxel_size_z / 2 },
-				{ cen_x - voxel_size_x / 2,cen_y - voxel_size_y / 2,cen_z + voxel_size_z / 2 },
-				{ cen_x + voxel_size_x / 2,cen_y - voxel_size_y / 2,cen_z + voxel_size_z / 2 },
-				{ cen_x + voxel_size_x / 2,cen_y + voxel_size_y / 2,cen_z + voxel_size_z / 2 },
-				{ cen_x - voxel_size_x / 2,cen_y + voxel_size_y / 2,cen_z + voxel_size_z / 2 } };
-
-			artery_voxels[i].corners[0] = artery_voxels[i].x*(height + 1) + artery_voxels[i].y +
-				artery_voxels[i].z*(width + 1)*(height + 1);
-			artery_voxels[i].corners[1] = (artery_voxels[i].x + 1)*(height + 1) + artery_voxels[i].y +
-				artery_voxels[i].z*(width + 1)*(height + 1);
-			artery_voxels[i].corners[2] = (artery_voxels[i].x + 1)*(height + 1) + (artery_voxels[i].y + 1) +
-				artery_voxels[i].z*(width + 1)*(height + 1);
-			artery_voxels[i].corners[3] = (artery_voxels[i].x + 0)*(height + 1) + (artery_voxels[i].y + 1) +
-				artery_voxels[i].z*(width + 1)*(height + 1);
-			artery_voxels[i].corners[4] = artery_voxels[i].x*(height + 1) + artery_voxels[i].y +
-				(artery_voxels[i].z + 1)*(width + 1)*(height + 1);
-			artery_voxels[i].corners[5] = (artery_voxels[i].x + 1)*(height + 1) + artery_voxels[i].y +
-				(artery_voxels[i].z + 1)*(width + 1)*(height + 1);
-			artery_voxels[i].corners[6] = (artery_voxels[i].x + 1)*(height + 1) + (artery_voxels[i].y + 1) +
-				(artery_voxels[i].z + 1)*(width + 1)*(height + 1);
-			artery_voxels[i].corners[7] = (artery_voxels[i].x + 0)*(height + 1) + (artery_voxels[i].y + 1) +
-				(artery_voxels[i].z + 1)*(width + 1)*(height + 1);
-
-			for (int k = 0; k < 8; k++)
-			{
-				arterycorners_pts[artery_voxels[i].corners[k]] = Point_3(ps[k][0], ps[k][1],ps[k][2]);
-			}
-			artery_voxels[i].corners_pts[0] = ps[0][0]; artery_voxels[i].corners_pts[1] = ps[0][1]; artery_voxels[i].corners_pts[2] = ps[0][2];
-			artery_voxels[i].corners_pts[3] = ps[3][0]; artery_voxels[i].corners_pts[4] = ps[3][1]; artery_voxels[i].corners_pts[5] = ps[3][2];
-			artery_voxels[i].corners_pts[6] = ps[1][0]; artery_voxels[i].corners_pts[7] = ps[1][1]; artery_voxels[i].corners_pts[8] = ps[1][2];
-			artery_voxels[i].corners_pts[9] = ps[2][0]; artery_voxels[i].corners_pts[10] = ps[2][1]; artery_voxels[i].corners_pts[11] = ps[2][2];
-			artery_voxels[i].corners_pts[12] = ps[4][0]; artery_voxels[i].corners_pts[13] = ps[4][1]; artery_voxels[i].corners_pts[14] = ps[4][2];
-			artery_voxels[i].corners_pts[15] = ps[7][0]; artery_voxels[i].corners_pts[16] = ps[7][1]; artery_voxels[i].corners_pts[17] = ps[7][2];
-			artery_voxels[i].corners_pts[18] = ps[5][0]; artery_voxels[i].corners_pts[19] = ps[5][1]; artery_voxels[i].corners_pts[20] = ps[5][2];
-			artery_voxels[i].corners_pts[21] = ps[6][0]; artery_voxels[i].corners_pts[22] = ps[6][1]; artery_voxels[i].corners_pts[23] = ps[6][2];
-		
-			mapartery_voxels[artery_voxels[i].index_] = artery_voxels[i];
-		}
+	bool load_cache(const std::string &file, uint64_t key) {
+		VolumeCache cache;
+		if (!cache.load(file, key) || cache.labels.size() != 3 || cache.surfaces.size() != 3)
+		{
+			return false;
+		}
+		width = cache.width;
+		height = cache.height;
+		slice = cache.slice;
+		grid_to_voxels(cache.labels[0], vein_voxels);
+		grid_to_voxels(cache.labels[1], artery_voxels);
+		grid_to_voxels(cache.labels[2], micro_voxels);
+		vein_surface.swap(cache.surfaces[0]);
+		artery_surface.swap(cache.surfaces[1]);
+		micro_surface.swap(cache.surfaces[2]);
+		return true;
+	}
 
-		//micro
-		for (int i = 0; i < micro_voxels.size(); i++)
-		{
-			PixelVessel p = micro_voxels[i];
-			double cen_x = float(p.x) / float(width - 1)*(2.0*image_wid - voxel_size_x)
-				- image_wid + voxel_size_x  / 2.0;
-			double cen_y = float(p.y) / float(height - 1)*(2.0*image_hei - voxel_size_y )
-				- image_hei + voxel_size_y  / 2.0;
-			double cen_z = float(p.z) / float(slice - 1)*(2.0*image_sli - voxel_size_z )
-				- image_sli + voxel_size_z  / 2.0;
-			micro_voxels[i].center[0] = cen_x;
-			micro_voxels[i].center[1] = cen_y;
-			micro_voxels[i].center[2] = cen_z;
-
-			std::vector<std::vector<double>> ps = {
-				{ cen_x - voxel_size_x  / 2,
-				cen_y - voxel_size_y  / 2,
-				cen_z - voxel_size_z  / 2 },
-				{ cen_x + voxel_size_x  / 2,
-				cen_y - voxel_size_y  / 2,
-				cen_z - voxel_size_z  / 2 },
-				{ cen_x + voxel_size_x  / 2,
-				cen_y + voxel_size_y  / 2,
-				cen_z - voxel_size_z  / 2 },
-				{ cen_x - voxel_size_x  / 2,
-				cen_y + voxel_size_y  / 2,
-				cen_z - voxel_size_z  / 2 },
-				{ cen_x - voxel_size_x  / 2,
-				cen_y - voxel_size_y  / 2,
-				cen_z + voxel_size_z  / 2 },
-				{ cen_x + voxel_size_x  / 2,
-				cen_y - voxel_size_y  / 2,
-				cen_z + voxel_size_z  / 2 },
-				{ cen_x + voxel_size_x  / 2,
-				cen_y + voxel_size_y  / 2,
-				cen_z + voxel_size_z  / 2 },
-				{ cen_x - voxel_size_x  / 2,
-				cen_y + voxel_size_y  / 2,
-				cen_z + voxel_size_z  / 2 } };
-
-			micro_voxels[i].corners[0] = micro_voxels[i].x*(height + 1) + micro_voxels[i].y +
-				micro_voxels[i].z*(width + 1)*(height + 1);
-			micro_voxels[i].corners[1] = (micro_voxels[i].x + 1)*(height + 1) + micro_voxels[i].y +
-				micro_voxels[i].z*(width + 1)*(height + 1);
-			micro_voxels[i].corners[2] = (micro_voxels[i].x + 1)*(height + 1) + (micro_voxels[i].y + 1) +
-				micro_voxels[i].z*(width + 1)*(height + 1);
-			micro_voxels[i].corners[3] = (micro_voxels[i].x + 0)*(height + 1) + (micro_voxels[i].y + 1) +
-				micro_voxels[i].z*(width + 1)*(height + 1);
-			micro_voxels[i].corners[4] = micro_voxels[i].x*(height + 1) + micro_voxels[i].y +
-				(micro_voxels[i].z + 1)*(width + 1)*(height + 1);
-			micro_voxels[i].corners[5] = (micro_voxels[i].x + 1)*(height + 1) + micro_voxels[i].y +
-				(micro_voxels[i].z + 1)*(width + 1)*(height + 1);
-			micro_voxels[i].corners[6] = (micro_voxels[i].x + 1)*(height + 1) + (micro_voxels[i].y + 1) +
-				(micro_voxels[i].z + 1)*(width + 1)*(height + 1);
-			micro_voxels[i].corners[7] = (micro_voxels[i].x + 0)*(height + 1) + (micro_voxels[i].y + 1) +
-				(micro_voxels[i].z + 1)*(width + 1)*(height + 1);
-
-			for (int k = 0; k < 8; k++)
-			{
-				microcorners_pts[micro_voxels[i].corners[k]] = Point_3(ps[k][0], ps[k][1], ps[k][2]);
-			}
-			micro_voxels[i].corners_pts[0] = ps[0][0]; micro_voxels[i].corners_pts[1] = ps[0][1]; micro_voxels[i].corners_pts[2] = ps[0][2];
-			micro_voxels[i].corners_pts[3] = ps[3][0]; micro_voxels[i].corners_pts[4] = ps[3][1]; micro_voxels[i].corners_pts[5] = ps[3][2];
-			micro_voxels[i].corners_pts[6] = ps[1][0]; micro_voxels[i].corners_pts[7] = ps[1][1]; micro_voxels[i].corners_pts[8] = ps[1][2];
-			micro_voxels[i].corners_pts[9] = ps[2][0]; micro_voxels[i].corners_pts[10] = ps[2][1]; micro_voxels[i].corners_pts[11] = ps[2][2];
-			micro_voxels[i].corners_pts[12] = ps[4][0]; micro_voxels[i].corners_pts[13] = ps[4][1]; micro_voxels[i].corners_pts[14] = ps[4][2];
-			micro_voxels[i].corners_pts[15] = ps[7][0]; micro_voxels[i].corners_pts[16] = ps[7][1]; micro_voxels[i].corners_pts[17] = ps[7][2];
-			micro_voxels[i].corners_pts[18] = ps[5][0]; micro_voxels[i].corners_pts[19] = ps[5][1]; micro_voxels[i].corners_pts[20] = ps[5][2];
-			micro_voxels[i].corners_pts[21] = ps[6][0]; micro_voxels[i].corners_pts[22] = ps[6][1]; micro_voxels[i].corners_pts[23] = ps[6][2];
-
-			mapmicro_voxels[micro_voxels[i].index_] = micro_voxels[i];
-		}
+	bool save_cache(const std::string &file, uint64_t key) {
+		VolumeCache cache;
+		cache.width = width;
+		cache.height = height;
+		cache.slice = slice;
+		cache.labels.resize(3);
+		voxels_to_grid(vein_voxels, cache.labels[0]);
+		voxels_to_grid(artery_voxels, cache.labels[1]);
+		voxels_to_grid(micro_voxels, cache.labels[2]);
+		cache.surfaces.push_back(vein_surface);
+		cache.surfaces.push_back(artery_surface);
+		cache.surfaces.push_back(micro_surface);
+		return cache.save(file, key);
 	}
 
-	void compute_surface(std::map<int, PixelVessel> map_voxels, std::vector<std::vector<int>> &faces) {
-		for (auto it = map_voxels.begin();it!= map_voxels.end();it++)
-		{
-			if (it->second.bvisited)
-			{
-				continue;
-			}
-			visit_neighbor(it->first, map_voxels);
-		}
-		for (auto it = map_voxels.begin(); it != map_voxels.end(); it++)
+	void voxels_to_grid(const std::vector<PixelVessel> &voxels, OccupancyGrid &grid) {
+		grid.resize(width, height, slice);
+		for (int i = 0; i < voxels.size(); i++)
 		{
-			if (it->second.xfacet)
-			{
-				std::vector<int> facet1 = {it->second.corners[1],it->second.corners[2], 
-					it->second.corners[6]};
-				std::vector<int> facet2 = { it->second.corners[1],
-					it->second.corners[6], it->second.corners[5] };
-				faces.push_back(facet1);
-				faces.push_back(facet2);
-			}
-			if (it->second.x_facet)
-			{
-				std::vector<int> facet1 = { it->second.corners[0],it->second.corners[4],
-					it->second.corners[7] };
-				std::vector<int> facet2 = { it->second.corners[0],
-					it->second.corners[7], it->second.corners[3] };
-				faces.push_back(facet1);
-				faces.push_back(facet2);
-			}
-			if (it->second.yfacet)
-			{
-				std::vector<int> facet1 = { it->second.corners[2],it->second.corners[3],
-					it->second.corners[7] };
-				std::vector<int> facet2 = { it->second.corners[2],
-					it->second.corners[7], it->second.corners[6] };
-				faces.push_back(facet1);
-				faces.push_back(facet2);
-			}
-			if (it->second.y_facet)
-			{
-				std::vector<int> facet1 = { it->second.corners[0],it->second.corners[1],
-					it->second.corners[5]};
-				std::vector<int> facet2 = { it->second.corners[0],
-					it->second.corners[5], it->second.corners[4] };
-				faces.push_back(facet1);
-				faces.push_back(facet2);
-			}
-			if (it->second.zfacet)
-			{
-				std::vector<int> facet1 = { it->second.corners[4],it->second.corners[5],
-					it->second.corners[6] };
-				std::vector<int> facet2 = { it->second.corners[4],
-					it->second.corners[6], it->second.corners[7] };
-				faces.push_back(facet1);
-				faces.push_back(facet2);
-			}
-			if (it->second.z_facet)
-			{
-				std::vector<int> facet1 = { it->second.corners[0],it->second.corners[3],
-					it->second.corners[2] };
-				std::vector<int> facet2 = { it->second.corners[0],
-					it->second.corners[2], it->second.corners[1] };
-				faces.push_back(facet1);
-				faces.push_back(facet2);
-			}
+			grid.set(voxels[i].x, voxels[i].y, voxels[i].z);
 		}
 	}
 
-
-	void visit_neighbor(int vox,std::map<int, PixelVessel> &voxels)
-	{
-		if (voxels.at(vox).bvisited)
-		{
-			return;
-		}
-		voxels.at(vox).bvisited = true;
-
-		PixelVessel v = voxels.at(vox);
-		//x
-		if (v.x < width-1)
-		{			
-			int xplus = vox + height;
-			if (voxels.find(xplus) != voxels.end())
-			{
-				voxels.at(vox).xfacet = 0;
-				//visit_neighbor(xplus, voxels);
-			}
-		}
-		//-x
-		if (v.x > 0)
-		{
-			int xminus = vox - height;
-			if (voxels.find(xminus) != voxels.end())
-			{
-				voxels.at(vox).x_facet = 0;
-				//visit_neighbor(xminus, voxels);
-			}
-		}
-		//y
-		if (v.y < height-1)
-		{
-			int yplus = vox + 1;
-			if (voxels.find(yplus) != voxels.end())
-			{
-				voxels.at(vox).yfacet = 0;
-				//visit_neighbor(yplus, voxels);
-			}
-		}
-		//-y
-		if (v.y >0)
-		{
-			int yminus = vox - 1;
-			if (voxels.find(yminus) != voxels.end())
-			{
-				voxels.at(vox).y_facet = 0;
-				//visit_neighbor(yminus, voxels);
-			}
-		}
-		//z
-		if (v.z <slice-1)
-		{
-			int zplus = vox + height*width;
-			if (voxels.find(zplus) != voxels.end())
-			{
-				voxels.at(vox).zfacet = 0;
-				//visit_neighbor(zplus,voxels);
-			}
-		}
-		//-z
-		if (v.z > 0)
-		{
-			int zminus = vox - height*width;
-			if (voxels.find(zminus) != voxels.end())
-			{
-				voxels.at(vox).z_facet = 0;
-				//visit_neighbor(zminus, voxels);
-			}
-		}
+	//voxels come back in slice order, as load_label() emits them
+	void grid_to_voxels(const OccupancyGrid &grid, std::vector<PixelVessel> &voxels) {
+		voxels.clear();
+		voxels.reserve(grid.count());
+		grid.for_each_voxel([&](int x, int y, int z) {
+			PixelVessel v; v.x = x; v.y = y; v.z = z;
+			v.index_ = x*height + y + z*width*height;
+			voxels.push_back(v);
+		});
 	}
 
-	void convert_save(std::map<int, Point_3> corners_pts,
-		std::vector<std::vector<int>> &faces,std::string file) {
+	//the three labels in one pass, interfaces between them are extracted once
+	void compute_surfaces() {
+		const std::vector<int> &priority = vessel_label_priority();
+		MultiLabelSurface surfaces;
+		surfaces.extract(label_bricks, priority, voxel_geometry(), 0, MERGE_FACES && !SMOOTH_SURFACES && !TAUBIN_ITERATIONS);
+		if (SMOOTH_SURFACES)
+		{
+			surfaces.place(SurfaceNets(label_bricks, priority, 0));
+		}
+		std::cout << "pre-compute done!!! " << surfaces.nb_triangles() << " triangles, "
+			<< surfaces.nb_interface_triangles() << " on interfaces" << std::endl;
+		smooth_voxel_surface(surfaces, voxel_geometry(), TAUBIN_ITERATIONS);
+		surfaces.label_mesh(0, vein_surface);
+		surfaces.label_mesh(1, artery_surface);
+		surfaces.label_mesh(2, micro_surface);
 #if SAVE_FILES
-		std::ofstream fout_obj;
-		fout_obj.open(file.c_str());
-		if (!fout_obj.is_open())
-			return;
-#endif	
-		int i = 0;
-		std::map<int, int> inde_t;
-		for (auto it = corners_pts.begin(); it != corners_pts.end(); it++,i++)
-		{
-#if SAVE_FILES
-			fout_obj << "v" << " "
-				<< it->second[0] << " "
-				<< it->second[1] << " "
-				<< it->second[2] << "\n";
+		save_surface(vein_surface, "vessel/vein.ply");
+		save_surface(artery_surface, "vessel/artery.ply");
+		save_surface(micro_surface, "vessel/micro.ply");
 #endif
-			inde_t[it->first] = i;
-		}
-		for (int fit = 0; fit < faces.size(); fit++)
+	}
+
+	//format by extension, see MeshStreamWriter
+	void save_surface(const IndexedMesh &surface, std::string file) {
+		if (!MeshStreamWriter::write(surface, file))
 		{
-			for (int k = 0;k<faces[fit].size();k++)
-			{
-				if (inde_t.find(faces[fit][k]) == inde_t.end())
-				{
-					std::cout << "wrong index" << std::endl;
-				}
-				faces[fit][k] = inde_t.at(faces[fit][k]);
-			}
-#if SAVE_FILES
-			fout_obj << "f " << faces[fit][0] + 1 << " " << faces[fit][1] + 1 << " " << faces[fit][2] + 1 << "\n";
-#endif
+			std::cout << "wrong: cannot write " << file << std::endl;
+			return;
 		}
-#if SAVE_FILES
-		fout_obj.close();
-#endif
-
 		std::cout << "convert and save done!!!" << std::endl;
 	}
 
@@ -968,81 +586,18 @@ private:
 
 	}
 
-	void compute_normal(std::map<int, Point_3> corners_pts,
-		std::vector<std::vector<int>> faces_, std::vector<Vector_3> &vnors,
-		std::vector<float> &smooth_faces) {
-
-		Meshu mesh;
-		read_Meshu(corners_pts, faces_, mesh);
-
-		auto fnormals = mesh.add_property_map<face_descriptor, Vector_3>
-			("f:normals", CGAL::NULL_VECTOR).first;
-		auto vnormals = mesh.add_property_map<vertex_descriptor, Vector_3>
-			("v:normals", CGAL::NULL_VECTOR).first;
-
-		CGAL::Polygon_mesh_processing::compute_normals(mesh,
-			vnormals,
-			fnormals,
-			CGAL::Polygon_mesh_processing::parameters::vertex_point_map(mesh.points()).
-			geom_traits(K()));
-
-		for (vertex_descriptor vd : vertices(mesh)) {
-			vnors.push_back(vnormals[vd]);
-		}
-		std::cout << "Vertex normals done:" << std::endl;
-
-		if (corners_pts.size() != vnors.size())
-		{
-			std::cout << "wrong: unequal size of corner and normals " << std::endl;
-		}
-
-		std::vector<Point_3> vs;
-		for (auto it = corners_pts.begin(); it != corners_pts.end(); it++)
-		{
-			vs.push_back(it->second);
-		}
-
-		for (int i = 0;i<faces_.size();i++)
-		{
-			for (int j = 0;j<faces_[i].size();j++)
-			{
-				smooth_faces.push_back(float(vnors[faces_[i][j]].x()));
-				smooth_faces.push_back(float(vnors[faces_[i][j]].y()));
-				smooth_faces.push_back(float(vnors[faces_[i][j]].z()));
-				smooth_faces.push_back(float(vs[faces_[i][j]].x()));
-				smooth_faces.push_back(float(vs[faces_[i][j]].y()));
-				smooth_faces.push_back(float(vs[faces_[i][j]].z()));
-			}
-		}
-	}
-
 private:
 
 	std::vector<PixelVessel> vein_voxels;
 	std::vector<PixelVessel> artery_voxels;
 	std::vector<PixelVessel> micro_voxels;
-
-	std::map<int, PixelVessel> mapvein_voxels;
-	std::map<int, PixelVessel> mapartery_voxels;
-	std::map<int, PixelVessel> mapmicro_voxels;
+	BrickVolume label_bricks;//cropped labels, only filled when the cache misses
+	VoxelSpacing spacing;
 
 	//surface
-	std::map<int, Point_3> veincorners_pts;
-	std::vector<std::vector<int>> vein_faces;
-	std::vector<float> vein_smooth_faces;
-
-	std::map<int, Point_3> arterycorners_pts;
-	std::vector<std::vector<int>> artery_faces;
-	std::vector<float> artery_smooth_faces;
-
-	std::map<int, Point_3> microcorners_pts;
-	std::vector<std::vector<int>> micro_faces;
-	std::vector<float> micro_smooth_faces;
-
-	//normals
-	std::vector<Vector_3> vein_normals;
-	std::vector<Vector_3> artery_normals;
-	std::vector<Vector_3> micro_normals;
+	IndexedMesh vein_surface;
+	IndexedMesh artery_surface;
+	IndexedMesh micro_surface;
 };
 
 
@@ -46,6 +46,8 @@
 #include <geogram_gfx/gui/simple_application.h>
 #include <geogram_gfx/GLUP/GLUP_private.h>
 #include "load_vessel.h"
+#include "surface_gfx.h"
+#include "voxel_gfx.h"
 
 namespace {
 
@@ -68,9 +70,13 @@ namespace {
 			vein_voxels = v.get_vein();
 			artery_voxels = v.get_artery();
 			micro_voxels = v.get_micro();
-			vein_faces = v.get_vein_smooth_faces();
-			artery_faces = v.get_artery_smooth_faces();
-			micro_faces = v.get_micro_smooth_faces();
+			voxel_geometry = v.voxel_geometry();
+			vein_surface = v.get_vein_surface();
+			artery_surface = v.get_artery_surface();
+			micro_surface = v.get_micro_surface();
+			vein_gfx.set_mesh(&vein_surface);
+			artery_gfx.set_mesh(&artery_surface);
+			micro_gfx.set_mesh(&micro_surface);
 
 			mesh_ = false;
 			point_size_ = 10.0f;
@@ -89,9 +95,7 @@ namespace {
 			micro_color_ = vec4f(0.8f, 0.62f, 0.13f, 1.0f);
 			micro_backcolor_ = vec4f(0.5f, 0.4f, 0.08f, 1.0f);
 
-			image_wid = IMAGEWIDTHSIZE;
-			image_hei = IMAGEWIDTHSIZE / width*height;
-			image_sli = IMAGEWIDTHSIZE / width*slice*SCALEVOXEL;
+			voxel_geometry.half_size(image_wid, image_hei, image_sli);
 
 			// Define the 3d region that we want to display
 			// (xmin, ymin, zmin, xmax, ymax, zmax)
@@ -106,6 +110,9 @@ namespace {
 		 * \copydoc SimpleApplication::GL_terminate()
 		 */
 		void GL_terminate() override {
+			vein_gfx.GL_terminate();
+			artery_gfx.GL_terminate();
+			micro_gfx.GL_terminate();
 			SimpleApplication::GL_terminate();
 		}
 
@@ -246,35 +253,17 @@ namespace {
 				if (do_draw_vein)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, vein_colors);
-					glupBegin(GLUP_POINTS);
-					for (int i = 0; i < vein_voxels.size(); i++)
-					{
-						glupVertex3f(vein_voxels[i].center[0], 
-							vein_voxels[i].center[1], vein_voxels[i].center[2]);
-					}
-					glupEnd();
+					draw_voxel_points(vein_voxels, voxel_geometry);
 				}
 				if (do_draw_artery)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, artery_colors);
-					glupBegin(GLUP_POINTS);
-					for (int i = 0; i < artery_voxels.size(); i++)
-					{
-						glupVertex3f(artery_voxels[i].center[0], 
-							artery_voxels[i].center[1], artery_voxels[i].center[2]);
-					}
-					glupEnd();
+					draw_voxel_points(artery_voxels, voxel_geometry);
 				}
 				if (do_draw_micro)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, micro_colors);
-					glupBegin(GLUP_POINTS);
-					for (int i = 0; i < micro_voxels.size(); i++)
-					{
-						glupVertex3f(micro_voxels[i].center[0],
-							micro_voxels[i].center[1], micro_voxels[i].center[2]);
-					}
-					glupEnd();
+					draw_voxel_points(micro_voxels, voxel_geometry);
 				}
 			} break;
 
@@ -287,32 +276,12 @@ namespace {
 				if (do_draw_vein)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, vein_colors);
-					glupBegin(GLUP_TRIANGLES);
-					for (int i = 0; i < vein_faces.size();)
-					{
-						glupNormal3d(vein_faces[i],
-							vein_faces[i + 1], vein_faces[i + 2]);
-						i += 3;
-						glupVertex3d(vein_faces[i],
-							vein_faces[i + 1], vein_faces[i + 2]);
-						i += 3;
-					}
-					glupEnd();
+					vein_gfx.draw();
 				}
 				if (do_draw_artery)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, artery_colors);
-					glupBegin(GLUP_TRIANGLES);
-					for (int i = 0; i < artery_faces.size();)
-					{
-						glupNormal3d(artery_faces[i],
-							artery_faces[i+1], artery_faces[i+2]);
-						i += 3;
-						glupVertex3d(artery_faces[i],
-							artery_faces[i+1], artery_faces[i+2]);
-						i += 3;
-					}
-					glupEnd();
+					artery_gfx.draw();
 				}
 				if (do_draw_micro)
 				{
@@ -324,17 +293,7 @@ namespace {
 					
 					glupSetColor4fv(GLUP_FRONT_COLOR, micro_colors);
 					glupSetColor4fv(GLUP_BACK_COLOR, micro_backcolors);
-					glupBegin(GLUP_TRIANGLES);
-					for (int i = 0; i < micro_faces.size();)
-					{
-						glupNormal3d(micro_faces[i],
-							micro_faces[i + 1], micro_faces[i + 2]);
-						i += 3;
-						glupVertex3d(micro_faces[i],
-							micro_faces[i + 1], micro_faces[i + 2]);
-						i += 3;
-					}
-					glupEnd();
+					micro_gfx.draw();
 
 					glupDisable(GLUP_ALPHA_DISCARD);
 				}
@@ -347,46 +306,19 @@ namespace {
 				if (do_draw_vein)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, vein_colors);
-					glupBegin(GLUP_HEXAHEDRA);
-					for (int i = 0; i < vein_voxels.size(); i++)
-					{
-						PixelVessel p = vein_voxels[i];
-						for (int k = 0; k < 8; k++)
-						{
-							glupVertex3f(p.corners_pts[k * 3], p.corners_pts[k * 3 + 1], p.corners_pts[k * 3 + 2]);
-						}
-					}
-					glupEnd();
+					draw_voxel_hexahedra(vein_voxels, voxel_geometry);
 				}
 				if (do_draw_artery)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, artery_colors);
-					glupBegin(GLUP_HEXAHEDRA);
-					for (int i = 0; i < artery_voxels.size(); i++)
-					{
-						PixelVessel p = artery_voxels[i];
-						for (int k = 0; k < 8; k++)
-						{
-							glupVertex3f(p.corners_pts[k * 3], p.corners_pts[k * 3 + 1], p.corners_pts[k * 3 + 2]);
-						}
-					}
-					glupEnd();
+					draw_voxel_hexahedra(artery_voxels, voxel_geometry);
 				}
 
 				glupSetCellsShrink(shrink_);
 				if (do_draw_micro)
 				{
 					glupSetColor4fv(GLUP_FRONT_COLOR, micro_colors);
-					glupBegin(GLUP_HEXAHEDRA);
-					for (int i = 0; i < micro_voxels.size(); i++)
-					{
-						PixelVessel p = micro_voxels[i];
-						for (int k = 0; k < 8; k++)
-						{
-							glupVertex3f(p.corners_pts[k * 3], p.corners_pts[k * 3 + 1], p.corners_pts[k * 3 + 2]);
-						}
-					}
-					glupEnd();
+					draw_voxel_hexahedra(micro_voxels, voxel_geometry);
 				}
 				glupSetCellsShrink(0.0);
 				
@@ -440,10 +372,14 @@ namespace {
 		std::vector<PixelVessel> vein_voxels;
 		std::vector<PixelVessel> artery_voxels;
 		std::vector<PixelVessel> micro_voxels;
-
-		std::vector<float> vein_faces;
-		std::vector<float> artery_faces;
-		std::vector<float> micro_faces;
+		VoxelGeometry voxel_geometry;
+
+		IndexedMesh vein_surface;
+		IndexedMesh artery_surface;
+		IndexedMesh micro_surface;
+		SurfaceGfx vein_gfx;
+		SurfaceGfx artery_gfx;
+		SurfaceGfx micro_gfx;
 	};
       
 }